@@ -1,573 +1,843 @@
-
-//
-// Example program for bcm2835 library
-// Shows how to interface with SPI to transfer a number of bytes to and from an SPI device
-//
-// After installing bcm2835, you can build this 
-// with something like:
-// gcc -o spin spin.c -l bcm2835
-// sudo ./spin
-//
-// Or you can test it before installing with:
-// gcc -o spin -I ../../src ../../src/bcm2835.c spin.c
-// sudo ./spin
-//
-// Author: Mike McCauley
-// Copyright (C) 2012 Mike McCauley
-// $Id: RF22.h,v 1.21 2012/05/30 01:51:25 mikem Exp $
-
-
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-#include <wiringPi.h>
-#include <bcm2835.h>
-#include <errno.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-//#include <syslog.h>
-#include <time.h>
-//#include <signal.h>
-#include <unistd.h>
-
-
-#define SPI_CRASH 1
-#define SPI_RESET 22 // Wirint Pi pin 22
-#define ReadyIn 21 // Physical pin 29, BCM pin 5, Wiring Pi pin 21
-#define TX_RX_DELAY 1
-#define TOGGLE_DELAY 1000
-#define DEBUG 1
-#define DEBUGBCM 0
-#define MAXPI_BYTES 261
-#define PI_SER_ST_INDEX 249
-
-int socStatus = -1;
-
-/* SPI device is crashed or not */
-int isSPIDevCrashed(unsigned char read_data[]) {
-
-    unsigned char SPI_DEV_ID[] = {0xE9,0x07,0x20,0x12};
-    int i =0;
-    int crashed = 0;
-
-    for (i=0;i<=3;i++) {
-        if(SPI_DEV_ID[i]!=read_data[i+5]) {
-            crashed = 1;
-            break;
-        } else {
-            crashed = 0;
-        }
-    }
-
-    return crashed;
-}
-
-
-/**
-    Signal Handler / can be used to gracefully shut down the 
-*/
-/*
-void sig_handler(int signo)
-{
-   switch ( signo ) {
-       case SIGINT:
-        syslog(LOG_INFO,"received SIGINT");
-        break;
-       case SIGTERM:
-        syslog(LOG_INFO,"recieved SIGTERM");
-        break;
-       default:
-        printf( "recieved signal %d",signo);
-   }
-    syslog(LOG_INFO," gracefully shutdown \n");
-   closelog();
-    exit(0);
-}*/
-
-
-/**
- * @return - long  - returns the Serial number of the Pi
- * getPiSerial function reads the cpuinfo from /proc/cpuinfo and reads the Serial
- * and reutns the 32 bit long
- *
- * */
-
-unsigned long getPiSerial() {
-
-    char *recv_data =(char *) malloc(17);
-    FILE *f = fopen("/proc/cpuinfo", "r");
-    if (!f) {
-        //  strcpy(recv_data,"error");
-        return -1 ;// recv_data;
-    }
-    char line[256];
-    while (fgets(line, 256, f)) {
-        if (strncmp(line, "Serial", 6) == 0) {
-            strcpy(recv_data, strchr(line, ':') + 2);
-        }
-
-    }
-
-
-    fclose(f);
-
-    return (unsigned long)strtoul(recv_data,NULL,16);
-}
-
-/**
- * send all - used to send the half buffer 
- */
-int send_all(int socket_in, const char *buffer, size_t length, int flags)
-{
-    ssize_t n;
-    const char *p = buffer;
-    //syslog(LOG_INFO,"send_all %zd  - %d \n", length, socket_in);
-    while (length > 0)
-    {
-        printf(" calling send %s - p - %s \n", buffer, p);
-        n = send(socket_in, p, length, flags);
-        if( n < 0 ) {
-            socStatus = -1;
-            //syslog(LOG_ERR,"Send failed - %zd", n);
-            return n;
-        }
-        printf("Send successful - %zd", n);
-        if (n == 0) break;
-        p += n;
-
-        length -= n;
-
-
-    }
-    return (n <= 0) ? -1 : 0;
-}
-
-/*
- * is connected is used to check if soclet is connected
- *
- */
-
-int isConnected(int socket_fd){
-
-    if( socStatus == -1 ) {
-        return -1;
-    }
-
-    int error = 0;
-    //  printf("is connected called \n");
-    socklen_t len = sizeof (error);
-
-    int retval = getsockopt (socket_fd, SOL_SOCKET,SO_ERROR , &error, &len);
-
-    //printf(" retval recieved %d with err  - %d ", retval , error );
-    if (retval != 0) {
-
-        fprintf(stderr, "error getting socket error code: %s\n", strerror(retval));
-        //close(socket_fd);
-        return -1;
-    }
-
-    if (error != 0) {
-        fprintf(stderr, "socket error: %s\n", strerror(error));
-        //close(socket_fd);
-        return -2;
-    }
-    printf( "return val - %d \n", retval);
-
-    return 1;
-}
-
-
-void printTimeTake( clock_t p_t2, clock_t  p_t1, char* msg ) {
-
-    printf("%s - %f \n",msg, ((double) (p_t2 - p_t1)/CLOCKS_PER_SEC));
-
-
-}
-    
-void dummy_data_for_initialization(void) {
-    /*there is bug in SPI device. for that we need to do this. */
-    
-    unsigned char bufInit[] = {0x0b}; // Dummy data for initialization.
-    bcm2835_spi_transfern(bufInit, sizeof(bufInit));
-    delay(TX_RX_DELAY);
-}
-
-
-
-int main(int argc, char **argv)
-{
-    clock_t t1,t2,t3,t4;
-
-    
-    // Initializing syslog 
-    //openlog("slog", LOG_PID|LOG_CONS, LOG_USER);
-    // syslog(LOG_INFO, "A different kind of Hello world ... ");
-    /*if (signal(SIGINT, sig_handler) == SIG_ERR)
-        syslog(LOG_ERR,"can't catch SIGINT");
-
-    if (signal(SIGTERM, sig_handler) == SIG_ERR)
-        syslog(LOG_ERR,"can't catch SIGTERM");
-
-    if( signal(SIGKILL,sig_handler) == SIG_ERR) 
-	syslog(LOG_ERR,"cant catch SIGKILL");
-    */
-    // If you call this, it will not actually access the GPIO
-    // Use for testing
-    if (DEBUGBCM) {
-        bcm2835_set_debug(1);
-    }
-   
-    // run as sudo
-    if (!bcm2835_init())
-    {
-      printf("bcm2835_init failed. Are you running as root??\n");
-      return 1;
-    }
-
-    if (!bcm2835_spi_begin())
-    {
-      printf("bcm2835_spi_begin failed. Are you running as root??\n");
-      return 1;
-    }
-    
-    bcm2835_spi_begin();
-    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);      // The default
-    bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);                   // The default
-    bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_32);    // 32 = 7.8125MHz on Rpi2, 12.5MHz on RPI3  
-    bcm2835_spi_chipSelect(BCM2835_SPI_CS0);                      // The default
-    bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, LOW);      // the default
-    
-
-    long serPi = getPiSerial();
-    // Send a some bytes to the slave and simultaneously read 
-    // some bytes back from the slave
-    // Most SPI devices expect one or 2 bytes of command, after which they will send back
-    // some data. In such a case you will have the command bytes first in the mpi_rpi_tx_rx_data,
-    // followed by as many 0 bytes as you expect returned data bytes. After the transfer, you 
-    // Can the read the reply bytes from the mpi_rpi_tx_rx_data.
-    // If you tie MISO to MOSI, you should read back what was sent.
-    
-#ifdef ENABLE_SERVER_SEND
-    char ipaddr[20] = "192.168.1.164";
-    int port = 5019;
-    
-    // Initializing syslog 
-    //openlog("slog", LOG_PID|LOG_CONS, LOG_USER);
-    // syslog(LOG_INFO, "A different kind of Hello world ... ");
-    //closelog();
-
-    if ( argc >= 2 ) {   
-        // argc should be 2 for correct execution
-        // We print argv[0] assuming it is the program name
-        printf( " args 1 =  " );
-        strcpy(ipaddr, argv[1]);
-        if( argc == 3 )
-            port = atoi(argv[2]);
-    }
-
-    int clientSocket, bytesTrasfered;
-    struct sockaddr_in serverAddr;
-    socklen_t addr_size;
-   
-    //clientConnect:
-    clientSocket = socket(PF_INET, SOCK_STREAM, 0);
-#endif //ENABLE_SERVER_SEND
-
-    int count = 1;
-    
-    // setting up wiring pi RESET Pin & ReadyIn Pin
-    wiringPiSetup();
-    pinMode(ReadyIn, INPUT);
-    pinMode(SPI_RESET, OUTPUT);
-    digitalWrite (SPI_RESET, LOW);
-    delay(TOGGLE_DELAY);
-    digitalWrite (SPI_RESET, HIGH);
-    delay(TOGGLE_DELAY);
-
-    printf("Starting\n") ;
-    printf("Stage1 Initiating SPI connection\n") ;
-
-   /* unsigned char bufInit[] = {0x0b}; // Dummy data for initialization.
-    bcm2835_spi_transfern(bufInit, sizeof(bufInit));
-    delay(TX_RX_DELAY);*/
-    dummy_data_for_initialization();
-    
-    //SPICRASHED1 START
-    if(SPI_CRASH) {
-        unsigned char SPI_ID_R1[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
-        bcm2835_spi_transfern(SPI_ID_R1, sizeof(SPI_ID_R1));
-        delay(TX_RX_DELAY);
-        // buf will now be filled with the data that was read from the slave
-        if(DEBUG) {
-        printf("Read from SPI_ID_R1: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", SPI_ID_R1[0],SPI_ID_R1[1],SPI_ID_R1[2],SPI_ID_R1[3],SPI_ID_R1[4],SPI_ID_R1[5], SPI_ID_R1[6], SPI_ID_R1[7], SPI_ID_R1[8]);
-        }
-
-        if(isSPIDevCrashed(SPI_ID_R1)) {
-            /* toggle SPI_RESET Pin */
-            digitalWrite (SPI_RESET, LOW);
-            delay(TOGGLE_DELAY);
-            
-            digitalWrite (SPI_RESET, HIGH);
-            delay(TOGGLE_DELAY);
-            /*
-            unsigned char bufInit_R2[] = {0x0b}; // Dummy data for initialization.
-            bcm2835_spi_transfern(bufInit_R2, sizeof(bufInit_R2));
-            delay(TX_RX_DELAY); */
-            dummy_data_for_initialization();
-            unsigned char SPI_ID_R2[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
-            bcm2835_spi_transfern(SPI_ID_R2, sizeof(SPI_ID_R2));
-            delay(TX_RX_DELAY);
-            // buf will now be filled with the data that was read from the slave
-            if(DEBUG) {
-            printf("Read from SPI_ID_R2: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", SPI_ID_R2[0],SPI_ID_R2[1],SPI_ID_R2[2],SPI_ID_R2[3],SPI_ID_R2[4],SPI_ID_R2[5], SPI_ID_R2[6], SPI_ID_R2[7], SPI_ID_R2[8]);
-            }
-            
-            if(isSPIDevCrashed(SPI_ID_R2)) {
-                printf("SPI Device crashed1\n");
-            } else {
-                printf("SPI Device is fine1\n");    
-            }
-        } else {
-            printf("SPI Device is fine2\n");
-        }
-    }
-    //SPICRASHED1 END
-
-    unsigned char bufM0[] = {0x02,0x10,0x80,0x00,0xff,0xff,0xfd,0xff,0x00};
-    //spi_write_word(0x108000,0xfffdffff); line # 109 from photon code
-    bcm2835_spi_transfern(bufM0, sizeof(bufM0));
-    delay(TX_RX_DELAY);
-
-    if(DEBUG) {
-        unsigned char buf0[] = { 0x0b, 0x10, 0x80, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
-        bcm2835_spi_transfern(buf0, sizeof(buf0));
-        delay(TX_RX_DELAY);
-        // buf will now be filled with the data that was read from the slave
-        printf("Read from SPI0: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", buf0[0],buf0[1],buf0[2],buf0[3],buf0[4],buf0[5], buf0[6], buf0[7], buf0[8]);
-    }
-
-    unsigned char bufM1[] = {0x02,0x10,0x80,0x1c,0x48,0xaa,0x0a,0x00,0x00};
-    //spi_write_word(0x10801c,0xaaa48);  line # 152 from photon code 
-    bcm2835_spi_transfern(bufM1, sizeof(bufM1));
-    delay(TX_RX_DELAY);    
- 
-#ifdef ENABLE_SERVER_SEND
-    serverAddr.sin_family = AF_INET;
-    
-    /* Set port number, using htons function to use proper byte order */
-    serverAddr.sin_port = htons(port);
-    
-    /* Set IP address to localhost */
-    serverAddr.sin_addr.s_addr = inet_addr(ipaddr);
-    
-    /* Set all bits of the padding field to 0 */
-    memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);
-                       
-    /*---- Connect the socket to the server using the address struct ----*/
-    addr_size = sizeof serverAddr;
-
-#endif //ENABLE_SERVER_SEND
-
-
-    while(1)
-    {
-        printf("Entering server Send \n");
-#ifdef ENABLE_SERVER_SEND
-        int retConnection = isConnected(clientSocket);
-        if(0 > retConnection ){
-
-            if( -2 == retConnection ) 
-                clientSocket = socket(PF_INET, SOCK_STREAM, 0);
-            //waitfor connect
-            //
-            //
-            do {
-
-                socStatus = connect(clientSocket, (struct sockaddr *) &serverAddr, addr_size);
-
-            } while ( socStatus !=  0 );
-        }
-
-#endif //ENABLE_SERVER_SEND
-
-        printf("Stage2\n");
-        
-        unsigned char bufM2[] = {0x02,0x10,0x70,0x70,0x00,0x00,0x00,0x00,0x00};
-        //spi_write_word(0x107070,0x0); line # 228 from photon code
-        bcm2835_spi_transfern(bufM2, sizeof(bufM2));
-        delay(TX_RX_DELAY);
-
-#ifdef PROFILE
-        t1 = clock(); /* time starts now */
-#endif //PROFILE
-        printf("Waiting for ReadyIn\n");
-        while(digitalRead(ReadyIn) == 0);  //Wait for Device to make Pin to 1
-        printf("Stage3\n");
-#ifdef PROFILE
-        t2 = clock(); //millis();
-#endif //PROFILE    
-        unsigned char bufM3[] = {0x02,0x10,0x80,0x1c,0x40,0xaa,0x0a,0x00,0x00};
-        //spi_write_word(0x10801c,0xaaa40);  //GPIO7 (SPIS_IO1/SPIS_MISO) is in SPI mode, line # 233 from photon code
-        bcm2835_spi_transfern(bufM3, sizeof(bufM3));
-        delay(TX_RX_DELAY);
-    
-        if(DEBUG) {
-            unsigned char buf3[] = {0x0b,0x10,0x80,0x1c,0xff,0xff,0xff,0xff,0xff};
-            bcm2835_spi_transfern(buf3, sizeof(buf3));
-            delay(TX_RX_DELAY);
-            // buf will now be filled with the data that was read from the slave
-            printf("Read from SPI3: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", buf3[0],buf3[1],buf3[2],buf3[3],buf3[4],buf3[5], buf3[6], buf3[7], buf3[8]);
-        }
-
-        unsigned char bufM4[] = {0x02,0x10,0x80,0x08,0x00,0x00,0x00,0x00,0x00};
-        //spi_write_word(0x108008,0x0);        //GPIO7 (SPIS_IO1/SPIS_MISO) drive to 0 , line # 234 from photon code
-        bcm2835_spi_transfern(bufM4, sizeof(bufM4));
-        delay(TX_RX_DELAY);
-
-        // Read Location Data - START
-        /*  {0x0b,0x18,0x00,0x00,0xFF, 0xFF, 0xFF, 0xFF, 0xFF} */
-        unsigned char mpi_rpi_tx_rx_data[MAXPI_BYTES] = {0x0b,0x18, 0x00, 0x00, 0x00 };
-        memset(&mpi_rpi_tx_rx_data[5],0xFF,MAXPI_BYTES - 5);
-
-        bcm2835_spi_transfern(mpi_rpi_tx_rx_data, sizeof(mpi_rpi_tx_rx_data));
-        delay(TX_RX_DELAY);
-        
-        if (DEBUG) {
-        printf("Read location from SPI: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", mpi_rpi_tx_rx_data[0],mpi_rpi_tx_rx_data[1],mpi_rpi_tx_rx_data[2],mpi_rpi_tx_rx_data[3],mpi_rpi_tx_rx_data[4],mpi_rpi_tx_rx_data[5], mpi_rpi_tx_rx_data[6], mpi_rpi_tx_rx_data[7], mpi_rpi_tx_rx_data[8]);
-        }
-        
-        mpi_rpi_tx_rx_data[PI_SER_ST_INDEX+3] = (int)((serPi >> 24) & 0xFF) ;
-        mpi_rpi_tx_rx_data[PI_SER_ST_INDEX+2]= (int)((serPi >> 16) & 0xFF) ;
-        mpi_rpi_tx_rx_data[PI_SER_ST_INDEX+1] = (int)((serPi >> 8) & 0XFF);
-        mpi_rpi_tx_rx_data[PI_SER_ST_INDEX] = (int)((serPi & 0XFF));
-      
-        unsigned  char  rx_tx [256];
-       
-        memcpy(rx_tx, &mpi_rpi_tx_rx_data[5],256);
-
-      // Read Location Data - END
-
-        //SPICRASHED2? START
-        if(SPI_CRASH) {
-            
-            unsigned char SPI_ID_R3[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
-            bcm2835_spi_transfern(SPI_ID_R3, sizeof(SPI_ID_R3));
-            delay(TX_RX_DELAY);
-            
-            // buf will now be filled with the data that was read from the slave
-            if(DEBUG) {
-            printf("Read from SPI_ID_R3: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", SPI_ID_R3[0],SPI_ID_R3[1],SPI_ID_R3[2],SPI_ID_R3[3],SPI_ID_R3[4],SPI_ID_R3[5], SPI_ID_R3[6], SPI_ID_R3[7], SPI_ID_R3[8]);
-            }
-
-            if(isSPIDevCrashed(SPI_ID_R3)) {
-
-                digitalWrite (SPI_RESET, LOW);
-                delay(TOGGLE_DELAY);
-
-                digitalWrite (SPI_RESET, HIGH);
-                delay(TOGGLE_DELAY);
-                /*unsigned char bufInit_R4[] = {0x0b}; // Dummy data for initialization.
-                bcm2835_spi_transfern(bufInit_R4, sizeof(bufInit_R4));
-                delay(TX_RX_DELAY);*/
-                dummy_data_for_initialization();
-
-                unsigned char SPI_ID_R4[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
-                bcm2835_spi_transfern(SPI_ID_R4, sizeof(SPI_ID_R4));
-                delay(TX_RX_DELAY);
-                
-                // buf will now be filled with the data that was read from the slave
-                if(DEBUG) {
-                printf("Read from SPI_ID_R4: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", SPI_ID_R4[0],SPI_ID_R4[1],SPI_ID_R4[2],SPI_ID_R4[3],SPI_ID_R4[4],SPI_ID_R4[5], SPI_ID_R4[6], SPI_ID_R4[7], SPI_ID_R4[8]);
-                }
-
-                if(isSPIDevCrashed(SPI_ID_R4)) {
-                    printf("SPI Device crashed2\n");
-                } else {
-                    printf("SPI Device is fine3\n");
-                    unsigned char bufSPIM0[] = {0x02,0x10,0x80,0x00,0xff,0xff,0xfd,0xff,0x00};
-                    //spi_write_word(0x108000,0xfffdffff); line # 109 from photon
-                    bcm2835_spi_transfern(bufSPIM0, sizeof(bufSPIM0));
-                    delay(TX_RX_DELAY);
-
-                    if(DEBUG) {
-                        unsigned char bufSPI0[] = { 0x0b, 0x10, 0x80, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
-                        bcm2835_spi_transfern(bufSPI0, sizeof(bufSPI0));
-                        delay(TX_RX_DELAY);
-                        // buf will now be filled with the data that was read from the slave
-                        printf("Read from bufSPI0: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", bufSPI0[0],bufSPI0[1],bufSPI0[2],bufSPI0[3],bufSPI0[4],bufSPI0[5], bufSPI0[6], bufSPI0[7], bufSPI0[8]);
-                    }
-
-                    unsigned char bufSPIM1[] = {0x02,0x10,0x80,0x1c,0x48,0xaa,0x0a,0x00,0x00};
-                    //spi_write_word(0x10801c,0xaaa48);  line # 152 
-                    bcm2835_spi_transfern(bufSPIM1, sizeof(bufSPIM1));
-                    delay(TX_RX_DELAY);    
-                }
-            } else {
-                printf("SPI Device is fine4\n");
-            }
-        }   
-        //SPICRASHED2? END
-        
-        unsigned char bufM5[] = {0x02,0x10,0x80,0x1c,0x48,0xaa,0x0a,0x00,0x00};
-        //spi_write_word(0x10801c,0xaaa48);  //GPIO7 (SPIS_IO1/SPIS_MISO) is in GPIO mode, line 248 from Photon Code
-        bcm2835_spi_transfern(bufM5, sizeof(bufM5));
-        delay(TX_RX_DELAY);
-    
-        if(DEBUG) {
-            unsigned char buf5[] = {0x0b,0x10,0x80,0x1c,0xff,0xff,0xff,0xff,0xff};
-            bcm2835_spi_transfern(buf5, sizeof(buf5));
-            delay(TX_RX_DELAY);
-
-            // buf will now be filled with the data that was read from the slave
-            printf("Read from SPI5: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", buf5[0],buf5[1],buf5[2],buf5[3],buf5[4],buf5[5], buf5[6], buf5[7], buf5[8]);
-        }
-
-        unsigned char bufM6[] = {0x02,0x10,0x70,0x70,0x01,0xc0,0x01,0xc0,0x00};
-        //spi_write_word(0x107070,0xC001C001);  //Write 0xC001C001 to Device to proceed, line 249 from Photon Code
-        bcm2835_spi_transfern(bufM6, sizeof(bufM6));
-        delay(TX_RX_DELAY);
-
-        if(DEBUG) {
-            unsigned char buf6[] = {0x0b,0x10,0x70,0x70,0xff,0xff,0xff,0xff,0xff};
-            bcm2835_spi_transfern(buf6, sizeof(buf6));
-            delay(TX_RX_DELAY);
-
-            // buf will now be filled with the data that was read from the slave
-            printf("Read from SPI6: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", buf6[0],buf6[1],buf6[2],buf6[3],buf6[4],buf6[5], buf6[6], buf6[7], buf6[8]);
-        }
-#ifdef PROFILE
-        t3 = clock();//millis();
-#endif //PROFILE
-#ifdef ENABLE_SERVER_SEND
-        printf("Sending 256 bytes...\n");
-        int retSocVal =  send_all(clientSocket, rx_tx, sizeof(rx_tx), MSG_CONFIRM) ;
-        if( retSocVal == -1 )
-        {
-            fprintf(stderr, "socket() send failed: %s\n", strerror(errno));
-            //syslog(LOG_ERR,  "socket() send failed: %s\n", strerror(errno));
-            close(clientSocket);
-            socStatus = -1;
-            clientSocket = socket(PF_INET, SOCK_STREAM, 0);
-        }
-#endif //
-
-       
-        count++;
-        printf("Count = %d \n",count);
-#ifdef PROFILE
-        t4 = clock();//millis();
-        printTimeTake(t2, t1, "T2 - T1 ");
-        printTimeTake(t3,t2, "T3 -T2 ");
-        printTimeTake(t4,t3, "T4 -T3 ");
-
-#endif //PROFILE
-
-        }
-
-    bcm2835_spi_end();
-    bcm2835_close();
-    return 0;
-}
-
+//
+// trakray node: reads location frames from the tracker over SPI and
+// forwards them to the collector (tcp_server.c).
+//
+// Build on the Pi:
+// gcc -o b28 b28.c backend.c backend_bcm2835.c backend_sim.c backend_spidev.c spi_script.c frame_ring.c uplink.c spool.c wire.c hist.c tlog.c health.c calib.c delta.c rt.c -l bcm2835 -l wiringPi -lpthread
+// sudo ./b28 [-b backend]... [-D device_config] [-n frames] [-g gap_us] [-c batch [-w hold_ms]]
+//            [-s spool [-S frames] [-R rate]] [-V 1|2] [-U [-T ttl]] [-E key_every]
+//            [-L sync] [-H every] [-P prio [-A cpu]] [-J] [-Y sync_ms]
+//            [-k clock_file] [server_ip [port]]
+// sudo ./b28 -C [-n reads] [-k clock_file]
+//
+// Build anywhere else against the simulated tracker only:
+// gcc -DNO_BCM2835 -o b28 b28.c backend.c backend_sim.c backend_spidev.c spi_script.c frame_ring.c uplink.c spool.c wire.c hist.c tlog.c health.c calib.c delta.c rt.c -lpthread
+// ./b28 -b sim:log=log_1528.txt,scale=0.001 -n 1000
+//
+// -b spidev reads the tracker through /dev/spidev0.0 and the GPIO chip
+// instead (backend_spidev.c), without root; it runs each SPI script in
+// one ioctl.
+//
+// Add -DENABLE_SERVER_SEND to forward frames and -DPROFILE to print the
+// stage times of every cycle.
+// The per cycle log lines go through the asynchronous logger (tlog.h) and
+// are formatted by its own thread; -DTLOG_LEVEL=TLOG_LVL_INFO compiles
+// the DEBUG register dumps out, -L sync writes every line on the spot
+// like the old printf calls did, to compare the two.
+// Frames go from the acquisition loop to the sender thread (uplink.c)
+// through a lock-free ring (frame_ring.h), so the collector never stalls
+// reading the tracker. Every cycle the wall clock time of its stages
+// (ReadyIn wait, SPI script, health check, publish) goes into a
+// histogram (hist.h); they are printed with the ring and uplink counters
+// every STATS_EVERY frames and on SIGUSR1. -c coalesces up to batch queued frames into one
+// send, holding a frame at most -w ms for the batch to fill.
+// The sender reconnects in the background with exponential backoff; with
+// -s frames produced while the collector is unreachable go to a spool
+// file (spool.c, -S frames big) that is replayed at up to -R frames per
+// second after the reconnect and kept across restarts.
+// Frames go out with the version 2 header of wire.h (serial, sequence
+// number, acquisition time, CRC); -V 1 sends the bare 256 byte frames
+// for a collector that predates it.
+// -U sends datagrams instead (uplink.h): up to -c frames each, everything
+// queued in one sendmmsg(), no reconnects, no spool, a failed send loses
+// its frames. server_ip may be a multicast group, -T sets its TTL.
+// -Y exchanges clock messages with the collector every sync_ms over the
+// connection (uplink.h), so the collector can put the acquisition times
+// of the node on its own clock and tell the true sensor to collector
+// latency; the collector must be new enough to answer them.
+// -E encodes the frames (delta.c) as deltas against the previous frame of
+// their tracker, with a keyframe every key_every frames and after every
+// reconnect, to save uplink bandwidth; delta_bench measures the gain on
+// captured frames.
+// The device ID is read back every -H frames (health.c, 1 reads it every
+// frame as before, 0 only after a frame that looks wrong) and at once
+// when the location block is all 0xFF; a crashed device is
+// reset with the shortest pulse that worked before and polled until it
+// answers instead of the old fixed 2 s of toggle_reset(). Frames read
+// from a crashed device are dropped, not sent.
+// -C calibrates the SPI clock (calib.c): it sweeps the clock dividers
+// with -n ID and location reads each (default 2000), prints the error
+// rate and transfer time of every divider, saves the fastest clean one
+// less a safety step to the -k file (default trakray.clock) and exits.
+// Later runs start with the divider of that file.
+// With -n the node stops after that many frames and prints frames per
+// second, the stage histograms, ReadyIn wake-up latency (when the
+// backend knows the edge time) and the CPU time used. Compare
+// -b sim:wait=spin with -b sim:wait=event (or bcm2835:wait=...) to see what
+// the busy ReadyIn loop costs, and -g 1000 with the default -g to see what
+// the old 1 ms delay after every transfer costs the SPI script.
+//
+// -P runs the acquisition loop in real-time mode (rt.h) at that
+// SCHED_FIFO priority: memory locked, pinned to an isolated core (or -A
+// cpu), the sender and logger threads moved off it. The time from the
+// ReadyIn edge to the first SPI transfer goes into its own histogram;
+// -J with -n runs the first half of the frames at normal priority and the
+// second half in real-time mode and prints that histogram for both, e.g.
+// sudo ./b28 -b bcm2835:wait=event -n 20000 -J -P 80 with a load running.
+//
+// Every -b (or line of the -D file) is one tracker of the node, up to
+// MAX_DEVICES of them, e.g. -b bcm2835:cs=0,ready=21 -b bcm2835:cs=1,ready=22
+// for two trackers on the chip selects of one bus. The loop sleeps in
+// poll() on the ReadyIn lines of all of them and reads whichever is ready,
+// in turn, so a slow tracker does not hold up the others; frames carry the
+// index of their tracker in the wire header. Compare
+// -b sim:delay=0.002,seed=1 -n 1000 with four such -b (seed=1..4) and
+// -n 4000 for the throughput of one and of four trackers.
+//
+// Based on the bcm2835 library SPI example by Mike McCauley
+// Copyright (C) 2012 Mike McCauley
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+//#include <syslog.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+#include "backend.h"
+#include "spi_script.h"
+#include "frame_ring.h"
+#include "uplink.h"
+#include "wire.h"
+#include "hist.h"
+#include "tlog.h"
+#include "health.h"
+#include "calib.h"
+#include "rt.h"
+
+
+#define SPI_CRASH 1
+#define TX_RX_DELAY 1
+#define READY_TIMEOUT 1000 // ms, ReadyIn waits wake up at least this often
+#define DEBUG 1
+#define MAXPI_BYTES 261
+#define PI_SER_ST_INDEX 249
+#define STATS_EVERY 1000
+
+// Pi serial inside the 256 byte frame
+#define PI_SER_FRAME_INDEX (PI_SER_ST_INDEX - FRAME_SPI_HDR)
+_Static_assert(PI_SER_FRAME_INDEX == WIRE_SERIAL_INDEX, "serial where the collector reads it");
+
+#define MAX_DEVICES 8
+
+/*
+ * One tracker, real or simulated, and the state of its acquisition cycle.
+ * read: up to the location block, check: the same plus the ID readback
+ * of the health check, release: hand the device back.
+ */
+struct device {
+    int id;
+    const char *spec;
+    struct backend *spi;
+    struct spi_script script_read, script_check, script_release;
+    unsigned char buf3[9], buf5[9], buf6[9], SPI_ID_R3[9];
+    struct health health;
+    unsigned long long t1;      /* measurement armed */
+    unsigned long frames;
+};
+
+static struct device devices[MAX_DEVICES];
+static unsigned ndevices;
+
+static void spi_transfern(struct device *d, unsigned char *buf, unsigned len) {
+    d->spi->transfer(d->spi, buf, buf, len);
+}
+
+/*
+ * Register commands of the acquisition cycle after ReadyIn. Writes clock
+ * their MISO bytes into spi_sink, reads land in their own buffers.
+ */
+static const unsigned char bufM3[] = {0x02,0x10,0x80,0x1c,0x40,0xaa,0x0a,0x00,0x00};
+//spi_write_word(0x10801c,0xaaa40);  //GPIO7 (SPIS_IO1/SPIS_MISO) is in SPI mode, line # 233 from photon code
+static const unsigned char bufM4[] = {0x02,0x10,0x80,0x08,0x00,0x00,0x00,0x00,0x00};
+//spi_write_word(0x108008,0x0);        //GPIO7 (SPIS_IO1/SPIS_MISO) drive to 0 , line # 234 from photon code
+static const unsigned char bufM5[] = {0x02,0x10,0x80,0x1c,0x48,0xaa,0x0a,0x00,0x00};
+//spi_write_word(0x10801c,0xaaa48);  //GPIO7 (SPIS_IO1/SPIS_MISO) is in GPIO mode, line 248 from Photon Code
+static const unsigned char bufM6[] = {0x02,0x10,0x70,0x70,0x01,0xc0,0x01,0xc0,0x00};
+//spi_write_word(0x107070,0xC001C001);  //Write 0xC001C001 to Device to proceed, line 249 from Photon Code
+static const unsigned char rdGPIO[] = {0x0b,0x10,0x80,0x1c,0xff,0xff,0xff,0xff,0xff};
+static const unsigned char rdCTRL[] = {0x0b,0x10,0x70,0x70,0xff,0xff,0xff,0xff,0xff};
+static const unsigned char rdID[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+/* location read: command, then 0xFF clocked out for the 256 data bytes */
+static const unsigned char rdLOC[MAXPI_BYTES] = { 0x0b, 0x18, 0x00, 0x00, 0x00,
+                                                  [5 ... MAXPI_BYTES - 1] = 0xFF };
+
+static unsigned char spi_sink[9];
+
+/* frames go out through ring, drop_slot takes the read when it is full */
+static struct frame_ring ring;
+static struct frame_slot drop_slot;
+
+static unsigned loc_cmd;    /* index of the location read in script_read / check */
+
+static void build_cycle_scripts(struct device *d, unsigned gap_us) {
+    spi_script_add(&d->script_read, bufM3, spi_sink, sizeof(bufM3), gap_us);
+    if (DEBUG)
+        spi_script_add(&d->script_read, rdGPIO, d->buf3, sizeof(d->buf3), gap_us);
+    spi_script_add(&d->script_read, bufM4, spi_sink, sizeof(bufM4), gap_us);
+    /* rx is pointed at the frame slot of each cycle */
+    loc_cmd = d->script_read.n;
+    spi_script_add(&d->script_read, rdLOC, NULL, MAXPI_BYTES, gap_us);
+    d->script_check = d->script_read;
+    spi_script_add(&d->script_check, rdID, d->SPI_ID_R3, sizeof(d->SPI_ID_R3), gap_us);
+
+    spi_script_add(&d->script_release, bufM5, spi_sink, sizeof(bufM5), gap_us);
+    if (DEBUG)
+        spi_script_add(&d->script_release, rdGPIO, d->buf5, sizeof(d->buf5), gap_us);
+    spi_script_add(&d->script_release, bufM6, spi_sink, sizeof(bufM6), gap_us);
+    if (DEBUG)
+        spi_script_add(&d->script_release, rdCTRL, d->buf6, sizeof(d->buf6), gap_us);
+}
+
+/* stages of the cycle, wall clock time in ns */
+enum { ST_WAIT, ST_SPI, ST_HEALTH, ST_PUBLISH, ST_WAKE, ST_TO_SPI, ST_COUNT };
+
+static const char *const stage_names[ST_COUNT] = {
+    "ReadyIn wait", "SPI script", "Health check", "Publish", "Wake latency", "ReadyIn to SPI"
+};
+static struct hist stages[ST_COUNT];
+static volatile sig_atomic_t stats_wanted;
+
+static void stats_signal(int signo) {
+    (void)signo;
+    stats_wanted = 1;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long real_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stages_print(void) {
+    int i;
+
+    for (i = 0; i < ST_COUNT; i++)
+        if (stages[i].count)
+            hist_print(&stages[i], stdout, stage_names[i], 1e6, "ms");
+}
+
+/* frames and health of every tracker */
+static void devices_print(void) {
+    unsigned k;
+
+    for (k = 0; k < ndevices; k++) {
+        if (ndevices > 1)
+            printf("Device %d (%s): %lu frames\n", devices[k].id, devices[k].spec,
+                   devices[k].frames);
+        health_print_stats(&devices[k].health, stdout);
+    }
+}
+
+/**
+    Signal Handler / can be used to gracefully shut down the 
+*/
+/*
+void sig_handler(int signo)
+{
+   switch ( signo ) {
+       case SIGINT:
+        syslog(LOG_INFO,"received SIGINT");
+        break;
+       case SIGTERM:
+        syslog(LOG_INFO,"recieved SIGTERM");
+        break;
+       default:
+        printf( "recieved signal %d",signo);
+   }
+    syslog(LOG_INFO," gracefully shutdown \n");
+   closelog();
+    exit(0);
+}*/
+
+
+/**
+ * @return - long  - returns the Serial number of the Pi
+ * getPiSerial function reads the cpuinfo from /proc/cpuinfo and reads the Serial
+ * and reutns the 32 bit long
+ *
+ * */
+
+unsigned long getPiSerial() {
+
+    char *recv_data =(char *) malloc(17);
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f) {
+        //  strcpy(recv_data,"error");
+        return -1 ;// recv_data;
+    }
+    char line[256];
+    while (fgets(line, 256, f)) {
+        if (strncmp(line, "Serial", 6) == 0) {
+            strcpy(recv_data, strchr(line, ':') + 2);
+        }
+
+    }
+
+
+    fclose(f);
+
+    return (unsigned long)strtoul(recv_data,NULL,16);
+}
+
+void printTimeTake(unsigned long long p_t2, unsigned long long p_t1, char* msg ) {
+
+    TLOG_INFO("%s - %f \n",msg, (p_t2 - p_t1) / 1e9);
+
+
+}
+    
+void dummy_data_for_initialization(struct device *d) {
+    /*there is bug in SPI device. for that we need to do this. */
+    
+    unsigned char bufInit[] = {0x0b}; // Dummy data for initialization.
+    spi_transfern(d, bufInit, sizeof(bufInit));
+    delay_ms(TX_RX_DELAY);
+}
+
+/* register setup after power up or a reset */
+static void device_configure(struct device *d) {
+    unsigned char bufM0[] = {0x02,0x10,0x80,0x00,0xff,0xff,0xfd,0xff,0x00};
+    //spi_write_word(0x108000,0xfffdffff); line # 109 from photon code
+    spi_transfern(d, bufM0, sizeof(bufM0));
+    delay_ms(TX_RX_DELAY);
+
+    if(DEBUG) {
+        unsigned char buf0[] = { 0x0b, 0x10, 0x80, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }; // Data to readback
+        spi_transfern(d, buf0, sizeof(buf0));
+        delay_ms(TX_RX_DELAY);
+        // buf will now be filled with the data that was read from the slave
+        TLOG_DEBUG("Read from SPI0: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", buf0[0],buf0[1],buf0[2],buf0[3],buf0[4],buf0[5], buf0[6], buf0[7], buf0[8]);
+    }
+
+    unsigned char bufM1[] = {0x02,0x10,0x80,0x1c,0x48,0xaa,0x0a,0x00,0x00};
+    //spi_write_word(0x10801c,0xaaa48);  line # 152 from photon code 
+    spi_transfern(d, bufM1, sizeof(bufM1));
+    delay_ms(TX_RX_DELAY);    
+}
+
+/* start a measurement, ReadyIn rises when the location block is ready */
+static void device_arm(struct device *d) {
+    TLOG_INFO("Stage2\n");
+    
+    unsigned char bufM2[] = {0x02,0x10,0x70,0x70,0x00,0x00,0x00,0x00,0x00};
+    //spi_write_word(0x107070,0x0); line # 228 from photon code
+    spi_transfern(d, bufM2, sizeof(bufM2));
+    // only the chip select gap: a 1 ms sleep here would hold up every
+    // other tracker of the node
+    delay_us(SPI_GAP_US);
+
+    d->t1 = mono_ns(); /* time starts now */
+}
+
+/* one spec per line, # starts a comment, returns the number of devices */
+static int read_device_config(const char *path, char specs[][256], int max) {
+    FILE *f = fopen(path, "r");
+    char line[256], *p;
+    int n = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (n < max && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        p[strcspn(p, " \t")] = '\0';
+        if (*p)
+            snprintf(specs[n++], sizeof(specs[0]), "%s", p);
+    }
+    fclose(f);
+    return n;
+}
+
+/*
+ * wait until at least one armed tracker has ReadyIn high, set ready[i]
+ * for those. With one tracker this is its own wait_ready; with several
+ * the edge fds of all are polled, so no tracker waits behind another.
+ * Returns the number ready, 0 on timeout, -1 on error.
+ */
+static int wait_ready_any(int *ready) {
+    struct pollfd pfd[MAX_DEVICES];
+    unsigned i, n = 0, nfd = 0;
+    int ret, timeout = READY_TIMEOUT;
+
+    if (ndevices == 1) {
+        ret = devices[0].spi->wait_ready(devices[0].spi, READY_TIMEOUT);
+        ready[0] = ret > 0;
+        return ret;
+    }
+    for (i = 0; i < ndevices; i++) {
+        if (devices[i].spi->ready_fd < 0) {
+            timeout = 1;        /* a tracker without an fd, check it often */
+            continue;
+        }
+        pfd[nfd].fd = devices[i].spi->ready_fd;
+        pfd[nfd].events = POLLIN;
+        nfd++;
+    }
+    if (poll(pfd, nfd, timeout) < 0 && errno != EINTR)
+        return -1;
+    for (i = 0, nfd = 0; i < ndevices; i++) {
+        ready[i] = 0;
+        if (devices[i].spi->ready_fd >= 0 && !(pfd[nfd++].revents & POLLIN))
+            continue;
+        ret = devices[i].spi->wait_ready(devices[i].spi, 0);
+        if (ret < 0)
+            return -1;
+        ready[i] = ret;
+        n += ret;
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long t1, t2, t3, t4, t5, t_release;
+    unsigned long long start_ns = mono_ns(), first_frame_ns = 0;
+    char specs[MAX_DEVICES][256];
+    const char *config = NULL;
+    int nspecs = 0, ready[MAX_DEVICES];
+    unsigned next = 0, first, k;
+    struct device *d;
+    long max_frames = 0;
+    unsigned gap_us = SPI_GAP_US;
+    unsigned health_every = HEALTH_DEFAULT_EVERY;
+    struct spi_script *script;
+    const char *clock_file = CALIB_DEFAULT_FILE;
+    int calibrate = 0;
+    int rt_prio = 0, rt_cpu = -1, jitter_ab = 0;
+    struct rt rt = { .cpu = -1, .dma_fd = -1 };
+    struct hist to_spi_normal;
+    unsigned clock_div;
+    int check, suspect, crashed;
+    double bench_start;
+    int opt, ret, i;
+    enum tlog_mode log_mode = TLOG_ASYNC;
+    struct uplink uplink;
+    struct uplink_config ucfg = { .port = 5019, .batch = 1 };
+    struct frame_slot *slot;
+    unsigned char *mpi_rpi_tx_rx_data;
+    unsigned long long acq_ns;
+    uint64_t run_id = (uint64_t)wire_new_run() << 32;
+
+    
+    // Initializing syslog 
+    //openlog("slog", LOG_PID|LOG_CONS, LOG_USER);
+    // syslog(LOG_INFO, "A different kind of Hello world ... ");
+    /*if (signal(SIGINT, sig_handler) == SIG_ERR)
+        syslog(LOG_ERR,"can't catch SIGINT");
+
+    if (signal(SIGTERM, sig_handler) == SIG_ERR)
+        syslog(LOG_ERR,"can't catch SIGTERM");
+
+    if( signal(SIGKILL,sig_handler) == SIG_ERR) 
+	syslog(LOG_ERR,"cant catch SIGKILL");
+    */
+    ucfg.version = WIRE_VERSION;
+    while ((opt = getopt(argc, argv, "b:D:n:g:c:w:s:S:R:V:UT:E:L:H:Ck:P:A:JY:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (nspecs < MAX_DEVICES)
+                snprintf(specs[nspecs++], sizeof(specs[0]), "%s", optarg);
+            break;
+        case 'D':
+            config = optarg;
+            break;
+        case 'n':
+            max_frames = atol(optarg);
+            break;
+        case 'g':
+            gap_us = atoi(optarg);
+            break;
+        case 'c':
+            ucfg.batch = atoi(optarg);
+            break;
+        case 'w':
+            ucfg.hold_ms = atoi(optarg);
+            break;
+        case 's':
+            ucfg.spool_path = optarg;
+            break;
+        case 'S':
+            ucfg.spool_frames = atoi(optarg);
+            break;
+        case 'R':
+            ucfg.drain_rate = atoi(optarg);
+            break;
+        case 'V':
+            ucfg.version = atoi(optarg);
+            break;
+        case 'U':
+            ucfg.udp = 1;
+            break;
+        case 'T':
+            ucfg.mcast_ttl = atoi(optarg);
+            break;
+        case 'E':
+            ucfg.key_every = atoi(optarg);
+            break;
+        case 'L':
+            log_mode = strcmp(optarg, "sync") == 0 ? TLOG_SYNC : TLOG_ASYNC;
+            break;
+        case 'H':
+            health_every = atoi(optarg);
+            break;
+        case 'C':
+            calibrate = 1;
+            break;
+        case 'k':
+            clock_file = optarg;
+            break;
+        case 'P':
+            rt_prio = atoi(optarg);
+            break;
+        case 'A':
+            rt_cpu = atoi(optarg);
+            break;
+        case 'J':
+            jitter_ab = 1;
+            break;
+        case 'Y':
+            ucfg.sync_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b bcm2835|spidev|sim[:args]]... [-D device_config] [-n frames] [-g gap_us] [-c batch [-w hold_ms]] [-s spool [-S frames] [-R rate]] [-V 1|2] [-U [-T ttl]] [-E key_every] [-L sync|async] [-H every] [-P prio [-A cpu]] [-J] [-Y sync_ms] [-C] [-k clock_file] [server_ip [port]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (jitter_ab && max_frames < 2) {
+        fprintf(stderr, "-J needs -n frames\n");
+        return 1;
+    }
+    if (jitter_ab && !rt_prio)
+        rt_prio = RT_DEFAULT_PRIO;
+
+    if (config) {
+        ret = read_device_config(config, specs + nspecs, MAX_DEVICES - nspecs);
+        if (ret < 0)
+            return 1;
+        nspecs += ret;
+    }
+    if (nspecs == 0)
+        snprintf(specs[nspecs++], sizeof(specs[0]), "bcm2835");
+
+    tlog_start(log_mode);
+    clock_div = calibrate ? 0 : calib_load(clock_file);
+    for (i = 0; i < nspecs; i++) {
+        d = &devices[ndevices];
+        d->id = i;
+        d->spec = specs[i];
+        d->spi = backend_open(d->spec, NULL);
+        if (!d->spi)
+            return 1;
+        ndevices++;
+        if (clock_div && d->spi->set_clock_div) {
+            if (d->spi->set_clock_div(d->spi, clock_div) == 0)
+                TLOG_INFO("SPI clock divider %u from %s\n", clock_div, clock_file);
+            else
+                TLOG_WARN("bad SPI clock divider %u in %s\n", clock_div, clock_file);
+        }
+        build_cycle_scripts(d, gap_us);
+        health_init(&d->health, health_every);
+    }
+    if (frame_ring_init(&ring, FRAME_RING_SLOTS) != 0) {
+        fprintf(stderr, "cannot allocate the frame ring\n");
+        return 1;
+    }
+    for (i = 0; i < ST_COUNT; i++)
+        hist_init(&stages[i]);
+    hist_init(&to_spi_normal);
+    signal(SIGUSR1, stats_signal);
+
+    long serPi = getPiSerial();
+    // Send a some bytes to the slave and simultaneously read 
+    // some bytes back from the slave
+    // Most SPI devices expect one or 2 bytes of command, after which they will send back
+    // some data. In such a case you will have the command bytes first in the mpi_rpi_tx_rx_data,
+    // followed by as many 0 bytes as you expect returned data bytes. After the transfer, you 
+    // Can the read the reply bytes from the mpi_rpi_tx_rx_data.
+    // If you tie MISO to MOSI, you should read back what was sent.
+    
+    char ipaddr[20] = "192.168.1.164";
+    int port = 5019;
+    
+    // Initializing syslog 
+    //openlog("slog", LOG_PID|LOG_CONS, LOG_USER);
+    // syslog(LOG_INFO, "A different kind of Hello world ... ");
+    //closelog();
+
+    if ( argc - optind >= 1 ) {
+        // first argument is the server address, second the port
+        TLOG_INFO(" args 1 =  " );
+        snprintf(ipaddr, sizeof(ipaddr), "%s", argv[optind]);
+        if( argc - optind == 2 )
+            port = atoi(argv[optind + 1]);
+    }
+
+    int count = 1;
+
+    TLOG_INFO("Starting\n") ;
+    for (k = 0; k < ndevices; k++) {
+        d = &devices[k];
+        TLOG_INFO("Stage1 Initiating SPI connection %d\n", d->id) ;
+
+        dummy_data_for_initialization(d);
+
+        //SPICRASHED1 START
+        // reset only a device that does not answer with its ID
+        if(SPI_CRASH) {
+            if(health_read_id(d->spi)) {
+                TLOG_INFO("SPI Device is fine2\n");
+            } else if(health_recover(&d->health, d->spi) == 0) {
+                TLOG_INFO("SPI Device is fine1\n");
+            } else {
+                TLOG_WARN("SPI Device crashed1\n");
+            }
+        }
+        //SPICRASHED1 END
+
+        device_configure(d);
+    }
+ 
+    if (calibrate) {
+        tlog_stop();
+        // the trackers share the clock, the slowest of their picks wins
+        for (k = 0, clock_div = 0; k < ndevices; k++) {
+            d = &devices[k];
+            printf("Device %d (%s)\n", d->id, d->spec);
+            unsigned div = calib_run(d->spi, max_frames ? max_frames : CALIB_DEFAULT_READS, stdout);
+            if (!div) {
+                clock_div = 0;
+                break;
+            }
+            if (div > clock_div)
+                clock_div = div;
+        }
+        if (clock_div && calib_save(clock_file, clock_div) == 0)
+            printf("saved %u to %s\n", clock_div, clock_file);
+        for (k = 0; k < ndevices; k++) {
+            d = &devices[k];
+            if (clock_div)
+                d->spi->set_clock_div(d->spi, clock_div);
+            // the sweep may have crashed the device at the failing divider
+            if (SPI_CRASH && !health_read_id(d->spi))
+                health_recover(&d->health, d->spi);
+            d->spi->close(d->spi);
+        }
+        return clock_div ? 0 : 1;
+    }
+
+    ucfg.ipaddr = ipaddr;
+    ucfg.port = port;
+    ucfg.serial = (uint32_t)serPi;
+    if (uplink_start(&uplink, &ring, &ucfg) != 0)
+        return 1;
+
+    // after the sender and logger threads exist, so they can be moved away
+    if (rt_prio && !jitter_ab)
+        rt_start(&rt, rt_prio, rt_cpu);
+
+    bench_start = now_sec();
+    for (k = 0; k < ndevices; k++)
+        device_arm(&devices[k]);
+    while(max_frames == 0 || count <= max_frames)
+    {
+        TLOG_INFO("Waiting for ReadyIn\n");
+        //Wait for Device to make Pin to 1, sleeping on the edge event
+        ret = wait_ready_any(ready);
+        if (ret < 0) {
+            fprintf(stderr, "waiting for ReadyIn failed\n");
+            break;
+        }
+        // serve the ready trackers, starting after the last one served
+        first = next;
+        for (k = 0; k < ndevices && (max_frames == 0 || count <= max_frames); k++) {
+        d = &devices[(first + k) % ndevices];
+        if (!ready[d->id])
+            continue;
+        t1 = d->t1;
+        t2 = mono_ns();
+        TLOG_INFO("Stage3\n");
+        acq_ns = t2;
+        if (d->spi->ready_edge_ns)
+            hist_add(&stages[ST_WAKE], t2 - d->spi->ready_edge_ns);
+        // Read Location Data - START, straight into the next ring slot
+        slot = frame_ring_claim(&ring);
+        if (!slot)
+            slot = &drop_slot;  // ring full, the frame is counted as dropped
+        mpi_rpi_tx_rx_data = slot->spi_hdr;
+        // the ID readback rides along only when the health check is due
+        check = SPI_CRASH && health_due(&d->health);
+        script = check ? &d->script_check : &d->script_read;
+        script->cmd[loc_cmd].rx = mpi_rpi_tx_rx_data;
+        if (d->spi->ready_edge_ns)
+            hist_add(&stages[ST_TO_SPI], mono_ns() - d->spi->ready_edge_ns);
+
+        // bufM3, bufM4, the location block and SPI_ID_R3 if due in one go
+        spi_script_run(d->spi, script);
+        t3 = mono_ns();
+        // before the Pi serial goes in, a crashed device reads all 0xFF
+        suspect = SPI_CRASH && health_frame_suspect(slot->data, FRAME_BYTES);
+
+        if(DEBUG) {
+            TLOG_DEBUG("Read from SPI3: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", d->buf3[0],d->buf3[1],d->buf3[2],d->buf3[3],d->buf3[4],d->buf3[5], d->buf3[6], d->buf3[7], d->buf3[8]);
+            TLOG_DEBUG("Read location from SPI: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", mpi_rpi_tx_rx_data[0],mpi_rpi_tx_rx_data[1],mpi_rpi_tx_rx_data[2],mpi_rpi_tx_rx_data[3],mpi_rpi_tx_rx_data[4],mpi_rpi_tx_rx_data[5], mpi_rpi_tx_rx_data[6], mpi_rpi_tx_rx_data[7], mpi_rpi_tx_rx_data[8]);
+        }
+        
+        slot->data[PI_SER_FRAME_INDEX+3] = (int)((serPi >> 24) & 0xFF) ;
+        slot->data[PI_SER_FRAME_INDEX+2]= (int)((serPi >> 16) & 0xFF) ;
+        slot->data[PI_SER_FRAME_INDEX+1] = (int)((serPi >> 8) & 0XFF);
+        slot->data[PI_SER_FRAME_INDEX] = (int)((serPi & 0XFF));
+
+        // v2 header: acquired at the ReadyIn edge when the backend saw it
+        if (d->spi->ready_edge_ns)
+            acq_ns = d->spi->ready_edge_ns;
+        wire_fill(&slot->wire, (uint32_t)serPi, d->id, run_id | (uint32_t)d->frames, acq_ns,
+                  real_ns() - (mono_ns() - acq_ns), slot->data);
+
+      // Read Location Data - END
+
+        //SPICRASHED2? START
+        crashed = 0;
+        if(check) {
+            // SPI_ID_R3 was read back by script_check
+            if(DEBUG) {
+            TLOG_DEBUG("Read from SPI_ID_R3: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", d->SPI_ID_R3[0],d->SPI_ID_R3[1],d->SPI_ID_R3[2],d->SPI_ID_R3[3],d->SPI_ID_R3[4],d->SPI_ID_R3[5], d->SPI_ID_R3[6], d->SPI_ID_R3[7], d->SPI_ID_R3[8]);
+            }
+            crashed = !health_id_ok(d->SPI_ID_R3);
+        }
+        if(suspect) {
+            d->health.suspect++;
+            // no readback this cycle, read the ID now
+            if(!check) {
+                check = 1;
+                crashed = !health_read_id(d->spi);
+            }
+        }
+        if(check) {
+            health_checked(&d->health, !crashed);
+
+            if(crashed) {
+                if(health_recover(&d->health, d->spi) != 0) {
+                    TLOG_WARN("SPI Device crashed2\n");
+                } else {
+                    TLOG_INFO("SPI Device is fine3\n");
+                    device_configure(d);
+                }
+            } else {
+                TLOG_INFO("SPI Device is fine4\n");
+            }
+        }   
+        //SPICRASHED2? END
+
+        // bufM5, bufM6 and their readbacks in one go, SPI time again
+        t_release = mono_ns();
+        spi_script_run(d->spi, &d->script_release);
+        t4 = mono_ns();
+
+        if(DEBUG) {
+            TLOG_DEBUG("Read from SPI5: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", d->buf5[0],d->buf5[1],d->buf5[2],d->buf5[3],d->buf5[4],d->buf5[5], d->buf5[6], d->buf5[7], d->buf5[8]);
+            TLOG_DEBUG("Read from SPI6: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", d->buf6[0],d->buf6[1],d->buf6[2],d->buf6[3],d->buf6[4],d->buf6[5], d->buf6[6], d->buf6[7], d->buf6[8]);
+        }
+        // hand the frame to the sender thread, the slot of a frame read
+        // from a crashed device is simply claimed again next cycle
+        if (!crashed && slot != &drop_slot) {
+            frame_ring_publish(&ring);
+            if (!first_frame_ns) {
+                first_frame_ns = mono_ns();
+                TLOG_INFO("Time to first frame: %.1f ms\n", (first_frame_ns - start_ns) / 1e6);
+            }
+        }
+        t5 = mono_ns();
+        d->frames++;
+        next = d->id + 1;
+        // next measurement of this tracker
+        device_arm(d);
+
+        hist_add(&stages[ST_WAIT], t2 - t1);
+        hist_add(&stages[ST_SPI], t3 - t2 + t4 - t_release);
+        hist_add(&stages[ST_HEALTH], t_release - t3);
+        hist_add(&stages[ST_PUBLISH], t5 - t4);
+       
+        count++;
+        TLOG_INFO("Count = %d \n",count);
+        if (jitter_ab && count == max_frames / 2 + 1) {
+            // second half of -J in real-time mode
+            to_spi_normal = stages[ST_TO_SPI];
+            hist_init(&stages[ST_TO_SPI]);
+            rt_start(&rt, rt_prio, rt_cpu);
+        }
+        if (count % STATS_EVERY == 0 || stats_wanted) {
+            stats_wanted = 0;
+            stages_print();
+            devices_print();
+            frame_ring_print_stats(&ring);
+            uplink_print_stats(&uplink);
+        }
+#ifdef PROFILE
+        printTimeTake(t2, t1, "T2 - T1 ");
+        printTimeTake(t3,t2, "T3 -T2 ");
+        printTimeTake(t4,t3, "T4 -T3 ");
+        printTimeTake(t5,t4, "T5 -T4 ");
+
+#endif //PROFILE
+
+        }
+        }
+
+    uplink_stop(&uplink);
+    tlog_stop();
+
+    if (max_frames) {
+        double elapsed = now_sec() - bench_start, cpu;
+        struct rusage ru;
+
+        getrusage(RUSAGE_SELF, &ru);
+        cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+              (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+        printf("Backend %s x%u: %d frames in %.3f s, %.2f frames/s\n", devices[0].spi->name,
+               ndevices, count - 1, elapsed, elapsed > 0 ? (count - 1) / elapsed : 0);
+        stages_print();
+        if (first_frame_ns)
+            printf("Time to first frame %.1f ms\n", (first_frame_ns - start_ns) / 1e6);
+        printf("CPU time %.3f s (%.1f%% of wall clock)\n", cpu,
+               elapsed > 0 ? 100 * cpu / elapsed : 0);
+    }
+    if (rt_prio)
+        rt_print(&rt, stdout);
+    if (jitter_ab) {
+        hist_print(&to_spi_normal, stdout, "ReadyIn to SPI, normal", 1e3, "us");
+        hist_print(&stages[ST_TO_SPI], stdout, "ReadyIn to SPI, real-time", 1e3, "us");
+        if (to_spi_normal.count && stages[ST_TO_SPI].count)
+            printf("Jitter p99.9 - p50: %.1f us normal, %.1f us real-time\n",
+                   (hist_quantile(&to_spi_normal, 0.999) - hist_quantile(&to_spi_normal, 0.5)) / 1e3,
+                   (hist_quantile(&stages[ST_TO_SPI], 0.999) -
+                    hist_quantile(&stages[ST_TO_SPI], 0.5)) / 1e3);
+    }
+    rt_stop(&rt);
+    devices_print();
+    frame_ring_print_stats(&ring);
+    uplink_print_stats(&uplink);
+    tlog_print_stats();
+    frame_ring_free(&ring);
+
+    for (k = 0; k < ndevices; k++)
+        devices[k].spi->close(devices[k].spi);
+    return 0;
+}
+
@@ -0,0 +1,160 @@
+/*
+ * backend.c - backend selection for the tracker SPI / GPIO access
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "backend.h"
+
+static const struct backend_pins default_pins = { 0, ReadyIn, SPI_RESET };
+
+struct backend *backend_open(const char *spec, const struct backend_pins *pins)
+{
+    char name[32];
+    const char *args = strchr(spec, ':');
+    size_t n = args ? (size_t)(args - spec) : strlen(spec);
+
+    if (n >= sizeof(name)) {
+        fprintf(stderr, "backend name too long: %s\n", spec);
+        return NULL;
+    }
+    memcpy(name, spec, n);
+    name[n] = '\0';
+    args = args ? args + 1 : "";
+
+    if (!pins)
+        pins = &default_pins;
+
+#ifndef NO_BCM2835
+    if (strcmp(name, "bcm2835") == 0)
+        return bcm2835_backend_open(args, pins);
+#endif
+    if (strcmp(name, "spidev") == 0)
+        return spidev_backend_open(args, pins);
+    if (strcmp(name, "sim") == 0)
+        return sim_backend_open(args, pins);
+
+    fprintf(stderr, "unknown backend: %s\n", name);
+    return NULL;
+}
+
+void delay_ms(unsigned ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+unsigned long long mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int backend_poll_in(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    unsigned long long deadline = 0, now;
+    int ret;
+
+    if (timeout_ms >= 0)
+        deadline = mono_ns() + (unsigned long long)timeout_ms * 1000000ULL;
+    for (;;) {
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret > 0)
+            return (pfd.revents & POLLIN) ? 1 : -1;
+        if (ret == 0)
+            return 0;
+        if (errno != EINTR)
+            return -1;
+        if (timeout_ms >= 0) {
+            now = mono_ns();
+            if (now >= deadline)
+                return 0;
+            timeout_ms = (int)((deadline - now + 999999) / 1000000);
+        }
+    }
+}
+
+/* line event timestamps are CLOCK_MONOTONIC since Linux 5.7 and
+ * CLOCK_REALTIME before, map the latter onto the monotonic clock */
+static unsigned long long gpio_event_time(unsigned long long ts)
+{
+    struct timespec rt;
+    unsigned long long now = mono_ns(), real;
+
+    if (ts <= now)
+        return ts;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    real = (unsigned long long)rt.tv_sec * 1000000000ULL + rt.tv_nsec;
+    return ts <= real ? now - (real - ts) : now;
+}
+
+int backend_gpio_events(const char *chip, unsigned line)
+{
+    struct gpioevent_request req;
+    int fd, ret;
+
+    fd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", chip, strerror(errno));
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = line;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+    snprintf(req.consumer_label, sizeof(req.consumer_label), "trakray-ready");
+    ret = ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+    close(fd);
+    if (ret < 0) {
+        fprintf(stderr, "cannot get ReadyIn events: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+    return req.fd;
+}
+
+int backend_gpio_wait_edge(int fd, int timeout_ms, unsigned long long *edge_ns)
+{
+    struct gpiohandle_data level;
+    struct gpioevent_data ev;
+    unsigned long long last = 0;
+    int ret;
+
+    *edge_ns = 0;
+
+    /* take the edges queued so far, then look at the level: the line
+     * may already be high, in which case no edge will come and the
+     * newest queued one (polled for by a multi-tracker node) is it */
+    while (read(fd, &ev, sizeof(ev)) == sizeof(ev))
+        last = ev.timestamp;
+    if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &level) < 0)
+        return -1;
+    if (level.values[0]) {
+        if (last)
+            *edge_ns = gpio_event_time(last);
+        return 1;
+    }
+
+    ret = backend_poll_in(fd, timeout_ms);
+    if (ret <= 0)
+        return ret;
+    if (read(fd, &ev, sizeof(ev)) != sizeof(ev))
+        return -1;
+    *edge_ns = gpio_event_time(ev.timestamp);
+    return 1;
+}
@@ -0,0 +1,126 @@
+/*
+ * backend.h - SPI / GPIO backend interface for the tracker device
+ *
+ * b28.c only talks to the tracker through this interface, so the same
+ * acquisition loop can drive the real device (bcm2835 + wiringPi) or the
+ * simulated device in backend_sim.c on an ordinary Linux box.
+ *
+ * A backend is selected with a spec string "name[:args]", e.g.
+ *   bcm2835
+ *   spidev:dev=/dev/spidev0.0
+ *   sim:log=log_1528.txt,scale=0.01
+ */
+
+#ifndef TRAKRAY_BACKEND_H
+#define TRAKRAY_BACKEND_H
+
+/* Default wiring of the tracker on the Pi header */
+#define SPI_RESET 22 // Wirint Pi pin 22
+#define ReadyIn 21 // Physical pin 29, BCM pin 5, Wiring Pi pin 21
+
+/* the same lines as GPIO chip offsets (BCM numbers), for spidev */
+#define SPI_RESET_GPIO 6
+#define READYIN_GPIO 5
+
+/* SPI clock = core clock / divider; 250 MHz on Rpi2, 400 MHz on Rpi3 */
+#define SPI_CORE_HZ 250000000
+#define SPI_DEFAULT_DIV 32
+
+struct spi_cmd;
+
+struct backend_pins {
+    int cs;         /* SPI chip select (0 = CS0) */
+    int ready_pin;  /* wiringPi pin number of ReadyIn */
+    int reset_pin;  /* wiringPi pin number of the device reset */
+};
+
+struct backend {
+    const char *name;
+
+    /*
+     * Full duplex transfer of len bytes. tx and rx may point to the same
+     * buffer, in which case the transfer is done in place like
+     * bcm2835_spi_transfern. Returns 0 on success, -1 on error.
+     */
+    int (*transfer)(struct backend *be, const unsigned char *tx,
+                    unsigned char *rx, unsigned len);
+
+    /*
+     * Optional: run a list of transfers (see spi_script.h) in as few bus
+     * operations as the hardware allows, honouring each gap_us. NULL when
+     * the backend only does single transfers.
+     */
+    int (*transfer_script)(struct backend *be, const struct spi_cmd *cmds,
+                           unsigned n);
+
+    /*
+     * Wait until ReadyIn is high. timeout_ms < 0 waits forever.
+     * Returns 1 when ready, 0 on timeout, -1 on error.
+     */
+    int (*wait_ready)(struct backend *be, int timeout_ms);
+
+    /*
+     * CLOCK_MONOTONIC time in ns of the ReadyIn rising edge that ended the
+     * last successful wait_ready, 0 when the backend cannot tell. The gap
+     * to the return of wait_ready is the wake-up latency.
+     */
+    unsigned long long ready_edge_ns;
+
+    /*
+     * fd that turns readable when ReadyIn rises, for a node that polls
+     * several trackers at once and then calls wait_ready(be, 0) on the
+     * ones that became readable. -1 when the backend cannot tell, it is
+     * then polled with wait_ready(be, 0).
+     */
+    int ready_fd;
+
+    /*
+     * Optional: set the SPI clock divider, a power of two from 2 to
+     * 65536. Returns 0, -1 when the divider is not supported. NULL when
+     * the backend has a fixed clock.
+     */
+    int (*set_clock_div)(struct backend *be, unsigned div);
+
+    /* Drive the reset line, 0 = LOW (device held in reset), 1 = HIGH */
+    void (*set_reset)(struct backend *be, int level);
+
+    void (*close)(struct backend *be);
+};
+
+/**
+ * @return - backend - opened backend or NULL on failure
+ * backend_open parses "name[:args]" and opens the matching backend for the
+ * device wired to pins. pins may be NULL for the default wiring.
+ */
+struct backend *backend_open(const char *spec, const struct backend_pins *pins);
+
+struct backend *bcm2835_backend_open(const char *args, const struct backend_pins *pins);
+struct backend *spidev_backend_open(const char *args, const struct backend_pins *pins);
+struct backend *sim_backend_open(const char *args, const struct backend_pins *pins);
+
+/* sleep for ms milliseconds, replacement for wiringPi delay() */
+void delay_ms(unsigned ms);
+
+/* CLOCK_MONOTONIC in ns */
+unsigned long long mono_ns(void);
+
+/**
+ * @return - int - 1 when fd became readable, 0 on timeout, -1 on error
+ * backend_poll_in waits for a ReadyIn event fd (GPIO line event, or the
+ * timer standing in for it in the simulator). timeout_ms < 0 waits forever.
+ */
+int backend_poll_in(int fd, int timeout_ms);
+
+/* rising edge events of GPIO line (BCM number) of chip, a non-blocking
+ * fd or -1 */
+int backend_gpio_events(const char *chip, unsigned line);
+
+/**
+ * @return - int - as backend->wait_ready
+ * backend_gpio_wait_edge waits for the line of a backend_gpio_events fd to
+ * be high; *edge_ns gets the time of the rising edge, 0 when it was high
+ * with no edge queued.
+ */
+int backend_gpio_wait_edge(int fd, int timeout_ms, unsigned long long *edge_ns);
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * backend_bcm2835.c - tracker access through the bcm2835 library (SPI)
+ * and wiringPi (ReadyIn / reset lines). Needs root, as bcm2835 maps
+ * /dev/mem.
+ *
+ * ReadyIn is waited for with rising edge events from the kernel GPIO
+ * character device, so the wait sleeps in poll() instead of spinning on
+ * digitalRead. args (comma separated):
+ *   wait=event|spin   edge events (default) or the old busy loop
+ *   chip=PATH         GPIO chip holding ReadyIn (default /dev/gpiochip0)
+ *   cs=0|1            chip select of the tracker
+ *   ready=N, reset=N  wiringPi pins of its ReadyIn and reset lines
+ *
+ * Several trackers on CS0 and CS1 share the one SPI controller (and its
+ * clock divider); the library is set up by the first and closed by the
+ * last, and each transfer selects its tracker's chip select while more
+ * than one is open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <wiringPi.h>
+#include <bcm2835.h>
+
+#include "backend.h"
+
+#define DEBUGBCM 0
+
+struct bcm_backend {
+    struct backend be;
+    struct backend_pins pins;
+    int event_fd;       /* ReadyIn line event fd, -1 when spinning */
+};
+
+static int bcm_users;   /* open backends on the SPI controller */
+
+static int bcm_transfer(struct backend *be, const unsigned char *tx,
+                        unsigned char *rx, unsigned len)
+{
+    struct bcm_backend *b = (struct bcm_backend *)be;
+
+    if (bcm_users > 1)
+        bcm2835_spi_chipSelect(b->pins.cs ? BCM2835_SPI_CS1 : BCM2835_SPI_CS0);
+    if (tx == rx)
+        bcm2835_spi_transfern((char *)rx, len);
+    else
+        bcm2835_spi_transfernb((char *)tx, (char *)rx, len);
+    return 0;
+}
+
+static int bcm_set_clock_div(struct backend *be, unsigned div)
+{
+    (void)be;
+    /* the divider register is 16 bit, 0 means 65536 */
+    if (div < 2 || div > 65536 || (div & (div - 1)))
+        return -1;
+    bcm2835_spi_setClockDivider((uint16_t)div);
+    return 0;
+}
+
+static int bcm_wait_ready_spin(struct backend *be, int timeout_ms)
+{
+    struct bcm_backend *b = (struct bcm_backend *)be;
+    unsigned int start = millis();
+
+    be->ready_edge_ns = 0;
+    while (digitalRead(b->pins.ready_pin) == 0) { //Wait for Device to make Pin to 1
+        if (timeout_ms >= 0 && millis() - start >= (unsigned int)timeout_ms)
+            return 0;
+    }
+    return 1;
+}
+
+static int bcm_wait_ready_event(struct backend *be, int timeout_ms)
+{
+    struct bcm_backend *b = (struct bcm_backend *)be;
+
+    return backend_gpio_wait_edge(b->event_fd, timeout_ms, &be->ready_edge_ns);
+}
+
+static void bcm_set_reset(struct backend *be, int level)
+{
+    struct bcm_backend *b = (struct bcm_backend *)be;
+
+    digitalWrite(b->pins.reset_pin, level ? HIGH : LOW);
+}
+
+static void bcm_close(struct backend *be)
+{
+    struct bcm_backend *b = (struct bcm_backend *)be;
+
+    if (b->event_fd >= 0)
+        close(b->event_fd);
+    if (--bcm_users == 0) {
+        bcm2835_spi_end();
+        bcm2835_close();
+    }
+    free(be);
+}
+
+struct backend *bcm2835_backend_open(const char *args, const struct backend_pins *pins)
+{
+    struct bcm_backend *b;
+    struct backend_pins pin = *pins;
+    char chip[64] = "/dev/gpiochip0";
+    int spin = 0;
+    const char *p;
+
+    for (p = args; *p; p += strcspn(p, ","), p += (*p == ',')) {
+        if (strncmp(p, "wait=spin", 9) == 0)
+            spin = 1;
+        else if (strncmp(p, "wait=event", 10) == 0)
+            spin = 0;
+        else if (strncmp(p, "chip=", 5) == 0)
+            snprintf(chip, sizeof(chip), "%.*s", (int)strcspn(p + 5, ","), p + 5);
+        else if (strncmp(p, "cs=", 3) == 0)
+            pin.cs = atoi(p + 3);
+        else if (strncmp(p, "ready=", 6) == 0)
+            pin.ready_pin = atoi(p + 6);
+        else if (strncmp(p, "reset=", 6) == 0)
+            pin.reset_pin = atoi(p + 6);
+        else {
+            fprintf(stderr, "bcm2835: unknown argument %.*s\n", (int)strcspn(p, ","), p);
+            return NULL;
+        }
+    }
+
+    b = calloc(1, sizeof(*b));
+    if (!b)
+        return NULL;
+
+    if (bcm_users == 0) {
+        // If you call this, it will not actually access the GPIO
+        // Use for testing
+        if (DEBUGBCM) {
+            bcm2835_set_debug(1);
+        }
+
+        // run as sudo
+        if (!bcm2835_init())
+        {
+          printf("bcm2835_init failed. Are you running as root??\n");
+          free(b);
+          return NULL;
+        }
+
+        if (!bcm2835_spi_begin())
+        {
+          printf("bcm2835_spi_begin failed. Are you running as root??\n");
+          bcm2835_close();
+          free(b);
+          return NULL;
+        }
+
+        bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);      // The default
+        bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);                   // The default
+        bcm2835_spi_setClockDivider(SPI_DEFAULT_DIV);    // 32 = 7.8125MHz on Rpi2, 12.5MHz on RPI3
+
+        // setting up wiring pi RESET Pin & ReadyIn Pin
+        wiringPiSetup();
+    }
+    bcm_users++;
+    bcm2835_spi_chipSelect(pin.cs ? BCM2835_SPI_CS1 : BCM2835_SPI_CS0);
+    bcm2835_spi_setChipSelectPolarity(pin.cs ? BCM2835_SPI_CS1 : BCM2835_SPI_CS0, LOW);
+    pinMode(pin.ready_pin, INPUT);
+    pinMode(pin.reset_pin, OUTPUT);
+    // the latch is low after boot, which holds the tracker in reset
+    digitalWrite(pin.reset_pin, HIGH);
+
+    b->pins = pin;
+    b->event_fd = -1;
+    if (!spin) {
+        b->event_fd = backend_gpio_events(chip, wpiPinToGpio(pin.ready_pin));
+        if (b->event_fd < 0)
+            printf("falling back to polling ReadyIn\n");
+    }
+    b->be.name = "bcm2835";
+    b->be.ready_fd = b->event_fd;
+    b->be.transfer = bcm_transfer;
+    b->be.wait_ready = b->event_fd >= 0 ? bcm_wait_ready_event : bcm_wait_ready_spin;
+    b->be.set_clock_div = bcm_set_clock_div;
+    b->be.set_reset = bcm_set_reset;
+    b->be.close = bcm_close;
+    return &b->be;
+}
@@ -0,0 +1,441 @@
+/*
+ * backend_sim.c - simulated tracker device
+ *
+ * Answers the register protocol b28.c speaks over SPI, so the acquisition
+ * loop can be run and benchmarked without a Pi:
+ *
+ *   0x0b a2 a1 a0 xx [data...]   read from 24 bit address, data from byte 5
+ *   0x02 a2 a1 a0 d0 d1 d2 d3 xx write little endian word
+ *   0x0b                         dummy byte after power up / reset
+ *
+ *   0x1070C0  device ID, reads back E9 07 20 12
+ *   0x107070  handshake: 0 arms a measurement, ReadyIn goes high when the
+ *             location block is ready; 0xC001C001 releases ReadyIn
+ *   0x180000  256 byte location block, as b28.c reads it (0b 18 00 00)
+ *
+ * ReadyIn delays are either fixed or replayed from the "T2 - T1" lines of
+ * a node log (log_1528.txt, log_3FB7.txt, log_D786.txt), multiplied by
+ * scale so long captures can be replayed quickly. SPI transfers take the
+ * time they would take on the wire at the emulated clock.
+ *
+ * The ReadyIn rising edge is delivered through a timerfd armed for the
+ * moment the line goes high, so wait=event exercises the same poll() path
+ * as the GPIO line events of the bcm2835 backend.
+ *
+ * args (comma separated):
+ *   log=FILE     replay ReadyIn delays from FILE
+ *   scale=F      multiply ReadyIn delays by F (default 1)
+ *   delay=S      fixed ReadyIn delay in seconds when no log (default 0.005)
+ *   hz=N         emulated SPI clock (default 7812500, divider 32 on Rpi2),
+ *                set_clock_div sets SPI_CORE_HZ / divider
+ *   max_hz=N     fastest clock the emulated cabling carries cleanly; above
+ *                it a transfer has a bit flipped with probability
+ *                10 * (hz / max_hz - 1) (default 0, never)
+ *   crash=P      probability per frame that the device crashes until reset
+ *   reset_ms=N   shortest reset pulse that clears a crash (default 0);
+ *                a shorter one is ignored by the crashed device
+ *   gap=US       minimum chip select gap between transfers (default 2);
+ *                a transfer that starts earlier is lost: reads return 0xFF
+ *                and writes are ignored
+ *   seed=N       random seed
+ *   wait=event|spin  wait on the edge event (default) or poll the level
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "backend.h"
+
+#define SIM_ID_ADDR    0x1070C0
+#define SIM_CTRL_ADDR  0x107070
+#define SIM_LOC_ADDR   0x180000
+#define SIM_LOC_BYTES  256
+#define SIM_PROCEED    0xC001C001u
+#define SIM_ID_WORD    0x122007E9u   /* E9 07 20 12 on the wire */
+#define SIM_MAX_REGS   16
+#define SIM_TAGS       8
+
+struct sim_reg {
+    uint32_t addr;
+    uint32_t val;
+};
+
+struct sim_backend {
+    struct backend be;
+
+    double scale;
+    double fixed_delay;
+    double hz;
+    double max_hz;
+    double crash_rate;
+    unsigned reset_ms;
+    unsigned seed;
+    unsigned min_gap_us;
+    uint64_t last_end;      /* end of the previous transfer */
+    unsigned long gap_errors;
+    unsigned long bit_errors;
+
+    double *delays;         /* replayed ReadyIn delays, seconds */
+    size_t ndelays;
+    size_t next_delay;
+
+    struct sim_reg regs[SIM_MAX_REGS];
+    int nregs;
+
+    unsigned char loc[SIM_LOC_BYTES];
+    int16_t tag_pos[SIM_TAGS][3];
+    unsigned frame_no;
+
+    uint64_t ready_at;      /* CLOCK_MONOTONIC ns when ReadyIn goes high, 0 = low */
+    int timer_fd;           /* fires at ready_at, the simulated edge event */
+    int spin;
+    int crashed;
+    int in_reset;
+    uint64_t reset_at;      /* start of the reset pulse */
+};
+
+/* arm the edge timer for ready_at, or disarm it when ReadyIn goes low */
+static void sim_set_edge(struct sim_backend *s, uint64_t ready_at)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ready_at / 1000000000ULL;
+    its.it_value.tv_nsec = ready_at % 1000000000ULL;
+    /* also drops an edge of the previous measurement nobody waited for;
+     * reading the fd after this would eat the edge of a ready_at that has
+     * passed already and leave a polled ready_fd silent */
+    timerfd_settime(s->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    s->ready_at = ready_at;
+}
+
+static uint32_t sim_reg_read(struct sim_backend *s, uint32_t addr)
+{
+    int i;
+
+    if (addr == SIM_ID_ADDR)
+        return SIM_ID_WORD;
+    for (i = 0; i < s->nregs; i++)
+        if (s->regs[i].addr == addr)
+            return s->regs[i].val;
+    return 0;
+}
+
+static void sim_reg_write(struct sim_backend *s, uint32_t addr, uint32_t val)
+{
+    int i;
+
+    for (i = 0; i < s->nregs; i++)
+        if (s->regs[i].addr == addr)
+            break;
+    if (i == s->nregs) {
+        if (s->nregs == SIM_MAX_REGS)
+            return;
+        s->nregs++;
+    }
+    s->regs[i].addr = addr;
+    s->regs[i].val = val;
+}
+
+static double sim_next_delay(struct sim_backend *s)
+{
+    double d;
+
+    if (s->ndelays == 0)
+        return s->fixed_delay * s->scale;
+    d = s->delays[s->next_delay];
+    s->next_delay = (s->next_delay + 1) % s->ndelays;
+    return d * s->scale;
+}
+
+/* fill the location block with a new measurement: a few tags doing a
+ * random walk, the rest 0xFF filler like the real device */
+static void sim_measure(struct sim_backend *s)
+{
+    unsigned char *p = s->loc;
+    int t, k;
+
+    memset(s->loc, 0xFF, sizeof(s->loc));
+    s->frame_no++;
+    *p++ = 0x01;
+    *p++ = s->frame_no & 0xFF;
+    *p++ = (s->frame_no >> 8) & 0xFF;
+    *p++ = SIM_TAGS;
+    for (t = 0; t < SIM_TAGS; t++) {
+        for (k = 0; k < 3; k++) {
+            s->tag_pos[t][k] += (int16_t)(rand_r(&s->seed) % 7) - 3;
+            *p++ = (unsigned char)(s->tag_pos[t][k] & 0xFF);
+            *p++ = (unsigned char)((s->tag_pos[t][k] >> 8) & 0xFF);
+        }
+    }
+}
+
+static void sim_handshake(struct sim_backend *s, uint32_t val)
+{
+    if (val == 0) {
+        sim_measure(s);
+        sim_set_edge(s, mono_ns() + (uint64_t)(sim_next_delay(s) * 1e9));
+        if (s->crash_rate > 0 &&
+            (double)rand_r(&s->seed) / RAND_MAX < s->crash_rate)
+            s->crashed = 1;
+    } else if (val == SIM_PROCEED) {
+        sim_set_edge(s, 0);
+    }
+}
+
+static unsigned char sim_read_byte(struct sim_backend *s, uint32_t addr)
+{
+    if (addr >= SIM_LOC_ADDR && addr < SIM_LOC_ADDR + SIM_LOC_BYTES)
+        return s->loc[addr - SIM_LOC_ADDR];
+    return (sim_reg_read(s, addr & ~3u) >> (8 * (addr & 3))) & 0xFF;
+}
+
+static int sim_transfer(struct backend *be, const unsigned char *tx,
+                        unsigned char *rx, unsigned len)
+{
+    struct sim_backend *s = (struct sim_backend *)be;
+    uint64_t done = mono_ns() + (uint64_t)(len * 8 * 1e9 / s->hz);
+    unsigned char cmd = len ? tx[0] : 0;
+    uint32_t addr = 0, val;
+    unsigned i;
+
+    if (len >= 4)
+        addr = ((uint32_t)tx[1] << 16) | ((uint32_t)tx[2] << 8) | tx[3];
+
+    if (s->last_end && mono_ns() - s->last_end < s->min_gap_us * 1000ULL) {
+        s->gap_errors++;
+        memset(rx, 0xFF, len);
+    } else if (s->in_reset || len < 5) {
+        memset(rx, 0x00, len);
+    } else if (s->crashed) {
+        memset(rx, 0xFF, len);
+    } else if (cmd == 0x0b) {
+        memset(rx, 0xFF, 5);
+        for (i = 5; i < len; i++)
+            rx[i] = sim_read_byte(s, addr + i - 5);
+    } else if (cmd == 0x02 && len >= 8) {
+        val = tx[4] | ((uint32_t)tx[5] << 8) | ((uint32_t)tx[6] << 16) |
+              ((uint32_t)tx[7] << 24);
+        memset(rx, 0xFF, len);
+        sim_reg_write(s, addr, val);
+        if (addr == SIM_CTRL_ADDR)
+            sim_handshake(s, val);
+    } else {
+        memset(rx, 0xFF, len);
+    }
+
+    /* a marginal link flips bits */
+    if (s->max_hz > 0 && s->hz > s->max_hz && len &&
+        (double)rand_r(&s->seed) / RAND_MAX < 10 * (s->hz / s->max_hz - 1)) {
+        s->bit_errors++;
+        rx[rand_r(&s->seed) % len] ^= 1 << (rand_r(&s->seed) % 8);
+    }
+
+    /* the bytes take this long on the wire */
+    while (mono_ns() < done)
+        ;
+    s->last_end = done;
+    return 0;
+}
+
+static int sim_wait_ready(struct backend *be, int timeout_ms)
+{
+    struct sim_backend *s = (struct sim_backend *)be;
+    uint64_t deadline = 0, expirations, now = mono_ns();
+    int ret;
+
+    be->ready_edge_ns = 0;
+    if (s->ready_at == 0 || s->in_reset) {
+        /* nothing armed, ReadyIn stays low */
+        if (timeout_ms < 0) {
+            fprintf(stderr, "sim: waiting for ReadyIn with no measurement armed\n");
+            return -1;
+        }
+        delay_ms(timeout_ms);
+        return 0;
+    }
+
+    /* already high; the edge is known if its timer expiry is still queued */
+    if (now >= s->ready_at) {
+        if (read(s->timer_fd, &expirations, sizeof(expirations)) > 0)
+            be->ready_edge_ns = s->ready_at;
+        return 1;
+    }
+
+    if (s->spin) {
+        if (timeout_ms >= 0)
+            deadline = now + (uint64_t)timeout_ms * 1000000ULL;
+        while ((now = mono_ns()) < s->ready_at)
+            if (deadline && now >= deadline)
+                return 0;
+    } else {
+        ret = backend_poll_in(s->timer_fd, timeout_ms);
+        if (ret <= 0)
+            return ret;
+        if (read(s->timer_fd, &expirations, sizeof(expirations)) < 0)
+            return -1;
+    }
+    be->ready_edge_ns = s->ready_at;
+    return 1;
+}
+
+static void sim_set_reset(struct backend *be, int level)
+{
+    struct sim_backend *s = (struct sim_backend *)be;
+
+    if (!level) {
+        s->in_reset = 1;
+        s->reset_at = mono_ns();
+        s->nregs = 0;
+        sim_set_edge(s, 0);
+    } else if (s->in_reset) {
+        s->in_reset = 0;
+        if (mono_ns() - s->reset_at >= s->reset_ms * 1000000ULL)
+            s->crashed = 0;
+    }
+}
+
+static int sim_set_clock_div(struct backend *be, unsigned div)
+{
+    struct sim_backend *s = (struct sim_backend *)be;
+
+    if (div < 2 || div > 65536 || (div & (div - 1)))
+        return -1;
+    s->hz = (double)SPI_CORE_HZ / div;
+    return 0;
+}
+
+static void sim_close(struct backend *be)
+{
+    struct sim_backend *s = (struct sim_backend *)be;
+
+    if (s->bit_errors)
+        printf("sim: %lu transfers corrupted above %.0f Hz\n", s->bit_errors, s->max_hz);
+    if (s->gap_errors)
+        printf("sim: %lu transfers lost, started within %u us of the previous one\n",
+               s->gap_errors, s->min_gap_us);
+    if (s->timer_fd >= 0)
+        close(s->timer_fd);
+    free(s->delays);
+    free(s);
+}
+
+/* collect the "T2 - T1  - 5.524187" lines of a node log */
+static int sim_load_log(struct sim_backend *s, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    size_t cap = 0;
+    double d;
+
+    if (!f) {
+        fprintf(stderr, "sim: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "T2 - T1", 7) != 0)
+            continue;
+        if (sscanf(strrchr(line, '-') + 1, "%lf", &d) != 1)
+            continue;
+        if (s->ndelays == cap) {
+            double *n;
+
+            cap = cap ? cap * 2 : 1024;
+            n = realloc(s->delays, cap * sizeof(*n));
+            if (!n) {
+                fclose(f);
+                return -1;
+            }
+            s->delays = n;
+        }
+        s->delays[s->ndelays++] = d;
+    }
+    fclose(f);
+    if (s->ndelays == 0) {
+        fprintf(stderr, "sim: no T2 - T1 timings in %s\n", path);
+        return -1;
+    }
+    printf("sim: replaying %zu ReadyIn delays from %s\n", s->ndelays, path);
+    return 0;
+}
+
+static int sim_parse_args(struct sim_backend *s, const char *args)
+{
+    char *copy = strdup(args), *save = NULL, *tok;
+    int ret = 0;
+
+    if (!copy)
+        return -1;
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(tok, '=');
+
+        if (!val) {
+            fprintf(stderr, "sim: bad argument %s\n", tok);
+            ret = -1;
+            break;
+        }
+        *val++ = '\0';
+        if (strcmp(tok, "log") == 0)
+            ret = sim_load_log(s, val);
+        else if (strcmp(tok, "scale") == 0)
+            s->scale = atof(val);
+        else if (strcmp(tok, "delay") == 0)
+            s->fixed_delay = atof(val);
+        else if (strcmp(tok, "hz") == 0)
+            s->hz = atof(val);
+        else if (strcmp(tok, "max_hz") == 0)
+            s->max_hz = atof(val);
+        else if (strcmp(tok, "crash") == 0)
+            s->crash_rate = atof(val);
+        else if (strcmp(tok, "reset_ms") == 0)
+            s->reset_ms = strtoul(val, NULL, 0);
+        else if (strcmp(tok, "seed") == 0)
+            s->seed = strtoul(val, NULL, 0);
+        else if (strcmp(tok, "gap") == 0)
+            s->min_gap_us = strtoul(val, NULL, 0);
+        else if (strcmp(tok, "wait") == 0)
+            s->spin = strcmp(val, "spin") == 0;
+        else {
+            fprintf(stderr, "sim: unknown argument %s\n", tok);
+            ret = -1;
+        }
+        if (ret)
+            break;
+    }
+    free(copy);
+    return ret;
+}
+
+struct backend *sim_backend_open(const char *args, const struct backend_pins *pins)
+{
+    struct sim_backend *s = calloc(1, sizeof(*s));
+
+    (void)pins;
+    if (!s)
+        return NULL;
+    s->scale = 1.0;
+    s->fixed_delay = 0.005;
+    s->hz = (double)SPI_CORE_HZ / SPI_DEFAULT_DIV;
+    s->seed = 1;
+    s->min_gap_us = 2;
+    s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (s->timer_fd < 0 || sim_parse_args(s, args) != 0 || s->hz <= 0) {
+        sim_close(&s->be);
+        return NULL;
+    }
+
+    s->be.name = "sim";
+    s->be.ready_fd = s->timer_fd;
+    s->be.transfer = sim_transfer;
+    s->be.wait_ready = sim_wait_ready;
+    s->be.set_clock_div = sim_set_clock_div;
+    s->be.set_reset = sim_set_reset;
+    s->be.close = sim_close;
+    return &s->be;
+}
@@ -0,0 +1,240 @@
+/*
+ * backend_spidev.c - tracker access through the kernel spidev driver and
+ * the GPIO character device. Needs no root, only read / write access to
+ * /dev/spidevB.C and /dev/gpiochipN (the spi and gpio groups on
+ * Raspberry Pi OS).
+ *
+ * Every transfer is one spi_ioc_transfer straight between the caller's
+ * buffers, so a location read lands in its frame slot without a copy,
+ * and a whole spi_script goes to the kernel in a single SPI_IOC_MESSAGE
+ * with chip select released and the gap waited out between commands.
+ *
+ * ReadyIn and reset are addressed by their BCM line numbers on the GPIO
+ * chip, as wiringPi pin numbers mean nothing to the kernel. args (comma
+ * separated):
+ *   dev=PATH          spidev device (default /dev/spidev0.CS)
+ *   chip=PATH         GPIO chip of ReadyIn and reset (default /dev/gpiochip0)
+ *   ready=N           ReadyIn line (default READYIN_GPIO)
+ *   reset=N           reset line (default SPI_RESET_GPIO)
+ *   wait=event|spin   edge events (default) or polling the line level
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "backend.h"
+#include "spi_script.h"
+
+struct spidev_backend {
+    struct backend be;
+    int spi_fd;
+    int event_fd;       /* ReadyIn line events */
+    int reset_fd;       /* reset line handle */
+    unsigned hz;
+};
+
+static int spidev_transfer(struct backend *be, const unsigned char *tx,
+                           unsigned char *rx, unsigned len)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+    struct spi_ioc_transfer t;
+
+    memset(&t, 0, sizeof(t));
+    t.tx_buf = (uintptr_t)tx;
+    t.rx_buf = (uintptr_t)rx;
+    t.len = len;
+    t.speed_hz = s->hz;
+    t.bits_per_word = 8;
+    return ioctl(s->spi_fd, SPI_IOC_MESSAGE(1), &t) < 0 ? -1 : 0;
+}
+
+static int spidev_transfer_script(struct backend *be, const struct spi_cmd *cmds,
+                                  unsigned n)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+    struct spi_ioc_transfer t[SPI_SCRIPT_MAX];
+    unsigned i;
+
+    if (n > SPI_SCRIPT_MAX)
+        return -1;
+    memset(t, 0, n * sizeof(t[0]));
+    for (i = 0; i < n; i++) {
+        t[i].tx_buf = (uintptr_t)cmds[i].tx;
+        t[i].rx_buf = (uintptr_t)cmds[i].rx;
+        t[i].len = cmds[i].len;
+        t[i].speed_hz = s->hz;
+        t[i].bits_per_word = 8;
+        t[i].delay_usecs = cmds[i].gap_us > 0xffff ? 0xffff : cmds[i].gap_us;
+        /* each command is a transfer of its own for the device */
+        t[i].cs_change = i + 1 < n;
+    }
+    return ioctl(s->spi_fd, SPI_IOC_MESSAGE(n), t) < 0 ? -1 : 0;
+}
+
+static int spidev_set_clock_div(struct backend *be, unsigned div)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+    uint32_t hz;
+
+    if (div < 2 || div > 65536 || (div & (div - 1)))
+        return -1;
+    hz = SPI_CORE_HZ / div;
+    /* the kernel clamps speed_hz of a transfer to the device maximum */
+    if (ioctl(s->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0)
+        return -1;
+    s->hz = hz;
+    return 0;
+}
+
+static int spidev_wait_ready_spin(struct backend *be, int timeout_ms)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+    unsigned long long start = mono_ns();
+    struct gpiohandle_data level;
+
+    be->ready_edge_ns = 0;
+    for (;;) {
+        if (ioctl(s->event_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &level) < 0)
+            return -1;
+        if (level.values[0])
+            return 1;
+        if (timeout_ms >= 0 && mono_ns() - start >= timeout_ms * 1000000ULL)
+            return 0;
+    }
+}
+
+static int spidev_wait_ready_event(struct backend *be, int timeout_ms)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+
+    return backend_gpio_wait_edge(s->event_fd, timeout_ms, &be->ready_edge_ns);
+}
+
+static void spidev_set_reset(struct backend *be, int level)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+    struct gpiohandle_data data;
+
+    memset(&data, 0, sizeof(data));
+    data.values[0] = level ? 1 : 0;
+    if (ioctl(s->reset_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0)
+        perror("spidev: cannot drive reset");
+}
+
+static void spidev_close(struct backend *be)
+{
+    struct spidev_backend *s = (struct spidev_backend *)be;
+
+    if (s->spi_fd >= 0)
+        close(s->spi_fd);
+    if (s->event_fd >= 0)
+        close(s->event_fd);
+    if (s->reset_fd >= 0)
+        close(s->reset_fd);
+    free(s);
+}
+
+/* the reset line as an output, high (device running) to start with */
+static int spidev_open_reset(const char *chip, unsigned line)
+{
+    struct gpiohandle_request req;
+    int fd, ret;
+
+    fd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", chip, strerror(errno));
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = line;
+    req.lines = 1;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    req.default_values[0] = 1;
+    snprintf(req.consumer_label, sizeof(req.consumer_label), "trakray-reset");
+    ret = ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
+    close(fd);
+    if (ret < 0) {
+        fprintf(stderr, "cannot get the reset line: %s\n", strerror(errno));
+        return -1;
+    }
+    return req.fd;
+}
+
+static int spidev_setup(int fd)
+{
+    uint8_t mode = SPI_MODE_0, bits = 8;
+    uint32_t hz = SPI_CORE_HZ / SPI_DEFAULT_DIV;
+
+    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+        ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) {
+        perror("spidev: cannot set up the bus");
+        return -1;
+    }
+    return 0;
+}
+
+struct backend *spidev_backend_open(const char *args, const struct backend_pins *pins)
+{
+    struct spidev_backend *s;
+    char dev[64], chip[64] = "/dev/gpiochip0";
+    unsigned ready = READYIN_GPIO, reset = SPI_RESET_GPIO;
+    int spin = 0;
+    const char *p;
+
+    snprintf(dev, sizeof(dev), "/dev/spidev0.%d", pins->cs);
+    for (p = args; *p; p += strcspn(p, ","), p += (*p == ',')) {
+        if (strncmp(p, "dev=", 4) == 0)
+            snprintf(dev, sizeof(dev), "%.*s", (int)strcspn(p + 4, ","), p + 4);
+        else if (strncmp(p, "chip=", 5) == 0)
+            snprintf(chip, sizeof(chip), "%.*s", (int)strcspn(p + 5, ","), p + 5);
+        else if (strncmp(p, "ready=", 6) == 0)
+            ready = strtoul(p + 6, NULL, 0);
+        else if (strncmp(p, "reset=", 6) == 0)
+            reset = strtoul(p + 6, NULL, 0);
+        else if (strncmp(p, "wait=spin", 9) == 0)
+            spin = 1;
+        else if (strncmp(p, "wait=event", 10) == 0)
+            spin = 0;
+        else {
+            fprintf(stderr, "spidev: unknown argument %.*s\n", (int)strcspn(p, ","), p);
+            return NULL;
+        }
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    s->event_fd = s->reset_fd = -1;
+    s->hz = SPI_CORE_HZ / SPI_DEFAULT_DIV;
+    s->spi_fd = open(dev, O_RDWR | O_CLOEXEC);
+    if (s->spi_fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", dev, strerror(errno));
+        spidev_close(&s->be);
+        return NULL;
+    }
+    s->event_fd = backend_gpio_events(chip, ready);
+    s->reset_fd = spidev_open_reset(chip, reset);
+    if (spidev_setup(s->spi_fd) != 0 || s->event_fd < 0 || s->reset_fd < 0) {
+        spidev_close(&s->be);
+        return NULL;
+    }
+
+    s->be.name = "spidev";
+    s->be.ready_fd = s->event_fd;
+    s->be.transfer = spidev_transfer;
+    s->be.transfer_script = spidev_transfer_script;
+    s->be.wait_ready = spin ? spidev_wait_ready_spin : spidev_wait_ready_event;
+    s->be.set_clock_div = spidev_set_clock_div;
+    s->be.set_reset = spidev_set_reset;
+    s->be.close = spidev_close;
+    return &s->be;
+}
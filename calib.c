@@ -0,0 +1,145 @@
+/*
+ * calib.c - SPI clock calibration, see calib.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "calib.h"
+#include "backend.h"
+#include "spi_script.h"
+#include "health.h"
+
+#define CALIB_MAX_DIVS 16
+#define LOC_READ_BYTES 261
+
+static const unsigned char rd_id[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static const unsigned char rd_loc[] = { 0x0b, 0x18, 0x00, 0x00, 0x00 };
+
+/* one transfer in place, returns its time in ns */
+static unsigned long long timed_read(struct backend *be, unsigned char *buf, unsigned len)
+{
+    unsigned long long t = mono_ns();
+
+    be->transfer(be, buf, buf, len);
+    t = mono_ns() - t;
+    delay_us(SPI_GAP_US);
+    return t;
+}
+
+static void calib_div(struct backend *be, struct calib_result *r, unsigned long reads)
+{
+    unsigned char id[sizeof(rd_id)], loc[LOC_READ_BYTES], prev[LOC_READ_BYTES];
+    unsigned long long id_ns = 0, loc_ns = 0;
+    unsigned long i;
+    int have_prev = 0;
+
+    for (i = 0; i < reads; i++) {
+        memcpy(id, rd_id, sizeof(id));
+        id_ns += timed_read(be, id, sizeof(id));
+        r->id_reads++;
+        if (!health_id_ok(id))
+            r->id_errors++;
+
+        memset(loc, 0xFF, sizeof(loc));
+        memcpy(loc, rd_loc, sizeof(rd_loc));
+        loc_ns += timed_read(be, loc, sizeof(loc));
+        r->frame_reads++;
+        if (health_frame_suspect(loc + sizeof(rd_loc), sizeof(loc) - sizeof(rd_loc)) ||
+            (have_prev && memcmp(loc + sizeof(rd_loc), prev + sizeof(rd_loc),
+                                 sizeof(loc) - sizeof(rd_loc)) != 0)) {
+            r->frame_errors++;
+            /* compare against the next read rather than a corrupted one */
+            have_prev = 0;
+            continue;
+        }
+        memcpy(prev, loc, sizeof(loc));
+        have_prev = 1;
+    }
+    r->id_us = reads ? id_ns / 1e3 / reads : 0;
+    r->frame_us = reads ? loc_ns / 1e3 / reads : 0;
+}
+
+static void print_row(FILE *f, const struct calib_result *r)
+{
+    unsigned long reads = r->id_reads + r->frame_reads;
+    unsigned long errors = r->id_errors + r->frame_errors;
+    char id[32], frame[32];
+
+    snprintf(id, sizeof(id), "%lu/%lu", r->id_errors, r->id_reads);
+    snprintf(frame, sizeof(frame), "%lu/%lu", r->frame_errors, r->frame_reads);
+    fprintf(f, "%8u %9.3f %13s %13s %10.2e %8.1f %9.1f %7.2f\n",
+            r->div, SPI_CORE_HZ / 1e6 / r->div, id, frame,
+            reads ? (double)errors / reads : 0, r->id_us, r->frame_us,
+            r->frame_us > 0 ? LOC_READ_BYTES * 8 / r->frame_us : 0);
+}
+
+unsigned calib_run(struct backend *be, unsigned long reads, FILE *f)
+{
+    struct calib_result res[CALIB_MAX_DIVS];
+    unsigned div, n = 0, clean = 0, pick;
+
+    if (!be->set_clock_div) {
+        fprintf(f, "calibration: backend %s has a fixed SPI clock\n", be->name);
+        return 0;
+    }
+    fprintf(f, "SPI clock calibration, %lu ID and %lu location reads per divider, "
+            "%.0f MHz core clock\n", reads, reads, SPI_CORE_HZ / 1e6);
+    fprintf(f, "%8s %9s %13s %13s %10s %8s %9s %7s\n", "divider", "MHz", "ID errors",
+            "frame errors", "error rate", "ID us", "frame us", "Mbit/s");
+    for (div = CALIB_SLOWEST_DIV; div >= CALIB_FASTEST_DIV && n < CALIB_MAX_DIVS; div /= 2) {
+        if (be->set_clock_div(be, div) != 0)
+            continue;
+        memset(&res[n], 0, sizeof(res[n]));
+        res[n].div = div;
+        calib_div(be, &res[n], reads);
+        print_row(f, &res[n]);
+        if (res[n].id_errors || res[n].frame_errors)
+            break;
+        clean = ++n;
+    }
+
+    if (!clean) {
+        be->set_clock_div(be, SPI_DEFAULT_DIV);
+        fprintf(f, "no divider read cleanly, keeping %u\n", SPI_DEFAULT_DIV);
+        return 0;
+    }
+    pick = clean > CALIB_MARGIN_STEPS ? clean - 1 - CALIB_MARGIN_STEPS : 0;
+    be->set_clock_div(be, res[pick].div);
+    fprintf(f, "fastest clean divider %u, using %u (%.3f MHz)\n",
+            res[clean - 1].div, res[pick].div, SPI_CORE_HZ / 1e6 / res[pick].div);
+    return res[pick].div;
+}
+
+int calib_save(const char *path, unsigned div)
+{
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        perror(tmp);
+        return -1;
+    }
+    fprintf(f, "%u\n", div);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        perror(path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+unsigned calib_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    unsigned div = 0;
+
+    if (!f)
+        return 0;
+    if (fscanf(f, "%u", &div) != 1)
+        div = 0;
+    fclose(f);
+    return div;
+}
@@ -0,0 +1,49 @@
+/*
+ * calib.h - SPI clock calibration of the tracker link
+ *
+ * The node used to run at a fixed divider of 32 without knowing whether
+ * the cabling could go faster or is marginal there. Calibration sweeps
+ * the dividers from slow to fast, doing `reads` ID readbacks and as many
+ * location block reads at each. An ID read is good when it returns
+ * E9 07 20 12; a location block read is good when it matches the read
+ * before it, as the block does not change between measurements. The
+ * sweep stops at the first divider with errors.
+ *
+ * The divider kept is one step slower than the fastest error free one
+ * (CALIB_MARGIN_STEPS), and never faster than a divider that failed. It
+ * is written to a one line file that later runs load with calib_load().
+ */
+
+#ifndef TRAKRAY_CALIB_H
+#define TRAKRAY_CALIB_H
+
+#include <stdio.h>
+
+#define CALIB_DEFAULT_FILE "trakray.clock"
+#define CALIB_DEFAULT_READS 2000
+#define CALIB_SLOWEST_DIV 256
+#define CALIB_FASTEST_DIV 2
+#define CALIB_MARGIN_STEPS 1
+
+struct backend;
+
+struct calib_result {
+    unsigned div;
+    unsigned long id_reads, id_errors;
+    unsigned long frame_reads, frame_errors;
+    double id_us, frame_us;     /* mean transfer time */
+};
+
+/*
+ * sweep the dividers, print the table to f and return the divider to
+ * use, 0 when no divider read cleanly or the backend has a fixed clock
+ */
+unsigned calib_run(struct backend *be, unsigned long reads, FILE *f);
+
+/* 0 or -1, written through a temporary file so a crash keeps the old one */
+int calib_save(const char *path, unsigned div);
+
+/* the saved divider, 0 when there is none */
+unsigned calib_load(const char *path);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * clocksync.c - node clocks on the collector's timeline, see clocksync.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clocksync.h"
+
+int clocksync_init(struct clocksync *cs)
+{
+    memset(cs, 0, sizeof(*cs));
+    pthread_mutex_init(&cs->lock, NULL);
+    cs->node = calloc(CLOCKSYNC_MAX_NODES, sizeof(*cs->node));
+    if (!cs->node) {
+        fprintf(stderr, "cannot allocate the clock table\n");
+        return -1;
+    }
+    return 0;
+}
+
+void clocksync_free(struct clocksync *cs)
+{
+    unsigned i;
+
+    for (i = 0; i < CLOCKSYNC_MAX_NODES; i++)
+        free(cs->node[i].latency);
+    free(cs->node);
+    cs->node = NULL;
+}
+
+/* the entry of serial, claimed when create is set; NULL if none */
+static struct clocksync_node *node_lookup(struct clocksync *cs, uint32_t serial, int create)
+{
+    unsigned i, h = (serial * 2654435761u) & (CLOCKSYNC_MAX_NODES - 1);
+    struct clocksync_node *n;
+
+    for (i = 0; i < CLOCKSYNC_MAX_NODES; i++, h = (h + 1) & (CLOCKSYNC_MAX_NODES - 1)) {
+        n = &cs->node[h];
+        if (!n->used) {
+            if (!create)
+                return NULL;
+            n->latency = malloc(sizeof(*n->latency));
+            if (!n->latency)
+                return NULL;
+            hist_init(n->latency);
+            n->used = 1;
+            n->serial = serial;
+            atomic_fetch_add(&cs->nodes, 1);
+            return n;
+        }
+        if (n->serial == serial)
+            return n;
+    }
+    return NULL;
+}
+
+/* offset and drift from the exchanges with a short round trip */
+static void estimate(struct clocksync_node *n)
+{
+    const struct clocksync_sample *s;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, x, y, m, span;
+    int64_t limit, best_offset = 0;
+    uint64_t ref = 0, tmin = UINT64_MAX, tmax = 0;
+    unsigned i, used = 0;
+
+    n->min_delay = INT64_MAX;
+    for (i = 0; i < n->nsamples; i++)
+        if (n->sample[i].delay < n->min_delay) {
+            n->min_delay = n->sample[i].delay;
+            best_offset = n->sample[i].offset;
+            ref = n->sample[i].t;
+        }
+    limit = 2 * n->min_delay + CLOCKSYNC_SLACK_NS;
+    /* x relative to the fastest exchange, so doubles keep the ns */
+    for (i = 0; i < n->nsamples; i++) {
+        s = &n->sample[i];
+        if (s->delay > limit)
+            continue;
+        x = (double)(int64_t)(s->t - ref);
+        y = (double)(s->offset - best_offset);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        if (s->t < tmin)
+            tmin = s->t;
+        if (s->t > tmax)
+            tmax = s->t;
+        used++;
+    }
+    n->used_samples = used;
+    n->ref = ref;
+    n->offset = best_offset;
+    n->drift = 0;
+    span = tmax > tmin ? (double)(tmax - tmin) : 0;
+    if (used >= 2 && span >= CLOCKSYNC_MIN_SPAN_NS) {
+        m = used * sxx - sx * sx;
+        if (m > 0) {
+            n->drift = (used * sxy - sx * sy) / m;
+            n->offset = best_offset + (sy - n->drift * sx) / used;
+        }
+    }
+    n->valid = 1;
+}
+
+void clocksync_exchange(struct clocksync *cs, uint32_t serial, const struct wire_sync *s)
+{
+    struct clocksync_node *n;
+    struct clocksync_sample *smp;
+    int64_t delay;
+
+    if (!s->t1 || !s->t2 || !s->t3 || !s->t4)
+        return;
+    pthread_mutex_lock(&cs->lock);
+    n = node_lookup(cs, serial, 1);
+    if (!n) {
+        cs->full++;
+        goto out;
+    }
+    n->exchanges++;
+    delay = (int64_t)(s->t4 - s->t1) - (int64_t)(s->t3 - s->t2);
+    if (delay < 0) {
+        n->rejected++;
+        goto out;
+    }
+    smp = &n->sample[n->head];
+    n->head = (n->head + 1) % CLOCKSYNC_SAMPLES;
+    if (n->nsamples < CLOCKSYNC_SAMPLES)
+        n->nsamples++;
+    smp->t = s->t1 + (s->t4 - s->t1) / 2;
+    smp->offset = ((int64_t)(s->t2 - s->t1) + (int64_t)(s->t3 - s->t4)) / 2;
+    smp->delay = delay;
+    estimate(n);
+out:
+    pthread_mutex_unlock(&cs->lock);
+}
+
+void clocksync_frames(struct clocksync *cs, const char *p, unsigned n, size_t stride,
+                      uint64_t rx_ns)
+{
+    const struct wire_hdr *h;
+    struct clocksync_node *node = NULL;
+    uint64_t acq;
+    double corr;
+    unsigned i;
+
+    if (!atomic_load(&cs->nodes))
+        return;
+    pthread_mutex_lock(&cs->lock);
+    for (i = 0; i < n; i++, p += stride) {
+        h = (const struct wire_hdr *)p;
+        /* runs of frames are mostly of one node */
+        if (!node || node->serial != h->serial)
+            node = node_lookup(cs, h->serial, 0);
+        if (!node || !node->valid)
+            continue;
+        /* only the correction in a double, the epoch in ns would lose 256 ns */
+        corr = node->offset + node->drift * (double)(int64_t)(h->real_ns - node->ref);
+        acq = h->real_ns + (int64_t)(corr < 0 ? corr - 0.5 : corr + 0.5);
+        node->frames++;
+        if (rx_ns < acq) {
+            node->early++;
+            continue;
+        }
+        hist_add(node->latency, rx_ns - acq);
+    }
+    pthread_mutex_unlock(&cs->lock);
+}
+
+void clocksync_print(struct clocksync *cs, FILE *f)
+{
+    const struct clocksync_node *n;
+    char name[64];
+    unsigned i;
+
+    pthread_mutex_lock(&cs->lock);
+    for (i = 0; i < CLOCKSYNC_MAX_NODES; i++) {
+        n = &cs->node[i];
+        if (!n->used || !n->valid)
+            continue;
+        fprintf(f, "Clock %08x: offset %+.3f ms, drift %+.3f ppm, round trip %.3f ms, "
+                "%u of %lu exchanges used (%lu rejected), %lu frames, %lu before acquisition\n",
+                n->serial, n->offset / 1e6, n->drift * 1e6, n->min_delay / 1e6,
+                n->used_samples, n->exchanges, n->rejected, n->frames, n->early);
+        if (n->latency->count) {
+            snprintf(name, sizeof(name), "Clock %08x: acquisition to receive", n->serial);
+            hist_print(n->latency, f, name, 1e6, "ms");
+        }
+    }
+    if (cs->full)
+        fprintf(f, "Clock: %lu exchanges of nodes beyond %u\n", cs->full, CLOCKSYNC_MAX_NODES);
+    pthread_mutex_unlock(&cs->lock);
+}
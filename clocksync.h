@@ -0,0 +1,89 @@
+/*
+ * clocksync.h - node clocks on the collector's timeline
+ *
+ * Frames carry the acquisition time on the node's CLOCK_REALTIME, which
+ * is off the collector's by whatever NTP left (or did not fix) on each
+ * Pi, so arrival minus acquisition is not the latency and frames of two
+ * nodes cannot be lined up. Nodes that exchange clock messages with the
+ * collector (wire.h, b28 -Y) hand in one completed exchange t1..t4 per
+ * request; each gives an offset of the collector's clock against the
+ * node's at node time (t1 + t4) / 2,
+ *
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2, round trip = (t4 - t1) - (t3 - t2)
+ *
+ * as NTP does, off by at most half the asymmetry of the round trip. Of
+ * the last CLOCKSYNC_SAMPLES exchanges of a node only those whose round
+ * trip is within twice the shortest plus CLOCKSYNC_SLACK_NS are kept,
+ * since a queued request or reply only adds error, and a straight line
+ * through their offsets over node time gives the offset and its drift.
+ * Until the exchanges span CLOCKSYNC_MIN_SPAN_NS the offset of the
+ * fastest one is used, without drift.
+ *
+ * The reactors hand in the frames of synchronized nodes with their
+ * kernel receive time; acquisition mapped onto the collector's clock to
+ * that receive time is the sensor to collector latency, kept per node.
+ * One lock covers the table, taken once per run of frames, as for the
+ * sequence numbers.
+ */
+
+#ifndef TRAKRAY_CLOCKSYNC_H
+#define TRAKRAY_CLOCKSYNC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "hist.h"
+#include "wire.h"
+
+#define CLOCKSYNC_MAX_NODES 1024        /* a power of two */
+#define CLOCKSYNC_SAMPLES 32
+#define CLOCKSYNC_SLACK_NS 100000
+#define CLOCKSYNC_MIN_SPAN_NS 1000000000ULL
+
+struct clocksync_sample {
+    uint64_t t;                         /* node time, middle of the exchange */
+    int64_t offset;                     /* collector minus node, ns */
+    int64_t delay;                      /* round trip, ns */
+};
+
+struct clocksync_node {
+    uint32_t serial;
+    int used;
+    struct clocksync_sample sample[CLOCKSYNC_SAMPLES];
+    unsigned nsamples, head;
+    unsigned long exchanges, rejected;  /* rejected: negative round trip */
+
+    /* the estimate, offset at node time ref plus drift ns per ns after it */
+    int valid;
+    uint64_t ref;
+    double offset, drift;
+    int64_t min_delay;
+    unsigned used_samples;
+
+    unsigned long frames, early;        /* early: arrived before acquisition */
+    struct hist *latency;               /* acquisition to kernel receive, ns */
+};
+
+struct clocksync {
+    pthread_mutex_t lock;
+    struct clocksync_node *node;
+    atomic_uint nodes;                  /* in use, frames skip the lock while 0 */
+    unsigned long full;                 /* exchanges of nodes that found no entry */
+};
+
+int clocksync_init(struct clocksync *cs);
+void clocksync_free(struct clocksync *cs);
+
+/* a completed exchange of node serial */
+void clocksync_exchange(struct clocksync *cs, uint32_t serial, const struct wire_sync *s);
+
+/* n v2 frames stride bytes apart, received at rx_ns on the collector's clock */
+void clocksync_frames(struct clocksync *cs, const char *p, unsigned n, size_t stride,
+                      uint64_t rx_ns);
+
+/* offset, drift and latency of every synchronized node */
+void clocksync_print(struct clocksync *cs, FILE *f);
+
+#endif
@@ -0,0 +1,693 @@
+/*
+ * collector_bench.c - load test for the collector (tcp_server.c)
+ *
+ * Compile
+ * gcc -O2 -o collector_bench collector_bench.c hist.c wire.c -lpthread
+ * ./collector_bench [-c conns[,conns...]] [-r fps] [-G b28_log] [-B burst] [-D trackers]
+ *                   [-C reconnects_per_s] [-d seconds] [-p port] [-V 1|2] [-S frames]
+ *                   [-o results.tsv [-L label]] -- ./server -p 5019
+ *
+ * Starts the collector given after "--" with its stdout on a pipe, opens
+ * conns node connections and sends r frames per second on each for the
+ * given time, in bursts of burst frames per send() like a node batching
+ * with -c. Every frame carries its connection, sequence number and the
+ * CLOCK_MONOTONIC time it was handed to send(); the frames coming back on
+ * the collector's stdout give the connections that were really served,
+ * the throughput, frames lost or reordered and the send to output
+ * latency, which includes any output buffering of the collector.
+ * -V 2 sends every frame behind a version 2 wire header (wire.h) as a
+ * node does, so the collector's header checks are part of the cost.
+ *
+ * Every connection keeps its own schedule, started at a random phase so
+ * the fleet is not in lock step. -G takes the time between frames from
+ * the ReadyIn waits ("T2 - T1") of a b28 log instead of -r, each
+ * connection replaying them from a random place, so the long gaps and
+ * the 200 fps runs of real trackers are part of the load. -D spreads the
+ * frames of a connection over that many trackers (the device of the
+ * v2 header, as b28 with several -b), so conns x trackers nodes reach
+ * the collector's per node tables. -C closes that many connections per
+ * second, after their last burst is out, and connects them again, as
+ * nodes that reboot or roam; their sequence numbers go on. -S starts the
+ * counter of every tracker at that many frames, as nodes that were
+ * running before the collector came up; the frames before are not lost,
+ * and a run fails when the collector (its "Wire:" line on stderr) counts
+ * more missing frames than came back lost.
+ *
+ * Besides the above it reports the collector's CPU time per frame and
+ * its resident memory per connection (growth of VmRSS from before the
+ * connections to the end of the run). A list of connection counts runs
+ * the test once per count, each against a fresh collector, to find where
+ * latency starts to degrade. -o appends one tab separated line per run
+ * (with a header for a new file), tagged with -L, to compare builds.
+ */
+
+#define _GNU_SOURCE     /* F_SETPIPE_SZ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "hist.h"
+#include "wire.h"
+
+#define FRAME_BYTES 256
+#define BENCH_SERIAL 0xbe000000     /* + connection number */
+#define BENCH_MAGIC 0x48434e42      /* "BNCH" */
+#define CONNECT_TIMEOUT_MS 3000
+#define MAX_BURST 64
+#define MAX_RUNS 16
+#define MAX_SLEEP_NS 10000000ULL    /* the sender looks at churn this often */
+#define MAX_LAG_NS 1000000000ULL    /* a connection further behind skips ahead */
+
+struct bench_frame {
+    uint32_t magic;
+    uint32_t conn;
+    uint64_t seq;
+    uint64_t sent_ns;
+    unsigned char fill[WIRE_SERIAL_INDEX - 24];
+    uint32_t serial;                /* little endian on the Pi and here */
+    unsigned char tail[FRAME_BYTES - WIRE_SERIAL_INDEX - 4];
+};
+
+_Static_assert(sizeof(struct bench_frame) == FRAME_BYTES, "bench frame is one frame");
+
+struct bench_conn {
+    int fd;
+    int connecting;             /* reconnect in progress */
+    uint64_t seq;
+    uint64_t next;              /* CLOCK_MONOTONIC of its next burst */
+    unsigned gap;               /* next -G gap to replay */
+    _Alignas(8) unsigned char out[MAX_BURST * WIRE_V2_BYTES];
+    unsigned out_len;
+    unsigned out_done;          /* bytes of out already sent, out_len = idle */
+    uint64_t rx_seq;            /* next sequence number expected back */
+    int seen;
+};
+
+/* what one run measured */
+struct bench_result {
+    int conns, connected, served;
+    unsigned long sent, skipped, reconnects;
+    uint64_t received, lost, reordered, bad;
+    long missing;               /* counted by the collector, -1 = not reported */
+    double seconds, cpu, rss_idle_kb, rss_kb, hwm_kb;
+    struct hist lat;
+};
+
+static struct bench_conn *conns;
+static int nconns, port = 5019, burst = 1, version = 1, trackers = 1;
+static double fps = 100, seconds = 10, churn;
+static uint64_t first_frame;        /* -S */
+static uint64_t *gaps;              /* -G, ns between frames */
+static unsigned ngaps;
+static atomic_int sending = 1;
+static atomic_ulong sent, skipped, reconnects;
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the ReadyIn waits of a b28 log, returns how many */
+static unsigned load_gaps(const char *path)
+{
+    unsigned cap = 0;
+    uint64_t *g;
+    char line[256];
+    double t;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "T2 - T1 - %lf", &t) != 1 || t <= 0)
+            continue;
+        if (ngaps == cap) {
+            cap = cap ? 2 * cap : 1024;
+            g = realloc(gaps, cap * sizeof(*gaps));
+            if (!g) {
+                perror(path);
+                exit(1);
+            }
+            gaps = g;
+        }
+        gaps[ngaps++] = (uint64_t)(t * 1e9);
+    }
+    fclose(f);
+    return ngaps;
+}
+
+/* time to the next burst of c */
+static uint64_t interval(struct bench_conn *c)
+{
+    uint64_t ns = 0;
+    int i;
+
+    if (!ngaps)
+        return 1000000000ULL * burst / fps;
+    for (i = 0; i < burst; i++)
+        ns += gaps[c->gap++ % ngaps];
+    return ns;
+}
+
+static long rss_kb(pid_t pid, const char *field)
+{
+    char path[64], line[128];
+    long kb = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    f = fopen(path, "r");
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+        if (strncmp(line, field, strlen(field)) == 0)
+            kb = atol(line + strlen(field));
+    fclose(f);
+    return kb;
+}
+
+static pid_t start_collector(char **argv, int *out, int err)
+{
+    int p[2];
+    pid_t pid;
+
+    if (pipe(p) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fcntl(p[0], F_SETPIPE_SZ, 1 << 20);
+    pid = fork();
+    if (pid == 0) {
+        dup2(p[1], 1);
+        dup2(err, 2);
+        close(p[0]);
+        close(p[1]);
+        execvp(argv[0], argv);
+        perror("exec collector");
+        _exit(127);
+    }
+    close(p[1]);
+    *out = p[0];
+    return pid;
+}
+
+static int connect_start(struct bench_conn *c)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    c->out_len = c->out_done = 0;
+    if (c->fd < 0)
+        return -1;
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 || errno == EINPROGRESS)
+        return 0;
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+}
+
+/* a connect in flight is done: 0 connected, -1 failed (and closed) */
+static int connect_done(struct bench_conn *c)
+{
+    socklen_t len = sizeof(int);
+    int err;
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+        return 0;
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+}
+
+/* non-blocking connects, returns how many completed within the timeout */
+static int connect_all(void)
+{
+    struct pollfd *pfd = calloc(nconns, sizeof(*pfd));
+    uint64_t deadline = mono_ns() + CONNECT_TIMEOUT_MS * 1000000ULL;
+    int i, pending = 0, ok = 0;
+
+    if (!pfd) {
+        perror("connect_all");
+        exit(1);
+    }
+    for (i = 0; i < nconns; i++) {
+        pfd[i].fd = -1;
+        pfd[i].events = POLLOUT;
+        if (connect_start(&conns[i]) == 0) {
+            pfd[i].fd = conns[i].fd;
+            pending++;
+        }
+    }
+    while (pending && mono_ns() < deadline) {
+        if (poll(pfd, nconns, 50) <= 0)
+            continue;
+        for (i = 0; i < nconns; i++) {
+            if (pfd[i].fd < 0 || !pfd[i].revents)
+                continue;
+            ok += connect_done(&conns[i]) == 0;
+            pfd[i].fd = -1;
+            pending--;
+        }
+    }
+    for (i = 0; i < nconns; i++) {
+        if (pfd[i].fd >= 0) {
+            close(conns[i].fd);
+            conns[i].fd = -1;
+        }
+    }
+    free(pfd);
+    return ok;
+}
+
+/* finish the burst in flight, returns 1 when the connection is idle */
+static int push(struct bench_conn *c)
+{
+    ssize_t n;
+
+    while (c->out_done < c->out_len) {
+        n = send(c->fd, (char *)c->out + c->out_done, c->out_len - c->out_done,
+                 MSG_NOSIGNAL);
+        if (n <= 0)
+            return 0;
+        c->out_done += n;
+    }
+    return 1;
+}
+
+/* close c once its burst is out and connect it again */
+static void reconnect(struct bench_conn *c)
+{
+    fcntl(c->fd, F_SETFL, 0);
+    push(c);
+    close(c->fd);
+    if (connect_start(c) == 0) {
+        c->connecting = 1;
+        atomic_fetch_add(&reconnects, 1);
+    }
+}
+
+static void send_burst(struct bench_conn *c, int i, uint64_t run, size_t hdr)
+{
+    struct bench_frame *f;
+    struct timespec ts;
+    uint64_t now, real;
+    int j;
+
+    now = mono_ns();
+    clock_gettime(CLOCK_REALTIME, &ts);
+    real = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    for (j = 0; j < burst; j++) {
+        f = (struct bench_frame *)(c->out + j * (hdr + FRAME_BYTES) + hdr);
+        f->magic = BENCH_MAGIC;
+        f->conn = i;
+        f->seq = c->seq++;
+        f->sent_ns = now;
+        f->serial = BENCH_SERIAL + i;
+        /* round robin over the trackers, each with its own counter */
+        if (hdr)
+            wire_fill((struct wire_hdr *)((unsigned char *)f - hdr), f->serial,
+                      f->seq % trackers, run | (uint32_t)(f->seq / trackers), now, real,
+                      (unsigned char *)f);
+    }
+    c->out_len = burst * (hdr + FRAME_BYTES);
+    c->out_done = 0;
+    push(c);
+    atomic_fetch_add(&sent, burst);
+}
+
+/* sends every connection's bursts when they are due */
+static void *sender(void *arg)
+{
+    uint64_t run = (uint64_t)wire_new_run() << 32, now, wake, churn_next = 0, churn_every = 0;
+    size_t hdr = version == WIRE_VERSION ? sizeof(struct wire_hdr) : 0;
+    unsigned rng = 2463534242u;
+    struct bench_conn *c;
+    struct pollfd pfd;
+    struct timespec ts;
+    int i;
+
+    (void)arg;
+    now = mono_ns();
+    for (i = 0; i < nconns; i++) {
+        c = &conns[i];
+        c->gap = ngaps ? rand() % ngaps : 0;
+        c->next = now + (uint64_t)((double)rand() / RAND_MAX * interval(c));
+    }
+    if (churn > 0) {
+        churn_every = 1e9 / churn;
+        churn_next = now + churn_every;
+    }
+
+    while (atomic_load(&sending)) {
+        now = mono_ns();
+        wake = now + MAX_SLEEP_NS;
+        while (churn_every && now >= churn_next) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            c = &conns[rng % nconns];
+            if (c->fd >= 0 && !c->connecting)
+                reconnect(c);
+            churn_next += churn_every;
+        }
+        for (i = 0; i < nconns; i++) {
+            c = &conns[i];
+            if (c->fd < 0)
+                continue;
+            if (c->connecting) {
+                pfd.fd = c->fd;
+                pfd.events = POLLOUT;
+                if (poll(&pfd, 1, 0) <= 0 || connect_done(c) != 0)
+                    continue;
+                c->connecting = 0;
+            }
+            if (c->next > now) {
+                if (c->next < wake)
+                    wake = c->next;
+                continue;
+            }
+            if (!push(c))
+                /* the collector is not keeping up with this connection */
+                atomic_fetch_add(&skipped, burst);
+            else
+                send_burst(c, i, run, hdr);
+            c->next += interval(c);
+            if (c->next + MAX_LAG_NS < now)
+                c->next = now;
+            if (c->next < wake)
+                wake = c->next;
+        }
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    /* let the last frames out before the connections close */
+    for (i = 0; i < nconns; i++) {
+        if (conns[i].fd >= 0) {
+            fcntl(conns[i].fd, F_SETFL, 0);
+            if (!conns[i].connecting)
+                push(&conns[i]);
+            close(conns[i].fd);
+        }
+    }
+    return NULL;
+}
+
+static uint64_t stop_sender(pthread_t tid)
+{
+    atomic_store(&sending, 0);
+    pthread_join(tid, NULL);
+    return mono_ns();
+}
+
+static void run_bench(char **collector, struct bench_result *res)
+{
+    static unsigned char buf[1 << 16];
+    struct bench_frame *f;
+    struct rusage before, after;
+    char line[512], *wire;
+    FILE *log;
+    pthread_t tid;
+    uint64_t start, end = 0;
+    unsigned fill = 0, off;
+    int out, status, i;
+    ssize_t n;
+    pid_t pid;
+
+    conns = calloc(nconns, sizeof(*conns));
+    if (!conns) {
+        perror("run_bench");
+        exit(1);
+    }
+    for (i = 0; i < nconns; i++)
+        conns[i].seq = conns[i].rx_seq = first_frame * trackers;
+    atomic_store(&sending, 1);
+    atomic_store(&sent, 0);
+    atomic_store(&skipped, 0);
+    atomic_store(&reconnects, 0);
+    hist_init(&res->lat);
+    res->conns = nconns;
+    getrusage(RUSAGE_CHILDREN, &before);
+
+    /* the collector's summary, to pass on once it is gone */
+    log = tmpfile();
+    if (!log) {
+        perror("tmpfile");
+        exit(1);
+    }
+    pid = start_collector(collector, &out, fileno(log));
+    usleep(300000);
+    res->rss_idle_kb = rss_kb(pid, "VmRSS:");
+    res->connected = connect_all();
+    start = mono_ns();
+    pthread_create(&tid, NULL, sender, NULL);
+
+    /* read back until the collector has been quiet for a second after the run */
+    for (;;) {
+        struct pollfd pfd = { out, POLLIN, 0 };
+
+        if (!end && mono_ns() - start >= seconds * 1e9) {
+            res->rss_kb = rss_kb(pid, "VmRSS:");
+            end = stop_sender(tid);
+        }
+        if (poll(&pfd, 1, end ? 1000 : 100) <= 0) {
+            if (end)
+                break;
+            continue;
+        }
+        n = read(out, buf + fill, sizeof(buf) - fill);
+        if (n <= 0) {
+            fprintf(stderr, "collector output closed\n");
+            if (!end)
+                end = stop_sender(tid);
+            break;
+        }
+        fill += n;
+        for (off = 0; off + FRAME_BYTES <= fill; off += FRAME_BYTES) {
+            uint64_t now = mono_ns();
+            struct bench_conn *c;
+
+            f = (struct bench_frame *)(buf + off);
+            if (f->magic != BENCH_MAGIC || f->conn >= (uint32_t)nconns) {
+                res->bad++;
+                continue;
+            }
+            c = &conns[f->conn];
+            if (!c->seen) {
+                c->seen = 1;
+                res->served++;
+            }
+            if (f->seq > c->rx_seq)
+                res->lost += f->seq - c->rx_seq;
+            else if (f->seq < c->rx_seq)
+                res->reordered++;
+            if (f->seq >= c->rx_seq)
+                c->rx_seq = f->seq + 1;
+            hist_add(&res->lat, now - f->sent_ns);
+            res->received++;
+        }
+        memmove(buf, buf + off, fill - off);
+        fill -= off;
+    }
+
+    res->hwm_kb = rss_kb(pid, "VmHWM:");
+    if (!res->rss_kb)
+        res->rss_kb = rss_kb(pid, "VmRSS:");
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    close(out);
+    res->missing = -1;
+    rewind(log);
+    while (fgets(line, sizeof(line), log)) {
+        fputs(line, stderr);
+        if (!strncmp(line, "Wire: ", 6) && (wire = strstr(line, "untracked), ")))
+            sscanf(wire, "untracked), %ld missing", &res->missing);
+    }
+    fclose(log);
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    res->sent = atomic_load(&sent);
+    res->skipped = atomic_load(&skipped);
+    res->reconnects = atomic_load(&reconnects);
+    res->seconds = (end - start) / 1e9;
+    res->cpu = after.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_utime.tv_sec -
+               before.ru_stime.tv_sec + (after.ru_utime.tv_usec + after.ru_stime.tv_usec -
+               before.ru_utime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+    free(conns);
+}
+
+static void print_result(const struct bench_result *r)
+{
+    printf("Connections: %d opened, %d connected, %d served, %d nodes, %lu reconnects\n",
+           r->conns, r->connected, r->served, r->conns * trackers, r->reconnects);
+    printf("Frames: %lu sent, %lu skipped (collector behind), %llu received, "
+           "%llu lost, %llu out of order, %llu garbled\n",
+           r->sent, r->skipped, (unsigned long long)r->received,
+           (unsigned long long)r->lost, (unsigned long long)r->reordered,
+           (unsigned long long)r->bad);
+    if (r->missing >= 0)
+        printf("Collector counted %ld missing\n", r->missing);
+    printf("Throughput: %.0f frames/s over %.2f s\n", r->received / r->seconds, r->seconds);
+    hist_print(&r->lat, stdout, "Latency", 1e6, "ms");
+    printf("Collector CPU time %.3f s, %.2f us per frame\n", r->cpu,
+           r->received ? r->cpu * 1e6 / r->received : 0);
+    printf("Collector memory: %.0f KB idle, %.0f KB loaded (peak %.0f KB), "
+           "%.1f KB per connection\n", r->rss_idle_kb, r->rss_kb, r->hwm_kb,
+           r->connected ? (r->rss_kb - r->rss_idle_kb) / r->connected : 0);
+}
+
+static void append_result(const char *path, const char *label, const char *pattern,
+                          const struct bench_result *r)
+{
+    FILE *f = fopen(path, "a");
+
+    if (!f) {
+        perror(path);
+        return;
+    }
+    if (ftell(f) == 0)
+        fprintf(f, "label\tversion\tconns\ttrackers\tpattern\tburst\tchurn\tconnected\t"
+                "served\tsent\tskipped\treceived\tlost\tfps\tcpu_us_per_frame\t"
+                "kb_per_conn\tp50_ms\tp99_ms\tp999_ms\tmax_ms\n");
+    fprintf(f, "%s\t%d\t%d\t%d\t%s\t%d\t%g\t%d\t%d\t%lu\t%lu\t%llu\t%llu\t%.0f\t%.3f\t"
+            "%.1f\t%.3f\t%.3f\t%.3f\t%.3f\n",
+            label, version, r->conns, trackers, pattern, burst, churn, r->connected,
+            r->served, r->sent, r->skipped, (unsigned long long)r->received,
+            (unsigned long long)r->lost, r->received / r->seconds,
+            r->received ? r->cpu * 1e6 / r->received : 0,
+            r->connected ? (r->rss_kb - r->rss_idle_kb) / r->connected : 0,
+            hist_quantile(&r->lat, 0.5) / 1e6, hist_quantile(&r->lat, 0.99) / 1e6,
+            hist_quantile(&r->lat, 0.999) / 1e6, r->lat.max / 1e6);
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    static struct bench_result res[MAX_RUNS];
+    const char *results = NULL, *label = "-", *gap_log = NULL;
+    char pattern[64], *list = "100", *tok, *save;
+    int counts[MAX_RUNS], nruns = 0, failed = 0, opt, i;
+    struct rlimit rl;
+
+    while ((opt = getopt(argc, argv, "c:r:G:B:D:C:d:p:V:S:o:L:")) != -1) {
+        switch (opt) {
+        case 'c':
+            list = optarg;
+            break;
+        case 'r':
+            fps = atof(optarg);
+            break;
+        case 'G':
+            gap_log = optarg;
+            break;
+        case 'B':
+            burst = atoi(optarg);
+            break;
+        case 'D':
+            trackers = atoi(optarg);
+            break;
+        case 'C':
+            churn = atof(optarg);
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'V':
+            version = atoi(optarg);
+            break;
+        case 'S':
+            first_frame = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            results = optarg;
+            break;
+        case 'L':
+            label = optarg;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    for (tok = strtok_r(list, ",", &save); tok && nruns < MAX_RUNS;
+         tok = strtok_r(NULL, ",", &save))
+        if ((counts[nruns] = atoi(tok)) > 0)
+            nruns++;
+    if (optind >= argc || !nruns || fps <= 0 || burst < 1 || burst > MAX_BURST ||
+        trackers < 1 || churn < 0) {
+        fprintf(stderr, "usage: %s [-c conns[,conns...]] [-r fps] [-G b28_log] [-B burst] "
+                "[-D trackers] [-C reconnects_per_s] [-d seconds] [-p port] [-V 1|2] "
+                "[-S frames] [-o results.tsv [-L label]] -- collector [args]\n",
+                argv[0]);
+        return 1;
+    }
+    if (gap_log && !load_gaps(gap_log)) {
+        fprintf(stderr, "%s: no ReadyIn waits (T2 - T1) found\n", gap_log);
+        return 1;
+    }
+    if (gap_log)
+        snprintf(pattern, sizeof(pattern), "log:%.50s", gap_log);
+    else
+        snprintf(pattern, sizeof(pattern), "%gfps", fps);
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    /* thousands of connections, on both ends; the collector inherits it */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    for (i = 0; i < nruns; i++) {
+        nconns = counts[i];
+        if (nruns > 1)
+            printf("== %d connections\n", nconns);
+        run_bench(argv + optind, &res[i]);
+        print_result(&res[i]);
+        if (res[i].missing > (long)res[i].lost) {
+            printf("FAIL: the collector counted %ld missing, %llu were lost\n",
+                   res[i].missing, (unsigned long long)res[i].lost);
+            failed = 1;
+        }
+        if (results)
+            append_result(results, label, pattern, &res[i]);
+        fflush(stdout);
+    }
+    if (nruns > 1) {
+        printf("%8s %8s %10s %12s %10s %9s %9s %9s\n", "conns", "served", "frames/s",
+               "us/frame", "KB/conn", "p50 ms", "p99 ms", "p99.9 ms");
+        for (i = 0; i < nruns; i++)
+            printf("%8d %8d %10.0f %12.2f %10.1f %9.3f %9.3f %9.3f\n", res[i].conns,
+                   res[i].served, res[i].received / res[i].seconds,
+                   res[i].received ? res[i].cpu * 1e6 / res[i].received : 0,
+                   res[i].connected ? (res[i].rss_kb - res[i].rss_idle_kb) /
+                   res[i].connected : 0,
+                   hist_quantile(&res[i].lat, 0.5) / 1e6,
+                   hist_quantile(&res[i].lat, 0.99) / 1e6,
+                   hist_quantile(&res[i].lat, 0.999) / 1e6);
+    }
+    return failed;
+}
@@ -0,0 +1,92 @@
+/*
+ * delta.c - location frame encoding, see delta.h
+ */
+
+#include <string.h>
+
+#include "delta.h"
+
+#define RLE_MAX_LITERAL 128
+#define RLE_MIN_REPEAT 3
+#define RLE_MAX_REPEAT 130
+
+static unsigned rle_encode(const unsigned char *in, unsigned n, unsigned char *out)
+{
+    unsigned i = 0, o = 0, start, run;
+
+    while (i < n) {
+        for (run = 1; i + run < n && run < RLE_MAX_REPEAT && in[i + run] == in[i]; run++)
+            ;
+        if (run >= RLE_MIN_REPEAT) {
+            out[o++] = run + 125;
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+        /* literals up to where a repeat worth coding starts */
+        start = i;
+        do
+            i++;
+        while (i < n && i - start < RLE_MAX_LITERAL &&
+               !(i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2]));
+        out[o++] = i - start - 1;
+        memcpy(out + o, in + start, i - start);
+        o += i - start;
+    }
+    return o;
+}
+
+unsigned delta_encode(struct delta_enc *e, unsigned key_every, uint32_t ctr,
+                      const unsigned char *frame, unsigned char *out,
+                      uint16_t *flags, uint32_t *base)
+{
+    unsigned char x[WIRE_PAYLOAD];
+    unsigned i, len;
+
+    if (!e->have_prev || (key_every && e->since_key + 1 >= key_every)) {
+        len = rle_encode(frame, WIRE_PAYLOAD, out);
+        *flags = WIRE_F_KEY;
+        *base = 0;
+        e->since_key = 0;
+    } else {
+        for (i = 0; i < WIRE_PAYLOAD; i++)
+            x[i] = frame[i] ^ e->prev[i];
+        len = rle_encode(x, WIRE_PAYLOAD, out);
+        *flags = WIRE_F_DELTA;
+        *base = e->prev_ctr;
+        e->since_key++;
+    }
+    memcpy(e->prev, frame, WIRE_PAYLOAD);
+    e->prev_ctr = ctr;
+    e->have_prev = 1;
+    return len;
+}
+
+int delta_decode(const unsigned char *in, unsigned len, const unsigned char *prev,
+                 unsigned char *out)
+{
+    unsigned i = 0, o = 0, c, k;
+
+    while (i < len) {
+        c = in[i++];
+        if (c < RLE_MAX_LITERAL) {
+            k = c + 1;
+            if (i + k > len || o + k > WIRE_PAYLOAD)
+                return -1;
+            memcpy(out + o, in + i, k);
+            i += k;
+        } else {
+            k = c - 125;
+            if (i >= len || o + k > WIRE_PAYLOAD)
+                return -1;
+            memset(out + o, in[i++], k);
+        }
+        o += k;
+    }
+    if (o != WIRE_PAYLOAD)
+        return -1;
+    if (prev)
+        for (i = 0; i < WIRE_PAYLOAD; i++)
+            out[i] ^= prev[i];
+    return 0;
+}
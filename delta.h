@@ -0,0 +1,57 @@
+/*
+ * delta.h - compact encoding of location frames for the uplink
+ *
+ * Most of a 256 byte location frame is 0xFF filler, and from one frame of
+ * a tracker to the next most of the rest stays the same. A keyframe is
+ * the frame run length coded on its own; a delta is the XOR with the
+ * previous frame of the same tracker, run length coded, so what did not
+ * change becomes runs of zeros. The decoder needs that previous frame,
+ * so a delta names the sequence counter of the frame it refers to.
+ *
+ * The run length code is PackBits: a control byte c below 128 is followed
+ * by c + 1 literal bytes, from 128 on by one byte repeated c - 125 times
+ * (3 to 130). A frame never grows past WIRE_ENC_MAX bytes.
+ *
+ * How the encoded frames travel is up to wire.h (WIRE_F_KEY, WIRE_F_DELTA).
+ */
+
+#ifndef TRAKRAY_DELTA_H
+#define TRAKRAY_DELTA_H
+
+#include <stdint.h>
+
+#include "wire.h"
+
+/* encoder state of one tracker */
+struct delta_enc {
+    unsigned char prev[WIRE_PAYLOAD];
+    uint32_t prev_ctr;          /* sequence counter of prev */
+    unsigned since_key;         /* frames since the last keyframe */
+    int have_prev;
+};
+
+/* the next frame is a keyframe, e.g. for a new connection */
+static inline void delta_enc_reset(struct delta_enc *e)
+{
+    e->have_prev = 0;
+}
+
+/*
+ * encode frame, whose sequence counter is ctr, into out (WIRE_ENC_MAX
+ * bytes): a keyframe when there is no previous frame or key_every frames
+ * went by since the last keyframe, a delta otherwise. Returns the encoded
+ * length and sets *flags to WIRE_F_KEY or WIRE_F_DELTA and, for a delta,
+ * *base to the counter of the frame it refers to.
+ */
+unsigned delta_encode(struct delta_enc *e, unsigned key_every, uint32_t ctr,
+                      const unsigned char *frame, unsigned char *out,
+                      uint16_t *flags, uint32_t *base);
+
+/*
+ * decode len bytes at in into the 256 byte out, against prev for a delta
+ * and NULL for a keyframe; 0, or -1 when the data is malformed
+ */
+int delta_decode(const unsigned char *in, unsigned len, const unsigned char *prev,
+                 unsigned char *out);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * delta_bench.c - compression and cost of the frame encoding (delta.h)
+ *
+ * Compile
+ * gcc -O2 -o delta_bench delta_bench.c delta.c hist.c wire.c
+ * ./delta_bench [-K key_every] frames.bin...
+ *
+ * Reads captured 256 byte frames, as the collector writes them to stdout
+ * or store_query returns them out of the store, and encodes them in order
+ * the way a node with -E key_every would, one encoder per node serial
+ * (a capture does not tell the trackers of a node apart). Every frame is
+ * decoded again and compared with the original. Prints the compression
+ * of the payloads and of whole v2 frames on the wire, and the time per
+ * frame to encode and to decode.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "delta.h"
+#include "hist.h"
+#include "wire.h"
+
+#define FRAME_BYTES 256
+#define MAX_NODES 1024              /* a power of two */
+#define DEFAULT_KEY_EVERY 32
+
+struct node {
+    uint32_t serial;
+    int used;
+    uint32_t ctr;
+    struct delta_enc enc;
+    unsigned char prev[FRAME_BYTES];   /* what the decoder has */
+};
+
+static struct node nodes[MAX_NODES];
+static unsigned long nnodes;
+
+static unsigned long long mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct node *node_lookup(uint32_t serial)
+{
+    unsigned i, h = (serial * 2654435761u) & (MAX_NODES - 1);
+
+    for (i = 0; i < MAX_NODES; i++, h = (h + 1) & (MAX_NODES - 1)) {
+        if (!nodes[h].used) {
+            nodes[h].used = 1;
+            nodes[h].serial = serial;
+            nnodes++;
+            return &nodes[h];
+        }
+        if (nodes[h].serial == serial)
+            return &nodes[h];
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char frame[FRAME_BYTES], enc[WIRE_ENC_MAX], dec[FRAME_BYTES];
+    unsigned long frames = 0, keyframes = 0, mismatches = 0, untracked = 0;
+    unsigned long long payload = 0, wire = 0, t, enc_total = 0, dec_total = 0;
+    unsigned key_every = DEFAULT_KEY_EVERY, len;
+    static struct hist enc_lat, dec_lat;
+    struct wire_hdr h;
+    struct node *n;
+    uint32_t serial, base;
+    uint16_t flags;
+    FILE *f;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "K:")) != -1) {
+        switch (opt) {
+        case 'K':
+            key_every = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-K key_every] frames.bin...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "usage: %s [-K key_every] frames.bin...\n", argv[0]);
+        return 1;
+    }
+    hist_init(&enc_lat);
+    hist_init(&dec_lat);
+    memset(&h, 0, sizeof(h));
+
+    for (i = optind; i < argc; i++) {
+        f = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "rb");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        while (fread(frame, FRAME_BYTES, 1, f) == 1) {
+            serial = wire_frame_serial(frame);
+            n = node_lookup(serial);
+            if (!n) {
+                untracked++;
+                continue;
+            }
+            t = mono_ns();
+            len = delta_encode(&n->enc, key_every, n->ctr, frame, enc, &flags, &base);
+            t = mono_ns() - t;
+            hist_add(&enc_lat, t);
+            enc_total += t;
+
+            t = mono_ns();
+            if (delta_decode(enc, len, flags == WIRE_F_KEY ? NULL : n->prev, dec) != 0)
+                memset(dec, 0, sizeof(dec));
+            t = mono_ns() - t;
+            hist_add(&dec_lat, t);
+            dec_total += t;
+            if (memcmp(dec, frame, FRAME_BYTES) != 0 ||
+                (flags == WIRE_F_DELTA && base != n->ctr - 1))
+                mismatches++;
+            memcpy(n->prev, dec, FRAME_BYTES);
+
+            h.payload_len = len;
+            payload += len;
+            wire += wire_frame_len(&h);
+            keyframes += flags == WIRE_F_KEY;
+            n->ctr++;
+            frames++;
+        }
+        if (f != stdin)
+            fclose(f);
+    }
+    if (!frames) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+
+    printf("%lu frames of %lu nodes (%lu untracked), keyframe every %u: %lu keyframes\n",
+           frames, nnodes, untracked, key_every, keyframes);
+    printf("payload: %.1f bytes per frame, %.2fx smaller than %d\n",
+           (double)payload / frames, (double)frames * FRAME_BYTES / payload, FRAME_BYTES);
+    printf("wire: %.1f bytes per frame, %.2fx smaller than %zu\n",
+           (double)wire / frames, (double)frames * WIRE_V2_BYTES / wire, WIRE_V2_BYTES);
+    printf("%lu frames decoded differently\n", mismatches);
+    hist_print(&enc_lat, stdout, "encode", 1e3, "us");
+    hist_print(&dec_lat, stdout, "decode", 1e3, "us");
+    printf("encode %.0f MB/s, decode %.0f MB/s of frames\n",
+           frames * FRAME_BYTES * 1e3 / enc_total, frames * FRAME_BYTES * 1e3 / dec_total);
+    return mismatches != 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * frame_ring.c - SPSC frame ring, see frame_ring.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "frame_ring.h"
+#include "backend.h"
+
+int frame_ring_init(struct frame_ring *r, unsigned slots)
+{
+    unsigned n = 1;
+
+    while (n < slots)
+        n <<= 1;
+    memset(r, 0, sizeof(*r));
+    if (posix_memalign((void **)&r->slots, 64, n * sizeof(struct frame_slot)) != 0)
+        return -1;
+    memset(r->slots, 0xFF, n * sizeof(struct frame_slot));
+    r->mask = n - 1;
+    r->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->event_fd < 0) {
+        free(r->slots);
+        return -1;
+    }
+    return 0;
+}
+
+void frame_ring_free(struct frame_ring *r)
+{
+    close(r->event_fd);
+    free(r->slots);
+    r->slots = NULL;
+}
+
+static void frame_ring_signal(struct frame_ring *r)
+{
+    uint64_t one = 1;
+    ssize_t n = write(r->event_fd, &one, sizeof(one));
+
+    (void)n;    /* only fails when the counter is already non zero */
+}
+
+void frame_ring_publish(struct frame_ring *r)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed) + 1;
+    unsigned used = head - atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    /* seq_cst store pairs with the consumer_waiting handshake below */
+    atomic_store(&r->head, head);
+    atomic_fetch_add_explicit(&r->published, 1, memory_order_relaxed);
+    if (used > atomic_load_explicit(&r->high_water, memory_order_relaxed))
+        atomic_store_explicit(&r->high_water, used, memory_order_relaxed);
+    if (atomic_load(&r->consumer_waiting))
+        frame_ring_signal(r);
+}
+
+unsigned frame_ring_wait(struct frame_ring *r, unsigned have, int timeout_ms)
+{
+    unsigned n = frame_ring_count(r);
+    uint64_t v;
+    ssize_t rd;
+
+    if (n > have)
+        return n;
+
+    /* announce the sleep, then look again so a publish in between is seen */
+    atomic_store(&r->consumer_waiting, 1);
+    n = frame_ring_count(r);
+    if (n <= have && backend_poll_in(r->event_fd, timeout_ms) > 0) {
+        rd = read(r->event_fd, &v, sizeof(v));
+        (void)rd;
+    }
+    atomic_store(&r->consumer_waiting, 0);
+    return frame_ring_count(r);
+}
+
+void frame_ring_wake(struct frame_ring *r)
+{
+    frame_ring_signal(r);
+}
+
+void frame_ring_print_stats(struct frame_ring *r)
+{
+    printf("Ring: %u/%u slots used, high water %u, %lu frames published, %lu dropped\n",
+           frame_ring_count(r), r->mask + 1,
+           atomic_load(&r->high_water),
+           atomic_load(&r->published), atomic_load(&r->drops));
+}
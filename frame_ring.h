@@ -0,0 +1,111 @@
+/*
+ * frame_ring.h - preallocated lock-free single producer / single consumer
+ * ring of location frames between the acquisition and sender threads
+ *
+ * The producer claims the next free slot, lets the SPI location read land
+ * straight in it and publishes it. When the ring is full the frame is
+ * counted as dropped and the producer reads into a scratch slot instead,
+ * so a stalled consumer never holds up acquisition. The consumer sleeps
+ * on an eventfd that the producer only writes while it is waiting.
+ */
+
+#ifndef TRAKRAY_FRAME_RING_H
+#define TRAKRAY_FRAME_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "wire.h"
+
+#define FRAME_BYTES 256
+#define FRAME_SPI_HDR 5             /* command / dummy bytes of the SPI read */
+#define FRAME_RING_SLOTS 1024
+
+/*
+ * One location frame. spi_hdr and data are contiguous, so the 261 byte
+ * location read (MAXPI_BYTES) can run in place from spi_hdr and data ends
+ * up holding the 256 bytes that go to the collector. wire is the version
+ * 2 header the producer fills in for them.
+ */
+struct frame_slot {
+    struct wire_hdr wire;
+    unsigned char spi_hdr[FRAME_SPI_HDR];
+    unsigned char data[FRAME_BYTES];
+};
+
+_Static_assert(offsetof(struct frame_slot, data) ==
+               offsetof(struct frame_slot, spi_hdr) + FRAME_SPI_HDR,
+               "location read must run over spi_hdr and data in one go");
+
+struct frame_ring {
+    struct frame_slot *slots;
+    unsigned mask;                      /* slots - 1, slots is a power of two */
+    int event_fd;
+
+    _Alignas(64) atomic_uint head;      /* next slot the producer fills */
+    _Alignas(64) atomic_uint tail;      /* next slot the consumer reads */
+    atomic_int consumer_waiting;
+
+    /* counters, written by the producer only */
+    _Alignas(64) atomic_ulong published;
+    atomic_ulong drops;
+    atomic_uint high_water;
+};
+
+/* slots is rounded up to a power of two, returns 0 or -1 */
+int frame_ring_init(struct frame_ring *r, unsigned slots);
+void frame_ring_free(struct frame_ring *r);
+
+/* producer: next free slot, or NULL (and one more drop) when full */
+static inline struct frame_slot *frame_ring_claim(struct frame_ring *r)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail > r->mask) {
+        atomic_fetch_add_explicit(&r->drops, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return &r->slots[head & r->mask];
+}
+
+/* producer: make the claimed slot visible to the consumer */
+void frame_ring_publish(struct frame_ring *r);
+
+/* consumer: frames ready to read */
+static inline unsigned frame_ring_count(struct frame_ring *r)
+{
+    return atomic_load(&r->head) -
+           atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+/* consumer: i-th ready frame, i < frame_ring_count() */
+static inline struct frame_slot *frame_ring_peek(struct frame_ring *r, unsigned i)
+{
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    return &r->slots[(tail + i) & r->mask];
+}
+
+/* consumer: hand n read frames back to the producer */
+static inline void frame_ring_release(struct frame_ring *r, unsigned n)
+{
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+/*
+ * consumer: wait up to timeout_ms (< 0 forever) until more than have
+ * frames are ready, returns frame_ring_count(), which is <= have on
+ * timeout or after frame_ring_wake
+ */
+unsigned frame_ring_wait(struct frame_ring *r, unsigned have, int timeout_ms);
+
+/* wake a waiting consumer, e.g. to shut it down */
+void frame_ring_wake(struct frame_ring *r);
+
+/* one line with occupancy, high-water mark, published and dropped frames */
+void frame_ring_print_stats(struct frame_ring *r);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * health.c - device health checks and crash recovery, see health.h
+ */
+
+#include <string.h>
+
+#include "health.h"
+#include "backend.h"
+#include "spi_script.h"
+#include "tlog.h"
+
+static const unsigned char dev_id[] = { 0xE9, 0x07, 0x20, 0x12 };
+
+void health_init(struct health *h, unsigned every)
+{
+    memset(h, 0, sizeof(*h));
+    h->every = every;
+    h->pulse_ms = HEALTH_PULSE_MIN_MS;
+    hist_init(&h->recovery);
+}
+
+int health_frame_suspect(const unsigned char *data, unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+        if (data[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+int health_id_ok(const unsigned char *rx)
+{
+    return memcmp(rx + 5, dev_id, sizeof(dev_id)) == 0;
+}
+
+int health_read_id(struct backend *be)
+{
+    unsigned char id[] = { 0x0b, 0x10, 0x70, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+    be->transfer(be, id, id, sizeof(id));
+    delay_us(SPI_GAP_US);
+    TLOG_DEBUG("Read ID: %02X %02X %02X %02X %02X %02X  %02X  %02X  %02X \n", id[0], id[1],
+               id[2], id[3], id[4], id[5], id[6], id[7], id[8]);
+    return health_id_ok(id);
+}
+
+void health_checked(struct health *h, int ok)
+{
+    h->since_check = 0;
+    h->checks++;
+    if (!ok)
+        h->crashes++;
+}
+
+/* the device needs a dummy byte after power up or reset */
+static void dummy_byte(struct backend *be)
+{
+    unsigned char b = 0x0b;
+
+    be->transfer(be, &b, &b, 1);
+    delay_us(SPI_GAP_US);
+}
+
+int health_recover(struct health *h, struct backend *be)
+{
+    unsigned long long start = mono_ns(), deadline;
+    unsigned pulse = h->pulse_ms, tries;
+
+    for (tries = 1; tries <= HEALTH_RESET_TRIES; tries++) {
+        h->pulses++;
+        be->set_reset(be, 0);
+        delay_ms(pulse);
+        be->set_reset(be, 1);
+        /* poll until the device is back, give it as long as the pulse */
+        deadline = mono_ns() + pulse * 1000000ULL;
+        do {
+            dummy_byte(be);
+            if (health_read_id(be)) {
+                h->pulse_ms = pulse;
+                h->recoveries++;
+                h->since_check = 0;
+                hist_add(&h->recovery, mono_ns() - start);
+                TLOG_INFO("SPI Device recovered, %u ms reset pulse\n", pulse);
+                return 0;
+            }
+            delay_ms(1);
+        } while (mono_ns() < deadline);
+
+        if (tries == HEALTH_RESET_TRIES)
+            break;
+        pulse *= 10;
+        if (pulse > HEALTH_PULSE_MAX_MS)
+            pulse = HEALTH_PULSE_MAX_MS;
+    }
+    h->failed++;
+    TLOG_WARN("SPI Device still crashed after %u reset pulses\n", tries);
+    return -1;
+}
+
+void health_print_stats(const struct health *h, FILE *f)
+{
+    fprintf(f, "Health: %lu ID checks every %u frames, %lu suspect frames, %lu crashes, "
+            "%lu recovered, %lu failed, %lu reset pulses, next pulse %u ms\n",
+            h->checks, h->every, h->suspect, h->crashes, h->recoveries, h->failed,
+            h->pulses, h->pulse_ms);
+    if (h->recovery.count)
+        hist_print(&h->recovery, f, "Recovery time", 1e6, "ms");
+}
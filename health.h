@@ -0,0 +1,74 @@
+/*
+ * health.h - tracker device health checks and crash recovery
+ *
+ * A crashed device answers every read with 0xFF, including its ID
+ * register. Reading the ID every frame costs a transfer per cycle, so it
+ * is only read every `every` frames while the device is healthy, and in
+ * the same cycle whenever the location block looks wrong (all 0xFF).
+ * An all zero block is what a device without tags in view sends.
+ *
+ * Recovery pulses the reset line and polls the ID until the device
+ * answers. The first pulse is the shortest one that worked before
+ * (HEALTH_PULSE_MIN_MS to start with); each retry makes the pulse and
+ * the time allowed to come back ten times longer, up to the fixed 1 s
+ * of the old toggle_reset(), for at most HEALTH_RESET_TRIES pulses.
+ */
+
+#ifndef TRAKRAY_HEALTH_H
+#define TRAKRAY_HEALTH_H
+
+#include <stdio.h>
+
+#include "hist.h"
+
+#define HEALTH_DEFAULT_EVERY 100
+#define HEALTH_PULSE_MIN_MS 10
+#define HEALTH_PULSE_MAX_MS 1000
+#define HEALTH_RESET_TRIES 3
+
+struct backend;
+
+struct health {
+    unsigned every;             /* frames between checks, 0 = only on bad data */
+    unsigned since_check;
+    unsigned pulse_ms;          /* reset pulse the next recovery starts with */
+
+    /* counters */
+    unsigned long checks;
+    unsigned long suspect;      /* frames that looked wrong */
+    unsigned long crashes;
+    unsigned long recoveries;
+    unsigned long failed;       /* recoveries that ran out of tries */
+    unsigned long pulses;
+    struct hist recovery;       /* crash seen to ID back, ns */
+};
+
+void health_init(struct health *h, unsigned every);
+
+/* the scheduled ID check is due this cycle */
+static inline int health_due(struct health *h)
+{
+    return h->every && ++h->since_check >= h->every;
+}
+
+/* 1 when the location block is all 0xFF, as a crashed device reads */
+int health_frame_suspect(const unsigned char *data, unsigned len);
+
+/* 1 when rx holds the device ID, rx is the 9 byte ID read */
+int health_id_ok(const unsigned char *rx);
+
+/* read the ID register, 1 when the device answers with its ID */
+int health_read_id(struct backend *be);
+
+/* record the result of an ID read of this cycle */
+void health_checked(struct health *h, int ok);
+
+/*
+ * reset the device until it reports its ID again, 0 on success, -1 when
+ * HEALTH_RESET_TRIES pulses did not bring it back
+ */
+int health_recover(struct health *h, struct backend *be);
+
+void health_print_stats(const struct health *h, FILE *f);
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * hist.c - log-linear latency histogram, see hist.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+
+void hist_init(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_merge(struct hist *h, const struct hist *src)
+{
+    unsigned i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        h->bucket[i] += src->bucket[i];
+    h->count += src->count;
+    h->sum += src->sum;
+    if (src->min < h->min)
+        h->min = src->min;
+    if (src->max > h->max)
+        h->max = src->max;
+}
+
+/* largest value that falls into bucket i */
+static uint64_t hist_upper(unsigned i)
+{
+    unsigned shift;
+
+    if (i < HIST_SUB)
+        return i;
+    shift = (i >> HIST_SUB_BITS) - 1;
+    return (((uint64_t)(HIST_SUB + (i & (HIST_SUB - 1))) + 1) << shift) - 1;
+}
+
+uint64_t hist_quantile(const struct hist *h, double q)
+{
+    uint64_t want, seen = 0, v;
+    unsigned i;
+
+    if (h->count == 0)
+        return 0;
+    want = (uint64_t)(q * h->count);
+    if (want >= h->count)
+        want = h->count - 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen > want) {
+            v = hist_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void hist_print(const struct hist *h, FILE *f, const char *name, double scale,
+                const char *unit)
+{
+    if (h->count == 0) {
+        fprintf(f, "%s: no samples\n", name);
+        return;
+    }
+    fprintf(f, "%s: %llu samples, mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, "
+            "p99.9 %.3f, max %.3f %s\n", name, (unsigned long long)h->count,
+            h->sum / h->count / scale,
+            hist_quantile(h, 0.50) / scale, hist_quantile(h, 0.90) / scale,
+            hist_quantile(h, 0.99) / scale, hist_quantile(h, 0.999) / scale,
+            h->max / scale, unit);
+}
@@ -0,0 +1,63 @@
+/*
+ * hist.h - log-linear latency histogram
+ *
+ * Values (usually nanoseconds) go into HIST_SUB buckets per power of two,
+ * so any quantile is within 1/HIST_SUB (6 %) of the true value whatever
+ * its magnitude. The table has a fixed size, so hist_add never allocates
+ * and is cheap enough for per frame use.
+ */
+
+#ifndef TRAKRAY_HIST_H
+#define TRAKRAY_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t count;
+    uint64_t min, max;
+    double sum;
+    uint64_t bucket[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *h);
+
+static inline unsigned hist_index(uint64_t v)
+{
+    unsigned shift;
+
+    if (v < HIST_SUB)
+        return (unsigned)v;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (unsigned)((v >> shift) & (HIST_SUB - 1));
+}
+
+static inline void hist_add(struct hist *h, uint64_t v)
+{
+    h->bucket[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+/* add the counts of src to h */
+void hist_merge(struct hist *h, const struct hist *src);
+
+/* value at quantile q (0..1), the upper end of its bucket, 0 when empty */
+uint64_t hist_quantile(const struct hist *h, double q);
+
+/*
+ * one line to f: name, count, mean, p50 p90 p99 p99.9 and max, values
+ * divided by scale and printed with unit
+ */
+void hist_print(const struct hist *h, FILE *f, const char *name, double scale,
+                const char *unit);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * latest.c - latest frame per node, see latest.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "latest.h"
+
+#define LATEST_USED (1ULL << 63)
+#define LATEST_SPINS 100                /* then yield, the other side may be preempted */
+
+static uint64_t latest_key(uint32_t serial, uint16_t device)
+{
+    return LATEST_USED | (uint64_t)serial << 16 | device;
+}
+
+static unsigned latest_hash(uint64_t key)
+{
+    return (unsigned)((key ^ key >> 29) * 0x9e3779b97f4a7c15ULL >> 32) & (LATEST_MAX_NODES - 1);
+}
+
+int latest_init(struct latest *l)
+{
+    memset(l, 0, sizeof(*l));
+    l->e = calloc(LATEST_MAX_NODES, sizeof(*l->e));
+    if (!l->e) {
+        perror("latest: out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+void latest_free(struct latest *l)
+{
+    free(l->e);
+    l->e = NULL;
+}
+
+/* the entry of key, claimed when it is new, NULL when the table is full */
+static struct latest_entry *latest_claim(struct latest *l, uint64_t key)
+{
+    unsigned i, h = latest_hash(key);
+    uint64_t k;
+
+    for (i = 0; i < LATEST_MAX_NODES; i++, h = (h + 1) & (LATEST_MAX_NODES - 1)) {
+        k = atomic_load_explicit(&l->e[h].key, memory_order_acquire);
+        if (k == key)
+            return &l->e[h];
+        if (k == 0) {
+            if (atomic_compare_exchange_strong(&l->e[h].key, &k, key) || k == key)
+                return &l->e[h];
+        }
+    }
+    return NULL;
+}
+
+void latest_update(struct latest *l, uint32_t serial, uint16_t device, uint64_t seq,
+                   uint64_t acq_ns, uint64_t arrival_ns, const unsigned char *frame)
+{
+    struct latest_entry *e = latest_claim(l, latest_key(serial, device));
+    unsigned s, spins = 0;
+
+    if (!e) {
+        atomic_fetch_add_explicit(&l->full, 1, memory_order_relaxed);
+        return;
+    }
+    /* take the entry: even to odd */
+    s = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    for (;;) {
+        if (!(s & 1) && atomic_compare_exchange_weak_explicit(&e->seq, &s, s + 1,
+                                                              memory_order_acquire,
+                                                              memory_order_relaxed))
+            break;
+        if (++spins > LATEST_SPINS)
+            sched_yield();
+        s = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+
+    e->rec.serial = serial;
+    e->rec.device = device;
+    e->rec.seq = seq;
+    e->rec.acq_ns = acq_ns;
+    e->rec.arrival_ns = arrival_ns;
+    e->rec.frames++;
+    memcpy(e->rec.frame, frame, LATEST_FRAME_BYTES);
+    if (!e->win_start)
+        e->win_start = arrival_ns;
+    e->win_frames++;
+    if (arrival_ns - e->win_start >= 1000000000ULL) {
+        e->rec.rate = e->win_frames * 1e9 / (arrival_ns - e->win_start);
+        e->win_start = arrival_ns;
+        e->win_frames = 0;
+    }
+
+    atomic_store_explicit(&e->seq, s + 2, memory_order_release);
+    atomic_fetch_add_explicit(&l->updates, 1, memory_order_relaxed);
+}
+
+/* a consistent copy of the record of e */
+static void latest_read(struct latest *l, struct latest_entry *e, struct latest_record *r)
+{
+    unsigned s1, s2, spins = 0;
+
+    for (;;) {
+        s1 = atomic_load_explicit(&e->seq, memory_order_acquire);
+        if (!(s1 & 1)) {
+            memcpy(r, &e->rec, sizeof(*r));
+            atomic_thread_fence(memory_order_acquire);
+            s2 = atomic_load_explicit(&e->seq, memory_order_relaxed);
+            if (s1 == s2)
+                return;
+        }
+        atomic_fetch_add_explicit(&l->read_retries, 1, memory_order_relaxed);
+        if (++spins > LATEST_SPINS)
+            sched_yield();
+    }
+}
+
+/* copy the entries key selects (all with key 0) */
+static unsigned latest_copy(struct latest *l, uint32_t serial, int all,
+                            struct latest_record *r, unsigned max)
+{
+    unsigned i, n = 0;
+    uint64_t k;
+
+    for (i = 0; i < LATEST_MAX_NODES && n < max; i++) {
+        k = atomic_load_explicit(&l->e[i].key, memory_order_acquire);
+        if (!k || (!all && (uint32_t)(k >> 16) != serial))
+            continue;
+        latest_read(l, &l->e[i], &r[n]);
+        /* claimed, but its first frame is still being written */
+        if (r[n].frames)
+            n++;
+    }
+    return n;
+}
+
+unsigned latest_node(struct latest *l, uint32_t serial, struct latest_record *r, unsigned max)
+{
+    return latest_copy(l, serial, 0, r, max);
+}
+
+unsigned latest_snapshot(struct latest *l, struct latest_record *r, unsigned max)
+{
+    return latest_copy(l, 0, 1, r, max);
+}
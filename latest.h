@@ -0,0 +1,72 @@
+/*
+ * latest.h - the most recent frame of every node, for queries
+ *
+ * A fixed open addressing table keyed by node serial (taken from the
+ * frame, as the store does) and tracker, updated by the reactors as frames
+ * arrive and read by the query thread (query.h). Entries are claimed with
+ * a compare and swap on their key and never removed.
+ *
+ * Every entry is a seqlock: a writer makes its sequence odd, updates the
+ * record and makes the sequence even again; a reader copies the record
+ * and tries again when the sequence was odd or changed meanwhile, so
+ * readers never hold up the reactors. Two writers of one entry (a node
+ * that reconnected to another reactor while its old connection drains)
+ * take turns on the odd sequence.
+ *
+ * rate is the frame rate of the node over its last full second; it is
+ * not decayed when the node goes quiet, arrival_ns tells how stale it is.
+ */
+
+#ifndef TRAKRAY_LATEST_H
+#define TRAKRAY_LATEST_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define LATEST_MAX_NODES 4096           /* node trackers, a power of two */
+#define LATEST_FRAME_BYTES 256
+
+/* one node tracker as a query returns it, little endian */
+struct latest_record {
+    uint32_t serial;
+    uint16_t device;                    /* tracker of the node, 0 for legacy frames */
+    uint16_t reserved;
+    uint64_t seq;                       /* wire sequence number, 0 for legacy frames */
+    uint64_t acq_ns;                    /* CLOCK_REALTIME of acquisition, 0 for legacy */
+    uint64_t arrival_ns;                /* CLOCK_REALTIME of arrival at the collector */
+    uint64_t frames;                    /* since the collector started */
+    double rate;                        /* frames per second */
+    unsigned char frame[LATEST_FRAME_BYTES];
+};
+
+_Static_assert(sizeof(struct latest_record) == 304, "latest record layout");
+
+struct latest_entry {
+    _Atomic uint64_t key;               /* 0 = free */
+    atomic_uint seq;                    /* odd while a writer is at it */
+    struct latest_record rec;
+    uint64_t win_start;                 /* rate window, written under seq */
+    uint64_t win_frames;
+};
+
+struct latest {
+    struct latest_entry *e;
+    atomic_ulong updates;
+    atomic_ulong full;                  /* frames of nodes that found no entry */
+    atomic_ulong read_retries;
+};
+
+int latest_init(struct latest *l);
+void latest_free(struct latest *l);
+
+/* a frame of serial's tracker device arrived */
+void latest_update(struct latest *l, uint32_t serial, uint16_t device, uint64_t seq,
+                   uint64_t acq_ns, uint64_t arrival_ns, const unsigned char *frame);
+
+/* copy the trackers of serial into r, room for max, returns how many */
+unsigned latest_node(struct latest *l, uint32_t serial, struct latest_record *r, unsigned max);
+
+/* copy every node tracker into r, room for max, returns how many */
+unsigned latest_snapshot(struct latest *l, struct latest_record *r, unsigned max);
+
+#endif
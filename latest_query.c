@@ -0,0 +1,255 @@
+/*
+ * latest_query.c - newest frames of the nodes, from a collector run with -q
+ *
+ * Compile
+ * gcc -O2 -o latest_query latest_query.c hist.c -lpthread
+ * ./latest_query -q /run/trakray.sock [-s serial] [-r]
+ * ./latest_query -q /run/trakray.sock [-s serial] -B readers [-d seconds]
+ *
+ * Prints one line per node tracker (query.h): serial, tracker, frames,
+ * frame rate, age of the newest frame and its first bytes; all of them,
+ * or those of the node with serial (hex as in /proc/cpuinfo). With -r
+ * the records are written to stdout as they come.
+ *
+ * -B starts that many readers, each querying back to back on its own
+ * connection for the given time, and prints the queries per second and
+ * the latency per query; run it next to a loaded collector (e.g. by
+ * collector_bench) and compare the collector's frame rate and latency
+ * with and without it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hist.h"
+
+#define FRAME_BYTES 256
+#define MAX_READERS 64
+
+/* struct latest_record of latest.h */
+struct record {
+    uint32_t serial;
+    uint16_t device;
+    uint16_t reserved;
+    uint64_t seq;
+    uint64_t acq_ns;
+    uint64_t arrival_ns;
+    uint64_t frames;
+    double rate;
+    unsigned char frame[FRAME_BYTES];
+};
+
+_Static_assert(sizeof(struct record) == 304, "latest record layout");
+
+struct reader {
+    pthread_t thread;
+    unsigned long queries;
+    unsigned long records;
+    int failed;
+    struct hist lat;
+};
+
+static const char *path;
+static char request[64];
+static double duration = 5;
+
+static unsigned long long now_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int connect_query(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len) {
+        n = recv(fd, p, len, 0);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* send the request and read the reply into *recs, returns the count or -1 */
+static long query(int fd, struct record **recs, uint32_t *cap)
+{
+    uint32_t count;
+
+    if (send(fd, request, strlen(request), MSG_NOSIGNAL) < 0 ||
+        read_all(fd, &count, sizeof(count)) != 0)
+        return -1;
+    if (count > *cap) {
+        free(*recs);
+        *recs = malloc(count * sizeof(**recs));
+        if (!*recs)
+            return -1;
+        *cap = count;
+    }
+    if (read_all(fd, *recs, count * sizeof(**recs)) != 0)
+        return -1;
+    return count;
+}
+
+static void *reader_thread(void *arg)
+{
+    struct reader *rd = arg;
+    struct record *recs = NULL;
+    unsigned long long end, t;
+    uint32_t cap = 0;
+    long n;
+    int fd;
+
+    fd = connect_query();
+    if (fd < 0) {
+        rd->failed = 1;
+        return NULL;
+    }
+    end = now_ns(CLOCK_MONOTONIC) + (unsigned long long)(duration * 1e9);
+    while ((t = now_ns(CLOCK_MONOTONIC)) < end) {
+        n = query(fd, &recs, &cap);
+        if (n < 0) {
+            rd->failed = 1;
+            break;
+        }
+        hist_add(&rd->lat, now_ns(CLOCK_MONOTONIC) - t);
+        rd->queries++;
+        rd->records += n;
+    }
+    free(recs);
+    close(fd);
+    return NULL;
+}
+
+static int bench(int readers)
+{
+    static struct reader rd[MAX_READERS];
+    static struct hist lat;
+    unsigned long queries = 0, records = 0;
+    int i, failed = 0;
+
+    hist_init(&lat);
+    for (i = 0; i < readers; i++) {
+        hist_init(&rd[i].lat);
+        if (pthread_create(&rd[i].thread, NULL, reader_thread, &rd[i]) != 0) {
+            perror("could not create thread");
+            return 1;
+        }
+    }
+    for (i = 0; i < readers; i++) {
+        pthread_join(rd[i].thread, NULL);
+        queries += rd[i].queries;
+        records += rd[i].records;
+        failed += rd[i].failed;
+        hist_merge(&lat, &rd[i].lat);
+    }
+    printf("%d readers, %d failed: %lu queries in %.1f s, %.0f queries/s, "
+           "%.1f records per query\n", readers, failed, queries, duration,
+           queries / duration, queries ? (double)records / queries : 0);
+    hist_print(&lat, stdout, "query", 1e3, "us");
+    return failed != 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct record *recs = NULL;
+    unsigned long long now;
+    int raw = 0, readers = 0, opt, fd, i, j;
+    const char *serial = NULL;
+    uint32_t cap = 0;
+    long n;
+
+    while ((opt = getopt(argc, argv, "q:s:rB:d:")) != -1) {
+        switch (opt) {
+        case 'q':
+            path = optarg;
+            break;
+        case 's':
+            serial = optarg;
+            break;
+        case 'r':
+            raw = 1;
+            break;
+        case 'B':
+            readers = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        default:
+            path = NULL;
+            optind = argc;
+            break;
+        }
+    }
+    if (!path || readers < 0 || readers > MAX_READERS) {
+        fprintf(stderr, "usage: %s -q query_socket [-s serial] [-r] "
+                "[-B readers [-d seconds]]\n", argv[0]);
+        return 1;
+    }
+    if (serial)
+        snprintf(request, sizeof(request), "node %.40s\n", serial);
+    else
+        strcpy(request, "all\n");
+    if (readers)
+        return bench(readers);
+
+    fd = connect_query();
+    if (fd < 0)
+        return 1;
+    n = query(fd, &recs, &cap);
+    close(fd);
+    if (n < 0) {
+        fprintf(stderr, "%s: query failed\n", path);
+        return 1;
+    }
+    if (raw) {
+        fwrite(recs, sizeof(*recs), n, stdout);
+        return 0;
+    }
+    now = now_ns(CLOCK_REALTIME);
+    for (i = 0; i < n; i++) {
+        printf("%08x %u %llu frames %.1f/s %.3f s ago ", recs[i].serial, recs[i].device,
+               (unsigned long long)recs[i].frames, recs[i].rate,
+               now > recs[i].arrival_ns ? (now - recs[i].arrival_ns) / 1e9 : 0);
+        for (j = 0; j < 16; j++)
+            printf("%02X", recs[i].frame[j]);
+        printf("\n");
+    }
+    fprintf(stderr, "%ld node trackers\n", n);
+    return 0;
+}
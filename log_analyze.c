@@ -0,0 +1,473 @@
+/*
+ * log_analyze.c - stage latency, health and rate out of node logs and captures
+ *
+ * Compile
+ * gcc -O2 -o log_analyze log_analyze.c hist.c
+ * ./log_analyze [-s] files...
+ * ./log_analyze [-t percent] -b base_file [-b base_file]... files...
+ *
+ * Reads b28 logs (its stdout, with PROFILE stage times), frame captures
+ * (the collector's stdout, store_query output) and store segments
+ * (NNNNNNNN.seg), telling them apart by content, and streams them: the
+ * statistics are histograms and a fixed node table, so memory does not
+ * grow with the input. All files given make up one run.
+ *
+ * From the logs: the time of each stage per cycle, T2-T1 (waiting for
+ * ReadyIn), T3-T2 (the SPI transfer) and T4-T3 (the send), the device
+ * ID readbacks and how many of the health checks found the device
+ * crashed, sends and failed sends, node starts and uplink connects, and
+ * the frame rate the cycles achieve (cycles over the sum of their stage
+ * times; logs carry no wall clock). From captures: frames per node; store
+ * segments also give the arrival rate and the time between frames of a
+ * node. -s adds one line per node.
+ *
+ * With -b the files given with -b are a baseline run and the others are
+ * compared with it: every metric side by side with its change, marked
+ * where it got worse by more than percent (default 10). The exit status
+ * is 2 when anything did, so a firmware or config change can be checked
+ * in a script.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hist.h"
+#include "wire.h"
+#include "store.h"
+
+#define FRAME_BYTES 256
+#define MAX_NODES 4096              /* a power of two */
+#define MAX_FILES 64
+#define STAGES 3
+#define DEFAULT_THRESHOLD 10.0      /* percent */
+
+static const char *stage_name[STAGES] = {
+    "T2-T1 ReadyIn wait", "T3-T2 SPI transfer", "T4-T3 send",
+};
+
+struct node {
+    uint32_t serial;
+    int used;
+    unsigned long frames;
+    uint64_t first_ns, last_ns;     /* arrival, store segments only */
+};
+
+struct run {
+    const char *name;
+    int nfiles;
+    unsigned long lines, logs, captures, segments;
+
+    /* logs */
+    struct hist stage[STAGES];      /* ns */
+    unsigned long cycles;
+    double cycle_s;                 /* sum of the stage times of whole cycles */
+    unsigned stage_seen;            /* stages of the current cycle so far */
+    double stage_sum;
+    unsigned long starts, id_reads, fine, crashed, recovered, dead;
+    unsigned long sends, send_errors, connects, connect_errors;
+    double backend_fps;             /* last b28 summary, 0 = none */
+
+    /* captures */
+    unsigned long frames, nnodes, untracked;
+    uint64_t first_ns, last_ns;     /* arrival span, store segments only */
+    unsigned long timed;            /* frames with an arrival time */
+    struct hist gap;                /* between frames of a node, ns */
+    struct node nodes[MAX_NODES];
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_init(struct run *r, const char *name)
+{
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    for (i = 0; i < STAGES; i++)
+        hist_init(&r->stage[i]);
+    hist_init(&r->gap);
+}
+
+static struct node *node_lookup(struct run *r, uint32_t serial)
+{
+    unsigned i, h = (serial * 2654435761u) & (MAX_NODES - 1);
+    struct node *n;
+
+    for (i = 0; i < MAX_NODES; i++, h = (h + 1) & (MAX_NODES - 1)) {
+        n = &r->nodes[h];
+        if (!n->used) {
+            n->used = 1;
+            n->serial = serial;
+            r->nnodes++;
+            return n;
+        }
+        if (n->serial == serial)
+            return n;
+    }
+    return NULL;
+}
+
+static void add_frame(struct run *r, const unsigned char *frame, uint64_t arrival_ns)
+{
+    struct node *n;
+    uint32_t serial;
+
+    r->frames++;
+    serial = wire_frame_serial(frame);
+    n = node_lookup(r, serial);
+    if (!n) {
+        r->untracked++;
+        return;
+    }
+    n->frames++;
+    if (!arrival_ns)
+        return;
+    if (n->last_ns && arrival_ns >= n->last_ns)
+        hist_add(&r->gap, arrival_ns - n->last_ns);
+    if (!n->first_ns)
+        n->first_ns = arrival_ns;
+    n->last_ns = arrival_ns;
+    if (!r->first_ns || arrival_ns < r->first_ns)
+        r->first_ns = arrival_ns;
+    if (arrival_ns > r->last_ns)
+        r->last_ns = arrival_ns;
+    r->timed++;
+}
+
+static int starts_with(const char *s, const char *prefix)
+{
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* "T2 - T1  - 5.524187", "T3 -T2  - 0.000503": stage 0 to 2, or -1 */
+static int stage_line(const char *s, double *sec)
+{
+    const char *p;
+    int a, b;
+
+    if (s[0] != 'T' || s[1] < '2' || s[1] > '4')
+        return -1;
+    a = s[1] - '0';
+    p = strchr(s + 2, 'T');
+    if (!p || p[1] < '1' || p[1] > '3')
+        return -1;
+    b = p[1] - '0';
+    p = strrchr(p, '-');
+    if (a != b + 1 || !p)
+        return -1;
+    *sec = strtod(p + 1, NULL);
+    return a - 2;
+}
+
+static void log_line(struct run *r, const char *s)
+{
+    const char *p;
+    double sec;
+    int k;
+
+    r->lines++;
+    while (*s == ' ')
+        s++;
+    k = stage_line(s, &sec);
+    if (k >= 0) {
+        hist_add(&r->stage[k], (uint64_t)(sec * 1e9));
+        /* a cycle counts for the rate once all of its stages are in */
+        if (k == 0) {
+            r->stage_seen = 0;
+            r->stage_sum = 0;
+        }
+        r->stage_seen |= 1u << k;
+        r->stage_sum += sec;
+        if (k == STAGES - 1 && r->stage_seen == (1u << STAGES) - 1) {
+            r->cycles++;
+            r->cycle_s += r->stage_sum;
+            r->stage_seen = 0;
+        }
+        return;
+    }
+    switch (s[0]) {
+    case 'R':
+        if (starts_with(s, "Read from SPI_ID_R") || starts_with(s, "Read ID:"))
+            r->id_reads++;
+        else if (starts_with(s, "return val - ") && atoi(s + 13) != 0)
+            r->send_errors++;
+        break;
+    case 'S':
+        if (starts_with(s, "SPI Device is fine"))
+            r->fine++;
+        else if (starts_with(s, "SPI Device crashed"))
+            r->crashed++;
+        else if (starts_with(s, "SPI Device recovered"))
+            r->recovered++;
+        else if (starts_with(s, "SPI Device still crashed"))
+            r->dead++;
+        else if (starts_with(s, "Send successful"))
+            r->sends++;
+        else if (starts_with(s, "Starting"))
+            r->starts++;
+        break;
+    case 'B':
+        /* "Backend sim x1: 1000 frames in 2.540 s, 393.70 frames/s" */
+        if (starts_with(s, "Backend ") && (p = strstr(s, " s, ")))
+            r->backend_fps = strtod(p + 4, NULL);
+        break;
+    case 'u':
+        if (starts_with(s, "uplink: connected"))
+            r->connects++;
+        else if (starts_with(s, "uplink: ") && strstr(s, "retry in"))
+            r->connect_errors++;
+        break;
+    default:
+        /* the first line of the old logs: " args 1 =  Starting" */
+        if (strstr(s, "Starting"))
+            r->starts++;
+        break;
+    }
+}
+
+static int analyze_file(struct run *r, const char *path)
+{
+    static unsigned char buf[1 << 16];
+    char line[1024];
+    struct store_record rec;
+    size_t n, i, fill;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    n = fread(buf, 1, sizeof(buf), f);
+
+    if (n >= 8 && memcmp(buf, STORE_SEG_MAGIC, 8) == 0) {
+        /* store segment: a header page, then the records */
+        r->segments++;
+        fill = n;
+        i = STORE_HEADER_BYTES;
+        for (;;) {
+            for (; i + sizeof(rec) <= fill; i += sizeof(rec)) {
+                memcpy(&rec, buf + i, sizeof(rec));
+                if (rec.arrival_ns)         /* not yet written */
+                    add_frame(r, rec.frame, rec.arrival_ns);
+            }
+            if (i > fill)
+                i = fill;
+            memmove(buf, buf + i, fill - i);
+            fill -= i;
+            i = 0;
+            n = fread(buf + fill, 1, sizeof(buf) - fill, f);
+            if (!n)
+                break;
+            fill += n;
+        }
+    } else if (memchr(buf, 0, n)) {
+        /* bare frames: no log line has a NUL in it */
+        r->captures++;
+        fill = n;
+        for (;;) {
+            for (i = 0; i + FRAME_BYTES <= fill; i += FRAME_BYTES)
+                add_frame(r, buf + i, 0);
+            memmove(buf, buf + i, fill - i);
+            fill -= i;
+            n = fread(buf + fill, 1, sizeof(buf) - fill, f);
+            if (!n)
+                break;
+            fill += n;
+        }
+    } else {
+        r->logs++;
+        rewind(f);
+        while (fgets(line, sizeof(line), f))
+            log_line(r, line);
+    }
+    fclose(f);
+    r->nfiles++;
+    return 0;
+}
+
+/* the metrics a run is compared on */
+enum metric_kind { LOWER_BETTER, HIGHER_BETTER };
+
+struct metric {
+    char name[48];
+    double value;
+    int kind;
+    const char *unit;
+};
+
+#define MAX_METRICS 32
+
+static unsigned run_metrics(const struct run *r, struct metric *m)
+{
+    unsigned n = 0, k;
+    double checks = r->fine + r->crashed, attempts = r->sends + r->send_errors;
+
+#define METRIC(v, kd, u, ...) do { \
+        snprintf(m[n].name, sizeof(m[n].name), __VA_ARGS__); \
+        m[n].value = (v); \
+        m[n].kind = (kd); \
+        m[n].unit = (u); \
+        n++; \
+    } while (0)
+
+    for (k = 0; k < STAGES; k++) {
+        if (!r->stage[k].count)
+            continue;
+        METRIC(hist_quantile(&r->stage[k], 0.5) / 1e6, LOWER_BETTER, "ms", "%s p50", stage_name[k]);
+        METRIC(hist_quantile(&r->stage[k], 0.99) / 1e6, LOWER_BETTER, "ms", "%s p99", stage_name[k]);
+        METRIC(r->stage[k].max / 1e6, LOWER_BETTER, "ms", "%s max", stage_name[k]);
+    }
+    if (r->cycles)
+        METRIC(r->cycles / r->cycle_s, HIGHER_BETTER, "/s", "frame rate");
+    if (r->backend_fps)
+        METRIC(r->backend_fps, HIGHER_BETTER, "/s", "backend frame rate");
+    if (checks)
+        METRIC(100.0 * r->crashed / checks, LOWER_BETTER, "%", "health checks failed");
+    if (attempts)
+        METRIC(100.0 * r->send_errors / attempts, LOWER_BETTER, "%", "sends failed");
+    if (r->logs)
+        METRIC(r->connects > 1 ? r->connects - 1 : 0, LOWER_BETTER, "", "reconnects");
+    if (r->timed && r->last_ns > r->first_ns) {
+        METRIC(r->timed * 1e9 / (r->last_ns - r->first_ns), HIGHER_BETTER, "/s",
+               "arrival rate");
+        METRIC(hist_quantile(&r->gap, 0.99) / 1e6, LOWER_BETTER, "ms", "node frame gap p99");
+    }
+    return n;
+#undef METRIC
+}
+
+static void print_run(const struct run *r, int per_node)
+{
+    unsigned i;
+
+    printf("%s: %d files (%lu logs, %lu captures, %lu segments), %lu lines, %lu frames\n",
+           r->name, r->nfiles, r->logs, r->captures, r->segments, r->lines, r->frames);
+    for (i = 0; i < STAGES; i++)
+        if (r->stage[i].count)
+            hist_print(&r->stage[i], stdout, stage_name[i], 1e6, "ms");
+    if (r->logs) {
+        printf("Cycles: %lu, %.2f frames/s over %.1f s of stage time", r->cycles,
+               r->cycle_s > 0 ? r->cycles / r->cycle_s : 0, r->cycle_s);
+        if (r->backend_fps)
+            printf(", backend reported %.2f frames/s", r->backend_fps);
+        printf("\n");
+        printf("Health: %lu ID reads, %lu checks, %lu crashed (%.2f%%), %lu recovered, "
+               "%lu still crashed\n", r->id_reads, r->fine + r->crashed, r->crashed,
+               r->fine + r->crashed ? 100.0 * r->crashed / (r->fine + r->crashed) : 0,
+               r->recovered, r->dead);
+        printf("Uplink: %lu sends, %lu failed, %lu starts, %lu connects (%lu reconnects), "
+               "%lu connect errors\n", r->sends, r->send_errors, r->starts, r->connects,
+               r->connects > 1 ? r->connects - 1 : 0, r->connect_errors);
+    }
+    if (r->frames) {
+        printf("Frames: %lu of %lu nodes (%lu untracked)", r->frames, r->nnodes, r->untracked);
+        if (r->timed && r->last_ns > r->first_ns)
+            printf(", %.1f frames/s over %.1f s", r->timed * 1e9 / (r->last_ns - r->first_ns),
+                   (r->last_ns - r->first_ns) / 1e9);
+        printf("\n");
+        if (r->gap.count)
+            hist_print(&r->gap, stdout, "Gap between frames of a node", 1e6, "ms");
+    }
+    if (per_node)
+        for (i = 0; i < MAX_NODES; i++) {
+            const struct node *n = &r->nodes[i];
+
+            if (!n->used)
+                continue;
+            printf("Node %08x: %lu frames", n->serial, n->frames);
+            if (n->last_ns > n->first_ns)
+                printf(", %.2f frames/s", (n->frames - 1) * 1e9 / (n->last_ns - n->first_ns));
+            printf("\n");
+        }
+}
+
+/* returns how many metrics got worse by more than threshold percent */
+static int compare(const struct run *base, const struct run *cur, double threshold)
+{
+    static struct metric mb[MAX_METRICS], mc[MAX_METRICS];
+    unsigned nb = run_metrics(base, mb), nc = run_metrics(cur, mc), i, j;
+    double change, worse;
+    int regressions = 0;
+
+    printf("%-34s %14s %14s %9s\n", "", base->name, cur->name, "change");
+    for (i = 0; i < nc; i++) {
+        for (j = 0; j < nb && strcmp(mb[j].name, mc[i].name) != 0; j++)
+            ;
+        if (j == nb) {
+            printf("%-34s %14s %12.3f%-2s\n", mc[i].name, "-", mc[i].value, mc[i].unit);
+            continue;
+        }
+        change = mb[j].value ? 100.0 * (mc[i].value - mb[j].value) / mb[j].value :
+                 (mc[i].value ? INFINITY : 0);
+        worse = mc[i].kind == LOWER_BETTER ? change : -change;
+        printf("%-34s %12.3f%-2s %12.3f%-2s %+8.1f%%%s\n", mc[i].name, mb[j].value, mb[j].unit,
+               mc[i].value, mc[i].unit, change, worse > threshold ? "  REGRESSION" : "");
+        regressions += worse > threshold;
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    static struct run base, cur;
+    const char *base_files[MAX_FILES];
+    double threshold = DEFAULT_THRESHOLD, start;
+    int nbase = 0, per_node = 0, opt, i, regressions;
+
+    while ((opt = getopt(argc, argv, "b:t:s")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (nbase < MAX_FILES)
+                base_files[nbase++] = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 's':
+            per_node = 1;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-s] [-t percent] [-b base_file]... files...\n", argv[0]);
+        return 1;
+    }
+    start = now_sec();
+    run_init(&base, nbase ? base_files[0] : NULL);
+    run_init(&cur, argv[optind]);
+    for (i = 0; i < nbase; i++)
+        if (analyze_file(&base, base_files[i]) != 0)
+            return 1;
+    for (i = optind; i < argc; i++)
+        if (analyze_file(&cur, argv[i]) != 0)
+            return 1;
+
+    if (nbase) {
+        print_run(&base, per_node);
+        printf("\n");
+    }
+    print_run(&cur, per_node);
+    fprintf(stderr, "%lu lines, %lu frames in %.3f s\n", base.lines + cur.lines,
+            base.frames + cur.frames, now_sec() - start);
+    if (!nbase)
+        return 0;
+    printf("\n");
+    regressions = compare(&base, &cur, threshold);
+    printf("%d metrics worse by more than %.0f%%\n", regressions, threshold);
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,571 @@
+/*
+ * pubsub.c - frame broker of the collector, see pubsub.h
+ */
+
+#define _GNU_SOURCE     /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "pubsub.h"
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void wake(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0)
+        perror("pubsub: write failed");
+}
+
+/*
+ * a chunk with nothing in it, NULL when all PUBSUB_CHUNKS are taken or
+ * PUBSUB_HOLD wait for the broker to be let go; under lock
+ */
+static struct pubsub_chunk *chunk_get(struct pubsub *ps)
+{
+    struct pubsub_chunk *c = ps->free;
+
+    if (ps->held && ps->npending >= PUBSUB_HOLD)
+        return NULL;
+    if (c)
+        ps->free = c->next;
+    else if (ps->chunks < PUBSUB_CHUNKS && (c = malloc(sizeof(*c))))
+        ps->chunks++;
+    if (c) {
+        c->next = NULL;
+        c->refs = 0;
+        c->frames = 0;
+    }
+    return c;
+}
+
+void pubsub_publish(struct pubsub *ps, const unsigned char *frames, unsigned n, size_t stride)
+{
+    struct pubsub_chunk *c;
+    struct timespec deadline;
+    uint64_t t;
+    unsigned i;
+    int woke = 0;
+
+    pthread_mutex_lock(&ps->lock);
+    for (i = 0; i < n; i++) {
+        c = ps->cur;
+        if (!c || c->frames == PUBSUB_CHUNK_FRAMES) {
+            if (c) {
+                *ps->pending_tail = c;
+                ps->pending_tail = &c->next;
+                ps->npending++;
+                ps->cur = NULL;
+            }
+            c = chunk_get(ps);
+            if (!c && ps->held) {
+                /* a blocking subscriber is behind: push back, for a while */
+                t = mono_ns();
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += PUBSUB_MAX_BLOCK_MS / 1000;
+                while (!(c = chunk_get(ps)) && ps->held && !ps->stop)
+                    if (pthread_cond_timedwait(&ps->freed, &ps->lock, &deadline) == ETIMEDOUT)
+                        break;
+                hist_add(&ps->block_lat, mono_ns() - t);
+            }
+            if (!c) {
+                ps->lost += n - i;
+                break;
+            }
+            ps->cur = c;
+        }
+        c->serial[c->frames] = wire_frame_serial(frames + i * stride);
+        memcpy(c->frame[c->frames++], frames + i * stride, PUBSUB_FRAME_BYTES);
+        ps->published++;
+    }
+    if (ps->armed && (ps->pending || (ps->cur && ps->cur->frames))) {
+        ps->armed = 0;
+        woke = 1;
+    }
+    pthread_mutex_unlock(&ps->lock);
+    if (woke)
+        wake(ps->wake_fd);
+}
+
+static void chunk_unref(struct pubsub *ps, struct pubsub_chunk *c)
+{
+    if (--c->refs)
+        return;
+    pthread_mutex_lock(&ps->lock);
+    c->next = ps->free;
+    ps->free = c;
+    if (ps->held)
+        pthread_cond_broadcast(&ps->freed);
+    pthread_mutex_unlock(&ps->lock);
+}
+
+static int sub_wants(const struct pubsub_sub *s, uint32_t serial)
+{
+    unsigned i;
+
+    if (!s->nserials)
+        return 1;
+    for (i = 0; i < s->nserials; i++)
+        if (s->serial[i] == serial)
+            return 1;
+    return 0;
+}
+
+static unsigned sub_wanted(const struct pubsub_sub *s, const struct pubsub_chunk *c)
+{
+    unsigned i, n = 0;
+
+    if (!s->nserials)
+        return c->frames;
+    for (i = 0; i < c->frames; i++)
+        n += sub_wants(s, c->serial[i]);
+    return n;
+}
+
+static void sub_close(struct pubsub *ps, struct pubsub_sub *s)
+{
+    while (s->len) {
+        chunk_unref(ps, s->queue[s->head]);
+        s->head = (s->head + 1) % PUBSUB_QUEUE;
+        s->len--;
+    }
+    close(s->fd);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+/* drop the oldest chunk not being sent yet, the queue is full */
+static void sub_drop_oldest(struct pubsub *ps, struct pubsub_sub *s)
+{
+    unsigned second = (s->head + 1) % PUBSUB_QUEUE;
+    struct pubsub_chunk *c;
+
+    if (s->frame || s->off) {
+        /* the head is half sent, the one behind it goes */
+        c = s->queue[second];
+        s->queue[second] = s->queue[s->head];
+    } else {
+        c = s->queue[s->head];
+    }
+    s->head = second;
+    s->len--;
+    atomic_fetch_add(&ps->dropped, sub_wanted(s, c));
+    chunk_unref(ps, c);
+}
+
+/* move to the next frame s wants, letting go of the chunks it is through */
+static void sub_skip(struct pubsub *ps, struct pubsub_sub *s)
+{
+    struct pubsub_chunk *c;
+
+    while (s->len && !s->off) {
+        c = s->queue[s->head];
+        while (s->frame < c->frames && !sub_wants(s, c->serial[s->frame]))
+            s->frame++;
+        if (s->frame < c->frames)
+            return;
+        chunk_unref(ps, c);
+        s->head = (s->head + 1) % PUBSUB_QUEUE;
+        s->len--;
+        s->frame = 0;
+    }
+}
+
+/* send what s has queued until its socket is full, straight from the chunks */
+static void sub_send(struct pubsub *ps, struct pubsub_sub *s)
+{
+    struct iovec iov[PUBSUB_IOV];
+    struct msghdr msg;
+    struct pubsub_chunk *c;
+    unsigned q, f, start, off, niov;
+    unsigned long frames = 0;
+    size_t total, take;
+    ssize_t n;
+
+    sub_skip(ps, s);
+    while (s->len) {
+        niov = 0;
+        total = 0;
+        for (q = 0; q < s->len && niov < PUBSUB_IOV; q++) {
+            c = s->queue[(s->head + q) % PUBSUB_QUEUE];
+            f = q ? 0 : s->frame;
+            off = q ? 0 : s->off;
+            while (f < c->frames && niov < PUBSUB_IOV) {
+                if (!sub_wants(s, c->serial[f])) {
+                    f++;
+                    continue;
+                }
+                for (start = f; f < c->frames && sub_wants(s, c->serial[f]); f++)
+                    ;
+                iov[niov].iov_base = c->frame[start] + off;
+                iov[niov].iov_len = (f - start) * PUBSUB_FRAME_BYTES - off;
+                total += iov[niov++].iov_len;
+                off = 0;
+            }
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+        n = sendmsg(s->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                sub_close(ps, s);
+            break;
+        }
+        /* walk the same frames again for what went out */
+        for (take = n; take; ) {
+            f = PUBSUB_FRAME_BYTES - s->off;
+            if (take < f) {
+                s->off += take;
+                break;
+            }
+            take -= f;
+            s->off = 0;
+            s->frame++;
+            frames++;
+            sub_skip(ps, s);
+        }
+        if ((size_t)n < total)
+            break;
+    }
+    atomic_fetch_add(&ps->sent, frames);
+}
+
+static void sub_give(struct pubsub *ps, struct pubsub_chunk *c)
+{
+    struct pubsub_sub *s;
+    int i;
+
+    for (i = 0; i < PUBSUB_MAX_SUBS; i++) {
+        s = &ps->sub[i];
+        if (s->fd < 0 || !s->subscribed || !sub_wanted(s, c))
+            continue;
+        if (s->len == PUBSUB_QUEUE) {
+            if (s->policy == PUBSUB_CLOSE) {
+                atomic_fetch_add(&ps->closed_slow, 1);
+                sub_close(ps, s);
+                continue;
+            }
+            sub_drop_oldest(ps, s);
+        }
+        s->queue[(s->head + s->len++) % PUBSUB_QUEUE] = c;
+        c->refs++;
+    }
+    if (!c->refs) {
+        c->refs = 1;
+        chunk_unref(ps, c);
+    }
+}
+
+/*
+ * take what the reactors published and hand it to the subscribers, as
+ * much as every blocking subscriber within its bound has room for;
+ * returns the ms until such a bound runs out, -1 for none
+ */
+static int collect(struct pubsub *ps)
+{
+    struct pubsub_chunk *take = NULL, **tail = &take, *c;
+    struct pubsub_sub *s;
+    unsigned room = PUBSUB_CHUNKS;
+    uint64_t now = mono_ns(), bound, left = UINT64_MAX;
+    int i, was_held;
+
+    for (i = 0; i < PUBSUB_MAX_SUBS; i++) {
+        s = &ps->sub[i];
+        if (s->fd < 0 || !s->subscribed || s->policy != PUBSUB_BLOCK)
+            continue;
+        /* past its bound it loses its oldest chunks like drop, until it caught up */
+        if (s->behind_since && s->len < PUBSUB_QUEUE / 2)
+            s->behind_since = 0;
+        if (s->behind_since && now - s->behind_since >= s->block_ms * 1000000ULL)
+            continue;
+        if (room > PUBSUB_QUEUE - s->len)
+            room = PUBSUB_QUEUE - s->len;
+    }
+
+    pthread_mutex_lock(&ps->lock);
+    for (i = room; i && ps->pending; i--) {
+        c = ps->pending;
+        ps->pending = c->next;
+        ps->npending--;
+        *tail = c;
+        tail = &c->next;
+    }
+    if (!ps->pending)
+        ps->pending_tail = &ps->pending;
+    if (i && ps->cur && ps->cur->frames) {
+        *tail = ps->cur;
+        tail = &ps->cur->next;
+        ps->cur = NULL;
+    }
+    *tail = NULL;
+    was_held = ps->held;
+    ps->held = ps->pending || !room;
+    if (was_held && !ps->held)
+        pthread_cond_broadcast(&ps->freed);
+    /* held back: the broker comes back by itself, as the subscriber drains */
+    ps->armed = !ps->pending && !(ps->cur && ps->cur->frames);
+    pthread_mutex_unlock(&ps->lock);
+
+    /* the bound runs from when a subscriber first held the others back */
+    for (i = 0; i < PUBSUB_MAX_SUBS; i++) {
+        s = &ps->sub[i];
+        if (s->fd < 0 || !s->subscribed || s->policy != PUBSUB_BLOCK)
+            continue;
+        bound = s->block_ms * 1000000ULL;
+        /* a hold that ended within the bound does not count against the next */
+        if (!ps->held && s->behind_since && now - s->behind_since < bound)
+            s->behind_since = 0;
+        if (ps->held && !s->behind_since && PUBSUB_QUEUE - s->len == room)
+            s->behind_since = now;
+        if (s->behind_since && now - s->behind_since < bound &&
+            left > bound - (now - s->behind_since))
+            left = bound - (now - s->behind_since);
+    }
+
+    while ((c = take)) {
+        take = c->next;
+        sub_give(ps, c);
+    }
+    return left == UINT64_MAX ? -1 : (int)(left / 1000000) + 1;
+}
+
+static int sub_subscribe(struct pubsub_sub *s, char *line)
+{
+    char *tok, *save, *end;
+    unsigned long v;
+
+    tok = strtok_r(line, " \t\r", &save);
+    if (!tok || strcmp(tok, "subscribe") != 0)
+        return -1;
+    s->policy = PUBSUB_DROP;
+    s->block_ms = PUBSUB_BLOCK_MS;
+    while ((tok = strtok_r(NULL, " \t\r", &save))) {
+        if (strcmp(tok, "drop") == 0)
+            s->policy = PUBSUB_DROP;
+        else if (strcmp(tok, "close") == 0)
+            s->policy = PUBSUB_CLOSE;
+        else if (strncmp(tok, "block", 5) == 0 && (!tok[5] || tok[5] == '=')) {
+            s->policy = PUBSUB_BLOCK;
+            if (tok[5])
+                s->block_ms = atoi(tok + 6);
+            if (s->block_ms > PUBSUB_MAX_BLOCK_MS)
+                s->block_ms = PUBSUB_MAX_BLOCK_MS;
+        } else {
+            v = strtoul(tok, &end, 16);
+            if (*end || s->nserials == PUBSUB_MAX_SERIALS)
+                return -1;
+            s->serial[s->nserials++] = (uint32_t)v;
+        }
+    }
+    s->subscribed = 1;
+    return 0;
+}
+
+static void sub_read(struct pubsub *ps, struct pubsub_sub *s)
+{
+    char discard[256], *nl;
+    ssize_t n;
+
+    if (s->subscribed) {
+        /* nothing more is asked, only the end of the connection matters */
+        n = recv(s->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            sub_close(ps, s);
+        return;
+    }
+    n = recv(s->fd, s->line + s->fill, sizeof(s->line) - 1 - s->fill, MSG_DONTWAIT);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            sub_close(ps, s);
+        return;
+    }
+    s->fill += n;
+    s->line[s->fill] = '\0';
+    nl = strchr(s->line, '\n');
+    if (!nl) {
+        if (s->fill == sizeof(s->line) - 1) {
+            atomic_fetch_add(&ps->rejected, 1);
+            sub_close(ps, s);
+        }
+        return;
+    }
+    *nl = '\0';
+    if (sub_subscribe(s, s->line) != 0) {
+        atomic_fetch_add(&ps->rejected, 1);
+        sub_close(ps, s);
+    }
+}
+
+static void accept_sub(struct pubsub *ps)
+{
+    int fd, i;
+
+    fd = accept4(ps->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    for (i = 0; i < PUBSUB_MAX_SUBS; i++)
+        if (ps->sub[i].fd < 0)
+            break;
+    if (i == PUBSUB_MAX_SUBS) {
+        atomic_fetch_add(&ps->rejected, 1);
+        close(fd);
+        return;
+    }
+    ps->sub[i].fd = fd;
+    atomic_fetch_add(&ps->accepted, 1);
+}
+
+static void *broker_thread(void *arg)
+{
+    struct pubsub *ps = arg;
+    struct pollfd pfd[3 + PUBSUB_MAX_SUBS];
+    int map[3 + PUBSUB_MAX_SUBS];
+    int i, n, timeout = -1;
+    uint64_t v;
+
+    for (;;) {
+        pfd[0].fd = ps->stop_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = ps->listen_fd;
+        pfd[1].events = POLLIN;
+        pfd[2].fd = ps->wake_fd;
+        pfd[2].events = POLLIN;
+        n = 3;
+        for (i = 0; i < PUBSUB_MAX_SUBS; i++) {
+            if (ps->sub[i].fd < 0)
+                continue;
+            pfd[n].fd = ps->sub[i].fd;
+            pfd[n].events = POLLIN | (ps->sub[i].len ? POLLOUT : 0);
+            map[n++] = i;
+        }
+        if (poll(pfd, n, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("pubsub: poll failed");
+            break;
+        }
+        if (pfd[0].revents)
+            break;
+        if (pfd[2].revents && read(ps->wake_fd, &v, sizeof(v)) < 0)
+            perror("pubsub: read failed");
+        for (i = 3; i < n; i++)
+            if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+                sub_read(ps, &ps->sub[map[i]]);
+        for (i = 0; i < PUBSUB_MAX_SUBS; i++)
+            if (ps->sub[i].fd >= 0 && ps->sub[i].len)
+                sub_send(ps, &ps->sub[i]);
+        /* sending first makes room for what collect hands on */
+        timeout = collect(ps);
+        for (i = 0; i < PUBSUB_MAX_SUBS; i++)
+            if (ps->sub[i].fd >= 0 && ps->sub[i].len)
+                sub_send(ps, &ps->sub[i]);
+        if (pfd[1].revents)
+            accept_sub(ps);
+    }
+    for (i = 0; i < PUBSUB_MAX_SUBS; i++)
+        if (ps->sub[i].fd >= 0)
+            sub_close(ps, &ps->sub[i]);
+    return NULL;
+}
+
+int pubsub_start(struct pubsub *ps, const char *path)
+{
+    struct sockaddr_un addr;
+    int i;
+
+    memset(ps, 0, sizeof(*ps));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "pubsub: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(ps->path, path);
+    for (i = 0; i < PUBSUB_MAX_SUBS; i++)
+        ps->sub[i].fd = -1;
+    pthread_mutex_init(&ps->lock, NULL);
+    pthread_cond_init(&ps->freed, NULL);
+    ps->pending_tail = &ps->pending;
+    ps->armed = 1;
+    hist_init(&ps->block_lat);
+
+    ps->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ps->listen_fd < 0) {
+        perror("pubsub: could not create socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(ps->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(ps->listen_fd, PUBSUB_MAX_SUBS) < 0) {
+        fprintf(stderr, "pubsub: could not listen on %s: %s\n", path, strerror(errno));
+        close(ps->listen_fd);
+        return -1;
+    }
+    ps->stop_fd = eventfd(0, EFD_CLOEXEC);
+    ps->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (ps->stop_fd < 0 || ps->wake_fd < 0 ||
+        pthread_create(&ps->thread, NULL, broker_thread, ps) != 0) {
+        perror("pubsub: could not start");
+        close(ps->listen_fd);
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+void pubsub_stop(struct pubsub *ps)
+{
+    struct pubsub_chunk *c;
+
+    pthread_mutex_lock(&ps->lock);
+    ps->stop = 1;
+    pthread_cond_broadcast(&ps->freed);
+    pthread_mutex_unlock(&ps->lock);
+    wake(ps->stop_fd);
+    pthread_join(ps->thread, NULL);
+    close(ps->stop_fd);
+    close(ps->wake_fd);
+    close(ps->listen_fd);
+    unlink(ps->path);
+
+    free(ps->cur);
+    while ((c = ps->pending)) {
+        ps->pending = c->next;
+        free(c);
+    }
+    while ((c = ps->free)) {
+        ps->free = c->next;
+        free(c);
+    }
+}
+
+void pubsub_print_stats(struct pubsub *ps, FILE *f)
+{
+    fprintf(f, "Pubsub: %lu subscribers, %lu rejected, %lu frames published, "
+            "%lu lost (no chunk free), %lu sent, %lu dropped for slow subscribers, "
+            "%lu slow subscribers closed\n",
+            atomic_load(&ps->accepted), atomic_load(&ps->rejected), ps->published, ps->lost,
+            atomic_load(&ps->sent), atomic_load(&ps->dropped), atomic_load(&ps->closed_slow));
+    if (ps->block_lat.count)
+        hist_print(&ps->block_lat, f, "Pubsub: reactor blocked", 1e3, "us");
+}
@@ -0,0 +1,126 @@
+/*
+ * pubsub.h - live frame stream of the collector for any number of consumers
+ *
+ * Consumers (analytics, dashboards, archivers) connect to a Unix stream
+ * socket and send one line
+ *
+ *   subscribe [drop|close|block[=ms]] [SERIAL ...]
+ *
+ * after which they get the 256 byte frames in the collector's stream
+ * format, of every node or only of up to PUBSUB_MAX_SERIALS node serials
+ * (hex as in /proc/cpuinfo, as store_query -s), from the next frame on.
+ *
+ * Frames are published once: the reactors copy them into chunks of
+ * PUBSUB_CHUNK_FRAMES under a short lock, as store_append does, and the
+ * broker thread hands every chunk to the subscribers that want any of its
+ * frames, counting them as references. Each subscriber is sent straight
+ * out of the shared chunks with writev() and drops its reference when it
+ * is through a chunk; a chunk nobody refers to goes back to the free
+ * list. At most PUBSUB_CHUNKS chunks exist.
+ *
+ * A subscriber may lag PUBSUB_QUEUE chunks behind. Then its policy
+ * decides: drop (the default) skips its oldest chunk, close disconnects
+ * it, block stops the broker from taking new chunks for up to ms
+ * (PUBSUB_BLOCK_MS, at most PUBSUB_MAX_BLOCK_MS), so the reactors fill
+ * PUBSUB_HOLD more chunks and then wait, pushing back on the nodes.
+ * Past its bound a blocking subscriber is treated as drop until it has
+ * caught up to half its queue. A reactor that finds no free chunk
+ * otherwise drops the frames and counts them lost, so only a blocking
+ * subscriber can ever hold up ingest, and only for its bound.
+ */
+
+#ifndef TRAKRAY_PUBSUB_H
+#define TRAKRAY_PUBSUB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "hist.h"
+#include "wire.h"
+
+#define PUBSUB_FRAME_BYTES 256
+#define PUBSUB_MAX_SUBS 16
+#define PUBSUB_MAX_SERIALS 8            /* per subscriber */
+#define PUBSUB_CHUNK_FRAMES 256         /* 64 KiB of frames */
+#define PUBSUB_CHUNKS 64
+#define PUBSUB_QUEUE 32                 /* chunks a subscriber may lag behind */
+#define PUBSUB_HOLD (PUBSUB_QUEUE / 2)  /* chunks held back for a blocking one */
+#define PUBSUB_BLOCK_MS 100
+#define PUBSUB_MAX_BLOCK_MS 1000
+#define PUBSUB_LINE_BYTES 128
+#define PUBSUB_IOV 64                   /* per writev() */
+
+enum pubsub_policy {
+    PUBSUB_DROP,
+    PUBSUB_CLOSE,
+    PUBSUB_BLOCK,
+};
+
+struct pubsub_chunk {
+    struct pubsub_chunk *next;          /* pending or free list */
+    unsigned refs;                      /* subscribers yet to send it, broker only */
+    unsigned frames;
+    uint32_t serial[PUBSUB_CHUNK_FRAMES];
+    unsigned char frame[PUBSUB_CHUNK_FRAMES][PUBSUB_FRAME_BYTES];
+};
+
+/* one consumer, broker only */
+struct pubsub_sub {
+    int fd;                             /* -1: free */
+    int subscribed;                     /* its request line is in */
+    unsigned fill;
+    char line[PUBSUB_LINE_BYTES];
+    enum pubsub_policy policy;
+    unsigned block_ms;
+    unsigned nserials;                  /* 0: every node */
+    uint32_t serial[PUBSUB_MAX_SERIALS];
+    struct pubsub_chunk *queue[PUBSUB_QUEUE];
+    unsigned head, len;
+    unsigned frame, off;                /* where in queue[head] sending stands */
+    uint64_t behind_since;              /* CLOCK_MONOTONIC, block holds the others back */
+};
+
+struct pubsub {
+    char path[108];                     /* sun_path */
+    int listen_fd;
+    int stop_fd;                        /* eventfd */
+    int wake_fd;                        /* eventfd, frames for the broker */
+    pthread_t thread;
+
+    /* publishing side, under lock */
+    pthread_mutex_t lock;
+    pthread_cond_t freed;               /* reactors: a chunk is free or block ended */
+    struct pubsub_chunk *cur;           /* being filled */
+    struct pubsub_chunk *pending, **pending_tail;
+    unsigned npending;
+    struct pubsub_chunk *free;
+    unsigned chunks;                    /* allocated */
+    int armed;                          /* broker is waiting for wake_fd */
+    int held;                           /* chunks held back for a blocking subscriber */
+    int stop;
+    unsigned long published;
+    unsigned long lost;                 /* no chunk free */
+    struct hist block_lat;              /* reactor waits for a chunk, ns */
+
+    struct pubsub_sub sub[PUBSUB_MAX_SUBS];
+
+    /* counters, written by the broker */
+    atomic_ulong accepted;
+    atomic_ulong rejected;              /* beyond PUBSUB_MAX_SUBS or bad requests */
+    atomic_ulong sent;                  /* frames, over all subscribers */
+    atomic_ulong dropped;               /* frames skipped for slow subscribers */
+    atomic_ulong closed_slow;
+};
+
+/* listen on path, replacing a stale socket there, and start the broker */
+int pubsub_start(struct pubsub *ps, const char *path);
+void pubsub_stop(struct pubsub *ps);
+
+/* publish n frames stride bytes apart, from the reactors */
+void pubsub_publish(struct pubsub *ps, const unsigned char *frames, unsigned n, size_t stride);
+
+void pubsub_print_stats(struct pubsub *ps, FILE *f);
+
+#endif
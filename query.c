@@ -0,0 +1,229 @@
+/*
+ * query.c - query socket of the collector, see query.h
+ */
+
+#define _GNU_SOURCE     /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+#include "query.h"
+
+static void client_close(struct query_client *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->fill = 0;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* answer one request line, -1 when the client is to go */
+static int answer(struct query *q, struct query_client *c, char *line)
+{
+    uint32_t count;
+    unsigned n;
+
+    if (strcmp(line, "all") == 0)
+        n = latest_snapshot(q->latest, q->reply, LATEST_MAX_NODES);
+    else if (strncmp(line, "node ", 5) == 0)
+        n = latest_node(q->latest, (uint32_t)strtoul(line + 5, NULL, 16), q->reply,
+                        LATEST_MAX_NODES);
+    else {
+        atomic_fetch_add(&q->rejected, 1);
+        return -1;
+    }
+    count = n;
+    atomic_fetch_add(&q->queries, 1);
+    atomic_fetch_add(&q->records, n);
+    if (send_all(c->fd, &count, sizeof(count)) != 0 ||
+        send_all(c->fd, q->reply, n * sizeof(*q->reply)) != 0)
+        return -1;
+    return 0;
+}
+
+static void client_read(struct query *q, struct query_client *c)
+{
+    char *nl, *p;
+    ssize_t n;
+
+    n = recv(c->fd, c->line + c->fill, sizeof(c->line) - 1 - c->fill, 0);
+    if (n <= 0) {
+        client_close(c);
+        return;
+    }
+    c->fill += n;
+    c->line[c->fill] = '\0';
+    p = c->line;
+    while ((nl = strchr(p, '\n'))) {
+        *nl = '\0';
+        if (nl > p && nl[-1] == '\r')
+            nl[-1] = '\0';
+        if (answer(q, c, p) != 0) {
+            client_close(c);
+            return;
+        }
+        p = nl + 1;
+    }
+    c->fill -= p - c->line;
+    memmove(c->line, p, c->fill);
+    /* a line that does not fit is no request of ours */
+    if (c->fill == sizeof(c->line) - 1) {
+        atomic_fetch_add(&q->rejected, 1);
+        client_close(c);
+    }
+}
+
+static void accept_client(struct query *q)
+{
+    struct timeval tv = { QUERY_SEND_TIMEOUT_MS / 1000, QUERY_SEND_TIMEOUT_MS % 1000 * 1000 };
+    int fd, i;
+
+    fd = accept4(q->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    for (i = 0; i < QUERY_MAX_CLIENTS; i++)
+        if (q->client[i].fd < 0)
+            break;
+    if (i == QUERY_MAX_CLIENTS) {
+        atomic_fetch_add(&q->rejected, 1);
+        close(fd);
+        return;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    q->client[i].fd = fd;
+    q->client[i].fill = 0;
+    atomic_fetch_add(&q->accepted, 1);
+}
+
+static void *query_thread(void *arg)
+{
+    struct query *q = arg;
+    struct pollfd pfd[2 + QUERY_MAX_CLIENTS];
+    int map[2 + QUERY_MAX_CLIENTS];
+    int i, n;
+
+    for (;;) {
+        pfd[0].fd = q->stop_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = q->listen_fd;
+        pfd[1].events = POLLIN;
+        n = 2;
+        for (i = 0; i < QUERY_MAX_CLIENTS; i++) {
+            if (q->client[i].fd < 0)
+                continue;
+            pfd[n].fd = q->client[i].fd;
+            pfd[n].events = POLLIN;
+            map[n++] = i;
+        }
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("query: poll failed");
+            break;
+        }
+        if (pfd[0].revents)
+            break;
+        for (i = 2; i < n; i++)
+            if (pfd[i].revents)
+                client_read(q, &q->client[map[i]]);
+        if (pfd[1].revents)
+            accept_client(q);
+    }
+    for (i = 0; i < QUERY_MAX_CLIENTS; i++)
+        if (q->client[i].fd >= 0)
+            client_close(&q->client[i]);
+    return NULL;
+}
+
+int query_start(struct query *q, const char *path, struct latest *l)
+{
+    struct sockaddr_un addr;
+    int i;
+
+    memset(q, 0, sizeof(*q));
+    q->latest = l;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "query: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(q->path, path);
+    for (i = 0; i < QUERY_MAX_CLIENTS; i++)
+        q->client[i].fd = -1;
+    q->reply = malloc(LATEST_MAX_NODES * sizeof(*q->reply));
+    if (!q->reply) {
+        perror("query: out of memory");
+        return -1;
+    }
+
+    q->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (q->listen_fd < 0) {
+        perror("query: could not create socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(q->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(q->listen_fd, QUERY_MAX_CLIENTS) < 0) {
+        fprintf(stderr, "query: could not listen on %s: %s\n", path, strerror(errno));
+        close(q->listen_fd);
+        return -1;
+    }
+    q->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (q->stop_fd < 0 || pthread_create(&q->thread, NULL, query_thread, q) != 0) {
+        perror("query: could not start");
+        close(q->listen_fd);
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+void query_stop(struct query *q)
+{
+    uint64_t one = 1;
+
+    if (write(q->stop_fd, &one, sizeof(one)) < 0)
+        perror("query: write failed");
+    pthread_join(q->thread, NULL);
+    close(q->stop_fd);
+    close(q->listen_fd);
+    unlink(q->path);
+    free(q->reply);
+    q->reply = NULL;
+}
+
+void query_print_stats(struct query *q, FILE *f)
+{
+    fprintf(f, "Query: %lu clients, %lu queries, %lu records, %lu rejected, "
+            "%lu node updates (%lu beyond %d node trackers), %lu read retries\n",
+            atomic_load(&q->accepted), atomic_load(&q->queries), atomic_load(&q->records),
+            atomic_load(&q->rejected), atomic_load(&q->latest->updates),
+            atomic_load(&q->latest->full), LATEST_MAX_NODES,
+            atomic_load(&q->latest->read_retries));
+}
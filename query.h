@@ -0,0 +1,59 @@
+/*
+ * query.h - local query socket of the collector over latest.h
+ *
+ * A Unix stream socket served by one thread, never by the reactors. A
+ * client sends one request per line:
+ *
+ *   all                every node tracker the collector has seen
+ *   node SERIAL        the trackers of one node, serial in hex as in
+ *                      /proc/cpuinfo (as store_query -s)
+ *
+ * and gets back a uint32_t record count followed by that many struct
+ * latest_record, little endian; an unknown request closes the
+ * connection. Requests on one connection are answered in order, so a
+ * client can keep its connection and poll. Up to QUERY_MAX_CLIENTS are
+ * served at once; a client that does not take its reply within
+ * QUERY_SEND_TIMEOUT_MS is dropped.
+ */
+
+#ifndef TRAKRAY_QUERY_H
+#define TRAKRAY_QUERY_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "latest.h"
+
+#define QUERY_MAX_CLIENTS 16
+#define QUERY_LINE_BYTES 64
+#define QUERY_SEND_TIMEOUT_MS 1000
+
+struct query_client {
+    int fd;                             /* -1: free */
+    unsigned fill;
+    char line[QUERY_LINE_BYTES];
+};
+
+struct query {
+    struct latest *latest;
+    char path[108];                     /* sun_path */
+    int listen_fd;
+    int stop_fd;                        /* eventfd */
+    pthread_t thread;
+    struct query_client client[QUERY_MAX_CLIENTS];
+    struct latest_record *reply;        /* LATEST_MAX_NODES records */
+
+    /* counters, written by the query thread */
+    atomic_ulong accepted;
+    atomic_ulong queries;
+    atomic_ulong records;
+    atomic_ulong rejected;              /* clients beyond the limit, bad requests */
+};
+
+/* listen on path, replacing a stale socket there, and start serving l */
+int query_start(struct query *q, const char *path, struct latest *l);
+void query_stop(struct query *q);
+void query_print_stats(struct query *q, FILE *f);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * rt.c - real-time mode of the acquisition loop, see rt.h
+ */
+
+#define _GNU_SOURCE     /* sched_setaffinity, CPU_SET */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "rt.h"
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+/* the last CPU of a list like "1,3-5" in a sysfs file, -1 if none */
+static int last_cpu_in(const char *path)
+{
+    char buf[256], *p;
+    int cpu = -1;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (fgets(buf, sizeof(buf), f))
+        for (p = buf; *p >= '0' && *p <= '9'; ) {
+            cpu = strtol(p, &p, 10);
+            if (*p == '-' || *p == ',')
+                p++;
+        }
+    fclose(f);
+    return cpu;
+}
+
+static int pick_cpu(void)
+{
+    int cpu = last_cpu_in("/sys/devices/system/cpu/isolated");
+
+    if (cpu >= 0)
+        return cpu;
+    return sysconf(_SC_NPROCESSORS_ONLN) - 1;
+}
+
+/*
+ * lock what is mapped now and whatever gets touched later; without
+ * MCL_ONFAULT (before Linux 4.4) MCL_FUTURE would populate the whole
+ * stack of every thread started afterwards
+ */
+static int lock_memory(void)
+{
+    volatile unsigned char stack[RT_STACK_PREFAULT];
+    unsigned i;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0 &&
+        (errno != EINVAL || mlockall(MCL_CURRENT | MCL_FUTURE) != 0))
+        return -1;
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    for (i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+    return 0;
+}
+
+/* every other thread of the process: off cpu, nice RT_OTHERS_NICE */
+static int demote_others(int cpu)
+{
+    pid_t self = syscall(SYS_gettid), tid;
+    struct dirent *e;
+    cpu_set_t others;
+    int i, n = 0, failed = 0;
+    DIR *dir;
+
+    CPU_ZERO(&others);
+    for (i = 0; i < CPU_SETSIZE && i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+        if (i != cpu)
+            CPU_SET(i, &others);
+    dir = opendir("/proc/self/task");
+    if (!dir)
+        return -1;
+    while ((e = readdir(dir))) {
+        tid = atoi(e->d_name);
+        if (tid <= 0 || tid == self)
+            continue;
+        /* on a single core there is nowhere else to go */
+        if ((CPU_COUNT(&others) && sched_setaffinity(tid, sizeof(others), &others) != 0) ||
+            setpriority(PRIO_PROCESS, tid, RT_OTHERS_NICE) != 0)
+            failed = 1;
+        n++;
+    }
+    closedir(dir);
+    return failed || !CPU_COUNT(&others) ? -1 : n;
+}
+
+static int write_file(const char *path, const char *s)
+{
+    FILE *f = fopen(path, "w");
+    int ret;
+
+    if (!f)
+        return -1;
+    ret = fputs(s, f) < 0;
+    ret |= fclose(f) != 0;
+    return ret ? -1 : 0;
+}
+
+static int set_governor(struct rt *rt, int cpu)
+{
+    char path[96], old[sizeof(rt->governor)];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (!fgets(old, sizeof(old), f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    old[strcspn(old, "\n")] = 0;
+    if (strcmp(old, "performance") == 0)
+        return 0;
+    if (write_file(path, "performance") != 0)
+        return -1;
+    strcpy(rt->governor, old);
+    return 0;
+}
+
+int rt_start(struct rt *rt, int prio, int cpu)
+{
+    struct sched_param sp = { .sched_priority = prio };
+    int32_t latency = 0;
+    cpu_set_t set;
+    int failed = 0;
+
+    memset(rt, 0, sizeof(*rt));
+    rt->cpu = -1;
+    rt->dma_fd = -1;
+
+    if (lock_memory() == 0)
+        rt->locked = 1;
+    else {
+        perror("rt: mlockall");
+        failed = 1;
+    }
+
+    if (cpu < 0)
+        cpu = pick_cpu();
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == 0)
+        rt->cpu = cpu;
+    else {
+        fprintf(stderr, "rt: cannot pin to CPU %d: %s\n", cpu, strerror(errno));
+        failed = 1;
+    }
+
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) == 0)
+        rt->prio = prio;
+    else {
+        fprintf(stderr, "rt: cannot run SCHED_FIFO %d: %s\n", prio, strerror(errno));
+        failed = 1;
+    }
+
+    if (demote_others(rt->cpu) >= 0)
+        rt->demoted = 1;
+    else {
+        fprintf(stderr, "rt: cannot move the other threads off CPU %d\n", cpu);
+        failed = 1;
+    }
+
+    if (rt->cpu >= 0 && set_governor(rt, rt->cpu) != 0)
+        fprintf(stderr, "rt: cannot set the performance governor of CPU %d\n", rt->cpu);
+
+    /* the limit holds as long as the file stays open */
+    rt->dma_fd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+    if (rt->dma_fd >= 0 && write(rt->dma_fd, &latency, sizeof(latency)) != sizeof(latency)) {
+        close(rt->dma_fd);
+        rt->dma_fd = -1;
+    }
+    if (rt->dma_fd < 0)
+        fprintf(stderr, "rt: cannot hold /dev/cpu_dma_latency at 0\n");
+    return failed ? -1 : 0;
+}
+
+void rt_stop(struct rt *rt)
+{
+    char path[96];
+
+    if (rt->governor[0]) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+                 rt->cpu);
+        write_file(path, rt->governor);
+        rt->governor[0] = 0;
+    }
+    if (rt->dma_fd >= 0) {
+        close(rt->dma_fd);
+        rt->dma_fd = -1;
+    }
+}
+
+void rt_print(const struct rt *rt, FILE *f)
+{
+    fprintf(f, "Real-time mode: ");
+    if (rt->prio)
+        fprintf(f, "SCHED_FIFO %d", rt->prio);
+    else
+        fprintf(f, "normal priority");
+    if (rt->cpu >= 0)
+        fprintf(f, " on CPU %d", rt->cpu);
+    fprintf(f, ", memory %slocked, other threads %s, idle states %s\n",
+            rt->locked ? "" : "not ", rt->demoted ? "demoted" : "not demoted",
+            rt->dma_fd >= 0 ? "limited" : "not limited");
+}
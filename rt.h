@@ -0,0 +1,52 @@
+/*
+ * rt.h - real-time mode of the acquisition loop
+ *
+ * At normal priority on a shared Pi the loop between the ReadyIn edge
+ * and the SPI read is exposed to page faults, preemption by anything else
+ * on its core, deep idle states and frequency changes. rt_start() makes
+ * the calling thread (the acquisition loop) a real-time one:
+ *
+ *  - locks the memory of the process (mlockall) and prefaults
+ *    RT_STACK_PREFAULT bytes of its stack; heap memory is kept rather
+ *    than trimmed back to the kernel, so a later malloc does not fault
+ *  - pins it to one core, the last isolated one (isolcpus=) if there is
+ *    one, the last online one otherwise, or the one asked for
+ *  - runs it under SCHED_FIFO at the given priority
+ *  - moves every other thread of the process (sender, logger) off that
+ *    core and lowers them to nice RT_OTHERS_NICE
+ *  - sets the cpufreq governor of the core to performance and holds
+ *    /dev/cpu_dma_latency at 0, so the core stays out of deep idle states
+ *
+ * Every step needs root or the matching capability; one that fails is
+ * reported and left out, the rest still apply. rt_stop() gives back the
+ * governor and the idle state limit.
+ *
+ * A backend that spins on ReadyIn (wait=spin) never gives the core up,
+ * so give the loop a core of its own before running it that way.
+ */
+
+#ifndef TRAKRAY_RT_H
+#define TRAKRAY_RT_H
+
+#include <stdio.h>
+
+#define RT_DEFAULT_PRIO 80
+#define RT_STACK_PREFAULT (256 * 1024)
+#define RT_OTHERS_NICE 5
+
+struct rt {
+    int prio;                   /* SCHED_FIFO priority, 0 = not applied */
+    int cpu;                    /* pinned to, -1 = not pinned */
+    int locked;                 /* memory locked */
+    int demoted;                /* other threads moved off the core */
+    int dma_fd;                 /* /dev/cpu_dma_latency, -1 = not held */
+    char governor[32];          /* to restore, "" = not changed */
+};
+
+/* enter the mode in the calling thread, cpu -1 picks one; 0 when all of it applied */
+int rt_start(struct rt *rt, int prio, int cpu);
+void rt_stop(struct rt *rt);
+
+void rt_print(const struct rt *rt, FILE *f);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * spi_script.c - run declarative SPI command lists on a backend
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "backend.h"
+#include "spi_script.h"
+
+/* below this a sleep costs more than the gap itself */
+#define SPIN_LIMIT_US 100
+
+int spi_script_add(struct spi_script *s, const unsigned char *tx,
+                   unsigned char *rx, unsigned len, unsigned gap_us)
+{
+    struct spi_cmd *c;
+
+    if (s->n == SPI_SCRIPT_MAX)
+        return -1;
+    c = &s->cmd[s->n++];
+    c->tx = tx;
+    c->rx = rx;
+    c->len = len;
+    c->gap_us = gap_us;
+    return 0;
+}
+
+void spi_script_set_gap(struct spi_script *s, unsigned gap_us)
+{
+    unsigned i;
+
+    for (i = 0; i < s->n; i++)
+        s->cmd[i].gap_us = gap_us;
+}
+
+void delay_us(unsigned us)
+{
+    unsigned long long end;
+    struct timespec ts;
+
+    if (us >= SPIN_LIMIT_US) {
+        ts.tv_sec = us / 1000000;
+        ts.tv_nsec = (long)(us % 1000000) * 1000L;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+            ;
+        return;
+    }
+    end = mono_ns() + us * 1000ULL;
+    while (mono_ns() < end)
+        ;
+}
+
+int spi_script_run(struct backend *be, const struct spi_script *s)
+{
+    unsigned i;
+
+    if (be->transfer_script)
+        return be->transfer_script(be, s->cmd, s->n);
+
+    for (i = 0; i < s->n; i++) {
+        if (be->transfer(be, s->cmd[i].tx, s->cmd[i].rx, s->cmd[i].len) < 0)
+            return -1;
+        if (s->cmd[i].gap_us)
+            delay_us(s->cmd[i].gap_us);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * spi_script.h - declarative SPI command lists
+ *
+ * A cycle of register writes and reads is described once as a list of
+ * commands and handed to the backend in one go. Backends that can queue
+ * several transfers in one bus operation (backend->transfer_script) get
+ * the whole list; the others get back to back transfers separated by the
+ * chip select gap the device needs, instead of a 1 ms delay() after each.
+ */
+
+#ifndef TRAKRAY_SPI_SCRIPT_H
+#define TRAKRAY_SPI_SCRIPT_H
+
+#define SPI_SCRIPT_MAX 16
+
+/*
+ * Gap between two transfers in us. The device only needs chip select
+ * high for a few SPI clocks between commands; 10 us leaves margin and
+ * can be changed with b28 -g.
+ */
+#define SPI_GAP_US 10
+
+struct spi_cmd {
+    const unsigned char *tx;
+    unsigned char *rx;      /* may equal tx for an in place transfer */
+    unsigned len;
+    unsigned gap_us;        /* idle time after this transfer */
+};
+
+struct spi_script {
+    struct spi_cmd cmd[SPI_SCRIPT_MAX];
+    unsigned n;
+};
+
+struct backend;
+
+/* append one transfer, returns -1 when the script is full */
+int spi_script_add(struct spi_script *s, const unsigned char *tx,
+                   unsigned char *rx, unsigned len, unsigned gap_us);
+
+/* set the gap after every command of the script */
+void spi_script_set_gap(struct spi_script *s, unsigned gap_us);
+
+/* run all commands in order, 0 on success, -1 on error */
+int spi_script_run(struct backend *be, const struct spi_script *s);
+
+/* wait us microseconds, spinning for short gaps where sleeping overshoots */
+void delay_us(unsigned us);
+
+#endif
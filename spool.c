@@ -0,0 +1,176 @@
+/*
+ * spool.c - persistent frame spool, see spool.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+#define SPOOL_MAGIC "TRKSPOOL"
+#define SPOOL_VERSION 3     /* 3: 48 byte wire header with the device */
+
+static struct spool_record *spool_slot(struct spool *sp, uint64_t rec)
+{
+    return (struct spool_record *)(sp->map + SPOOL_PAGE) + rec % sp->hdr.capacity;
+}
+
+/* first record of the block being filled in RAM */
+static uint64_t spool_block_start(const struct spool *sp)
+{
+    return sp->hdr.head - sp->hdr.head % SPOOL_PER_BLOCK;
+}
+
+/*
+ * copy the header into the mapping. Until close only whole blocks are in
+ * the file, so head is recorded at the start of the block being filled.
+ */
+static void spool_sync_header(struct spool *sp, int flags, int exact)
+{
+    struct spool_header h = sp->hdr;
+
+    if (!exact) {
+        h.head = spool_block_start(sp);
+        if (h.tail > h.head)
+            h.tail = h.head;
+    }
+    memcpy(sp->map, &h, sizeof(h));
+    msync(sp->map, SPOOL_PAGE, flags);
+    sp->header_writes++;
+    sp->blocks_since_sync = 0;
+}
+
+/* copy the RAM block into the mapping, it is complete or we are closing */
+static void spool_write_block(struct spool *sp)
+{
+    struct spool_record *dst = spool_slot(sp, spool_block_start(sp));
+
+    memcpy(dst, sp->block, SPOOL_BLOCK);
+    msync(dst, SPOOL_BLOCK, MS_ASYNC);
+    sp->blocks_written++;
+}
+
+int spool_open(struct spool *sp, const char *path, unsigned frames,
+               unsigned sync_blocks)
+{
+    uint64_t capacity = (frames + SPOOL_PER_BLOCK - 1) / SPOOL_PER_BLOCK * SPOOL_PER_BLOCK;
+    off_t size = SPOOL_PAGE + capacity * SPOOL_RECORD;
+    struct stat st;
+    int fresh;
+
+    memset(sp, 0, sizeof(*sp));
+    sp->sync_blocks = sync_blocks ? sync_blocks : 1;
+    if (capacity == 0)
+        return -1;
+
+    sp->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (sp->fd < 0 || fstat(sp->fd, &st) < 0) {
+        fprintf(stderr, "spool: cannot open %s: %s\n", path, strerror(errno));
+        if (sp->fd >= 0)
+            close(sp->fd);
+        return -1;
+    }
+    if (st.st_size != size && ftruncate(sp->fd, size) < 0) {
+        fprintf(stderr, "spool: cannot size %s: %s\n", path, strerror(errno));
+        close(sp->fd);
+        return -1;
+    }
+    sp->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sp->fd, 0);
+    if (sp->map == MAP_FAILED) {
+        fprintf(stderr, "spool: cannot map %s: %s\n", path, strerror(errno));
+        close(sp->fd);
+        return -1;
+    }
+
+    memcpy(&sp->hdr, sp->map, sizeof(sp->hdr));
+    fresh = memcmp(sp->hdr.magic, SPOOL_MAGIC, 8) != 0 ||
+            sp->hdr.version != SPOOL_VERSION ||
+            sp->hdr.record_size != SPOOL_RECORD ||
+            sp->hdr.capacity != capacity ||
+            sp->hdr.head < sp->hdr.tail ||
+            sp->hdr.head - sp->hdr.tail > capacity;
+    if (fresh) {
+        memset(&sp->hdr, 0, sizeof(sp->hdr));
+        memcpy(sp->hdr.magic, SPOOL_MAGIC, 8);
+        sp->hdr.version = SPOOL_VERSION;
+        sp->hdr.record_size = SPOOL_RECORD;
+        sp->hdr.capacity = capacity;
+        spool_sync_header(sp, MS_SYNC, 1);
+    } else {
+        /* a clean close may have left a partly filled block */
+        memcpy(sp->block, spool_slot(sp, spool_block_start(sp)), SPOOL_BLOCK);
+        printf("spool: resuming %s with %u frames queued\n", path, spool_count(sp));
+    }
+    return 0;
+}
+
+void spool_close(struct spool *sp)
+{
+    if (!sp->map)
+        return;
+    if (sp->hdr.head % SPOOL_PER_BLOCK)
+        spool_write_block(sp);
+    spool_sync_header(sp, MS_SYNC, 1);
+    munmap(sp->map, SPOOL_PAGE + sp->hdr.capacity * SPOOL_RECORD);
+    close(sp->fd);
+    sp->map = NULL;
+}
+
+void spool_append(struct spool *sp, const struct wire_hdr *wire,
+                  const unsigned char *frame)
+{
+    struct spool_record *rec = &sp->block[sp->hdr.head % SPOOL_PER_BLOCK];
+
+    if (spool_count(sp) == sp->hdr.capacity) {
+        sp->hdr.tail++;
+        sp->overwritten++;
+    }
+    rec->wire = *wire;
+    memcpy(rec->data, frame, WIRE_PAYLOAD);
+    sp->appended++;
+    if ((sp->hdr.head + 1) % SPOOL_PER_BLOCK == 0) {
+        spool_write_block(sp);
+        sp->hdr.head++;
+        if (++sp->blocks_since_sync >= sp->sync_blocks)
+            spool_sync_header(sp, MS_ASYNC, 0);
+    } else {
+        sp->hdr.head++;
+    }
+}
+
+const struct spool_record *spool_peek(struct spool *sp, unsigned i)
+{
+    uint64_t rec = sp->hdr.tail + i;
+
+    if (rec >= spool_block_start(sp))
+        return &sp->block[rec % SPOOL_PER_BLOCK];
+    return spool_slot(sp, rec);
+}
+
+void spool_consume(struct spool *sp, unsigned n)
+{
+    uint64_t old = sp->hdr.tail;
+
+    sp->hdr.tail += n;
+    sp->drained += n;
+    /* record progress once per crossed block run, and when running empty */
+    if (spool_count(sp) == 0 ||
+        sp->hdr.tail / (SPOOL_PER_BLOCK * sp->sync_blocks) !=
+        old / (SPOOL_PER_BLOCK * sp->sync_blocks))
+        spool_sync_header(sp, MS_ASYNC, 0);
+}
+
+void spool_print_stats(struct spool *sp)
+{
+    unsigned long payload = sp->appended * SPOOL_RECORD;
+
+    printf("Spool: %u queued, %lu appended, %lu drained, %lu overwritten, "
+           "write amplification %.2f\n",
+           spool_count(sp), sp->appended, sp->drained, sp->overwritten,
+           payload ? (double)(sp->blocks_written * SPOOL_BLOCK + sp->header_writes * SPOOL_PAGE) / payload : 0);
+}
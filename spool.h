@@ -0,0 +1,98 @@
+/*
+ * spool.h - persistent on-disk spool of location frames
+ *
+ * While the collector is unreachable the sender thread appends frames to
+ * a fixed size circular file that is memory mapped; after a reconnect it
+ * drains the spool in order. The file survives a restart of the node.
+ *
+ * A record keeps the version 2 wire header (wire.h) with the frame, so a
+ * replayed frame carries its original sequence number and acquisition
+ * time. Records are 320 bytes, which does not divide a page, so they are
+ * staged in blocks of 64 records (5 pages).
+ *
+ * Written with SD cards in mind: frames are collected in a RAM block and
+ * copied into the mapping only once the 20 KiB block is full, so every
+ * data page is dirtied once per pass over the file. The header (head /
+ * tail indices) is copied into the mapping every sync_blocks blocks, when
+ * the spool runs empty and on close, so write amplification stays at
+ * about 1 + 1/(5 * sync_blocks). A power cut loses at most the unsynced
+ * blocks; frames drained but not yet recorded in the header are sent
+ * again.
+ */
+
+#ifndef TRAKRAY_SPOOL_H
+#define TRAKRAY_SPOOL_H
+
+#include <stdint.h>
+
+#include "wire.h"
+
+#define SPOOL_PAGE 4096
+#define SPOOL_RECORD 320
+#define SPOOL_BLOCK (5 * SPOOL_PAGE)
+#define SPOOL_PER_BLOCK (SPOOL_BLOCK / SPOOL_RECORD)
+#define SPOOL_DEFAULT_FRAMES 65536      /* 20 MiB */
+#define SPOOL_DEFAULT_SYNC_BLOCKS 4
+
+/* one spooled frame, the wire header and payload go out as they are */
+struct spool_record {
+    struct wire_hdr wire;
+    unsigned char data[WIRE_PAYLOAD];
+    unsigned char pad[SPOOL_RECORD - WIRE_V2_BYTES];
+};
+
+_Static_assert(sizeof(struct spool_record) == SPOOL_RECORD &&
+               SPOOL_BLOCK % SPOOL_RECORD == 0, "spool record layout");
+
+struct spool_header {
+    char magic[8];              /* "TRKSPOOL" */
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;          /* records, a multiple of SPOOL_PER_BLOCK */
+    uint64_t head;              /* records ever appended */
+    uint64_t tail;              /* records ever drained or overwritten */
+};
+
+struct spool {
+    int fd;
+    unsigned char *map;         /* header page followed by the records */
+    struct spool_header hdr;    /* live copy, the mapped one lags behind */
+    unsigned sync_blocks;
+    unsigned blocks_since_sync;
+    struct spool_record block[SPOOL_PER_BLOCK];     /* the block being filled */
+
+    /* counters */
+    unsigned long appended;
+    unsigned long overwritten;  /* oldest frames lost to a full spool */
+    unsigned long drained;
+    unsigned long blocks_written;
+    unsigned long header_writes;
+};
+
+/*
+ * open or create the spool file with room for frames records (rounded up
+ * to whole blocks); an existing spool of the same size and version is
+ * resumed, one of an older version starts out empty
+ */
+int spool_open(struct spool *sp, const char *path, unsigned frames,
+               unsigned sync_blocks);
+void spool_close(struct spool *sp);
+
+/* append one 256 byte frame and its header, overwriting the oldest when full */
+void spool_append(struct spool *sp, const struct wire_hdr *wire,
+                  const unsigned char *frame);
+
+static inline unsigned spool_count(const struct spool *sp)
+{
+    return (unsigned)(sp->hdr.head - sp->hdr.tail);
+}
+
+/* i-th oldest frame, i < spool_count(); valid until the next append */
+const struct spool_record *spool_peek(struct spool *sp, unsigned i);
+
+/* drop the n oldest frames once they have been sent */
+void spool_consume(struct spool *sp, unsigned n);
+
+void spool_print_stats(struct spool *sp);
+
+#endif
@@ -0,0 +1,740 @@
+/*
+ * store.c - segmented frame store, see store.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "store.h"
+
+#define IDX_MAGIC "TRKIDX01"
+
+static uint64_t real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void seg_path(char *path, size_t len, const char *dir, uint32_t seg, const char *ext)
+{
+    snprintf(path, len, "%s/%08u.%s", dir, seg, ext);
+}
+
+/* segment numbers in dir, sorted, returns the count or -1 */
+static int list_segments(const char *dir, uint32_t **segs)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    uint32_t *v = NULL, *nv, seg, t;
+    int n = 0, cap = 0, i, j;
+    char ext[8];
+
+    if (!d)
+        return -1;
+    while ((e = readdir(d))) {
+        if (sscanf(e->d_name, "%8u.%4s", &seg, ext) != 2 || strcmp(ext, "seg") != 0)
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            nv = realloc(v, cap * sizeof(*v));
+            if (!nv) {
+                closedir(d);
+                free(v);
+                return -1;
+            }
+            v = nv;
+        }
+        v[n++] = seg;
+    }
+    closedir(d);
+    for (i = 1; i < n; i++)
+        for (j = i; j > 0 && v[j - 1] > v[j]; j--) {
+            t = v[j];
+            v[j] = v[j - 1];
+            v[j - 1] = t;
+        }
+    *segs = v;
+    return n;
+}
+
+static int index_init(struct store_index *idx, uint32_t seg)
+{
+    memset(idx, 0, sizeof(*idx));
+    memcpy(idx->hdr.magic, IDX_MAGIC, 8);
+    idx->hdr.segment = seg;
+    idx->time_cap = 1024;
+    idx->time = malloc(idx->time_cap * sizeof(*idx->time));
+    idx->serial = calloc(STORE_MAX_SERIALS, sizeof(*idx->serial));
+    if (!idx->time || !idx->serial) {
+        idx->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void index_free(struct store_index *idx)
+{
+    free(idx->time);
+    free(idx->serial);
+    idx->time = NULL;
+    idx->serial = NULL;
+}
+
+static struct store_serial *index_serial(struct store_index *idx, uint32_t serial, int add)
+{
+    unsigned h = (serial * 2654435761u) & (STORE_MAX_SERIALS - 1);
+
+    while (idx->serial[h].count) {
+        if (idx->serial[h].serial == serial)
+            return &idx->serial[h];
+        h = (h + 1) & (STORE_MAX_SERIALS - 1);
+    }
+    if (!add)
+        return NULL;
+    /* keep the table sparse, past that queries scan the segment */
+    if (idx->hdr.serials >= STORE_MAX_SERIALS * 3 / 4) {
+        idx->hdr.serials_full = 1;
+        return NULL;
+    }
+    idx->hdr.serials++;
+    idx->serial[h].serial = serial;
+    return &idx->serial[h];
+}
+
+/* account record number idx->hdr.records, -1 when out of memory */
+static int index_add(struct store_index *idx, const struct store_record *rec)
+{
+    struct store_serial *s;
+    uint64_t *time;
+
+    if (idx->failed)
+        return -1;
+    if (idx->hdr.records % STORE_INDEX_EVERY == 0) {
+        if (idx->hdr.entries == idx->time_cap) {
+            time = realloc(idx->time, idx->time_cap * 2 * sizeof(*idx->time));
+            if (!time) {
+                idx->failed = 1;
+                return -1;
+            }
+            idx->time = time;
+            idx->time_cap *= 2;
+        }
+        idx->time[idx->hdr.entries++] = rec->arrival_ns;
+    }
+    if (idx->hdr.records == 0)
+        idx->hdr.first_ns = rec->arrival_ns;
+    idx->hdr.last_ns = rec->arrival_ns;
+    idx->hdr.records++;
+
+    s = index_serial(idx, rec->serial, 1);
+    if (s) {
+        if (s->count++ == 0)
+            s->first_ns = rec->arrival_ns;
+        s->last_ns = rec->arrival_ns;
+    }
+    return 0;
+}
+
+/* write the index next to its segment, via a rename so it is whole or absent */
+static int index_write(const struct store_index *idx, const char *dir)
+{
+    char path[300], tmp[310];
+    FILE *f;
+    unsigned i;
+
+    if (idx->failed) {
+        fprintf(stderr, "store: no index for segment %08u (out of memory), queries scan it\n",
+                idx->hdr.segment);
+        return -1;
+    }
+    seg_path(path, sizeof(path), dir, idx->hdr.segment, "idx");
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        fprintf(stderr, "store: cannot write %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    fwrite(&idx->hdr, sizeof(idx->hdr), 1, f);
+    fwrite(idx->time, sizeof(*idx->time), idx->hdr.entries, f);
+    for (i = 0; i < STORE_MAX_SERIALS; i++)
+        if (idx->serial[i].count)
+            fwrite(&idx->serial[i], sizeof(idx->serial[i]), 1, f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "store: cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* map a segment read only, returns its records or NULL */
+static const struct store_record *seg_map(const char *dir, uint32_t seg, uint64_t *records,
+                                          size_t *len)
+{
+    char path[300];
+    struct stat st;
+    void *map;
+    int fd;
+
+    seg_path(path, sizeof(path), dir, seg, "seg");
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size <= STORE_HEADER_BYTES) {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (memcmp(map, STORE_SEG_MAGIC, 8) != 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *len = st.st_size;
+    /* a torn last record of a crashed segment is left out */
+    *records = (st.st_size - STORE_HEADER_BYTES) / sizeof(struct store_record);
+    return (const struct store_record *)((char *)map + STORE_HEADER_BYTES);
+}
+
+static void seg_unmap(const struct store_record *recs, size_t len)
+{
+    munmap((char *)recs - STORE_HEADER_BYTES, len);
+}
+
+/* whole records in a segment file, by its size */
+static uint64_t seg_records(const char *dir, uint32_t seg)
+{
+    char path[300];
+    struct stat st;
+
+    seg_path(path, sizeof(path), dir, seg, "seg");
+    if (stat(path, &st) < 0 || st.st_size <= STORE_HEADER_BYTES)
+        return 0;
+    return (st.st_size - STORE_HEADER_BYTES) / sizeof(struct store_record);
+}
+
+/* index of a segment from its .idx file, or by scanning the segment */
+static int index_load(struct store_index *idx, const char *dir, uint32_t seg)
+{
+    const struct store_record *recs;
+    struct store_idx_header hdr;
+    struct store_serial s, *p;
+    uint64_t i, records, *time;
+    char path[300];
+    size_t len;
+    FILE *f;
+
+    if (index_init(idx, seg) != 0) {
+        index_free(idx);
+        return -1;
+    }
+    seg_path(path, sizeof(path), dir, seg, "idx");
+    f = fopen(path, "r");
+    if (f) {
+        records = seg_records(dir, seg);
+        /* an index claiming more than its segment holds is corrupt, scan instead */
+        if (fread(&hdr, sizeof(hdr), 1, f) == 1 && memcmp(hdr.magic, IDX_MAGIC, 8) == 0 &&
+            hdr.records <= records &&
+            hdr.entries <= (records + STORE_INDEX_EVERY - 1) / STORE_INDEX_EVERY &&
+            (time = realloc(idx->time, (hdr.entries ? hdr.entries : 1) * sizeof(*time)))) {
+            idx->time = time;
+            idx->time_cap = hdr.entries ? hdr.entries : 1;
+            if (fread(idx->time, sizeof(*idx->time), hdr.entries, f) == hdr.entries) {
+                idx->hdr = hdr;
+                idx->hdr.serials = 0;
+                for (i = 0; i < hdr.serials && fread(&s, sizeof(s), 1, f) == 1; i++)
+                    if ((p = index_serial(idx, s.serial, 1)))
+                        *p = s;
+                idx->hdr.serials_full |= hdr.serials_full;
+                fclose(f);
+                return 0;
+            }
+        }
+        fclose(f);
+        index_free(idx);
+        if (index_init(idx, seg) != 0) {
+            index_free(idx);
+            return -1;
+        }
+    }
+
+    recs = seg_map(dir, seg, &records, &len);
+    if (!recs)
+        return 0;       /* empty segment */
+    for (i = 0; i < records; i++)
+        if (index_add(idx, &recs[i]) != 0) {
+            seg_unmap(recs, len);
+            index_free(idx);
+            return -1;
+        }
+    seg_unmap(recs, len);
+    return 0;
+}
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* writer: open the segment a chunk belongs to */
+static int seg_create(struct store *st, uint32_t seg)
+{
+    struct store_seg_header hdr;
+    unsigned char page[STORE_HEADER_BYTES];
+    char path[300];
+
+    seg_path(path, sizeof(path), st->dir, seg, "seg");
+    st->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (st->fd < 0) {
+        fprintf(stderr, "store: cannot create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    memset(page, 0, sizeof(page));
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STORE_SEG_MAGIC, 8);
+    hdr.record_size = sizeof(struct store_record);
+    hdr.segment = seg;
+    hdr.created_ns = real_ns();
+    memcpy(page, &hdr, sizeof(hdr));
+    if (pwrite(st->fd, page, sizeof(page), 0) != sizeof(page)) {
+        fprintf(stderr, "store: cannot write %s\n", path);
+        close(st->fd);
+        st->fd = -1;
+        return -1;
+    }
+    st->fd_segment = seg;
+    st->segments++;
+    return 0;
+}
+
+static void store_sync(struct store *st)
+{
+    uint64_t t0 = mono_ns(), t1;
+
+    if (st->fd < 0 || st->unsynced == 0)
+        return;
+    if (fdatasync(st->fd) < 0)
+        fprintf(stderr, "store: fdatasync failed: %s\n", strerror(errno));
+    t1 = mono_ns();
+    hist_add(&st->sync_time, t1 - t0);
+    hist_add(&st->sync_lat, t1 - st->unsynced_ns);
+    st->busy_ns += t1 - t0;
+    st->syncs++;
+    st->unsynced = 0;
+}
+
+static int sync_wanted(const struct store *st)
+{
+    return st->unsynced &&
+           ((st->cfg.sync_frames && st->unsynced >= st->cfg.sync_frames) ||
+            (st->cfg.sync_ms && mono_ns() - st->unsynced_ns >= st->cfg.sync_ms * 1000000ULL));
+}
+
+/* writer: one pwritev() for n chunks that follow each other in a segment */
+static void write_run(struct store *st, struct store_chunk **c, unsigned n)
+{
+    struct iovec iov[STORE_CHUNKS];
+    uint64_t t0 = mono_ns(), t1, off = c[0]->offset;
+    size_t left = 0, done;
+    unsigned i, first = 0;
+    ssize_t w;
+
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = c[i]->rec;
+        iov[i].iov_len = c[i]->records * sizeof(struct store_record);
+        left += iov[i].iov_len;
+    }
+    while (left > 0) {
+        w = pwritev(st->fd, iov + first, n - first, off);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "store: segment write failed: %s\n", strerror(errno));
+            break;
+        }
+        st->writes++;
+        st->bytes += w;
+        off += w;
+        left -= w;
+        for (done = w; first < n && done >= iov[first].iov_len; first++)
+            done -= iov[first].iov_len;
+        if (first < n) {
+            iov[first].iov_base = (char *)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    t1 = mono_ns();
+    st->busy_ns += t1 - t0;
+    for (i = 0; i < n; i++) {
+        hist_add(&st->write_lat, t1 - c[i]->first_ns);
+        if (st->unsynced == 0)
+            st->unsynced_ns = c[i]->first_ns;
+        st->unsynced += c[i]->records;
+    }
+}
+
+/* writer: a segment is complete, make it durable and index it */
+static void seg_close(struct store *st, struct store_chunk *c)
+{
+    if (st->cfg.sync_frames || st->cfg.sync_ms)
+        store_sync(st);
+    st->unsynced = 0;
+    close(st->fd);
+    st->fd = -1;
+    index_write(&c->index, st->dir);
+    index_free(&c->index);
+}
+
+/* writer: write a batch of chunks in queue order */
+static void write_chunks(struct store *st, struct store_chunk *list)
+{
+    struct store_chunk *run[STORE_CHUNKS], *c;
+    unsigned n = 0;
+
+    for (c = list; c; c = c->next) {
+        /* extend the run while the chunks are back to back */
+        if (n && (run[n - 1]->segment != c->segment ||
+                  run[n - 1]->offset + run[n - 1]->records * sizeof(struct store_record) != c->offset)) {
+            write_run(st, run, n);
+            n = 0;
+        }
+        if (c->segment != st->fd_segment || st->fd < 0) {
+            if (st->fd >= 0)
+                close(st->fd);
+            if (seg_create(st, c->segment) != 0) {
+                if (c->seg_end)
+                    index_free(&c->index);
+                continue;
+            }
+        }
+        run[n++] = c;
+        if (c->seg_end) {
+            write_run(st, run, n);
+            n = 0;
+            seg_close(st, c);
+        }
+    }
+    if (n)
+        write_run(st, run, n);
+    if (sync_wanted(st))
+        store_sync(st);
+}
+
+/* under lock: queue the chunk being filled */
+static void queue_cur(struct store *st)
+{
+    st->cur->next = NULL;
+    *st->queue_tail = st->cur;
+    st->queue_tail = &st->cur->next;
+    st->cur = NULL;
+    pthread_cond_signal(&st->wake);
+}
+
+static void *store_writer(void *arg)
+{
+    struct store *st = arg;
+    struct store_chunk *list, *c, *last;
+    uint64_t now, due;
+    struct timespec ts;
+    int stop;
+
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        /* sleep until chunks are queued, or the partial chunk or a sync is due */
+        while (!st->queue && !st->stop) {
+            now = mono_ns();
+            due = now + 1000000000ULL;
+            if (st->cur && st->cur->records) {
+                if (now - st->cur->first_ns >= st->cfg.flush_ms * 1000000ULL) {
+                    queue_cur(st);
+                    break;
+                }
+                due = st->cur->first_ns + st->cfg.flush_ms * 1000000ULL;
+            }
+            if (st->unsynced && st->cfg.sync_ms &&
+                st->unsynced_ns + st->cfg.sync_ms * 1000000ULL < due) {
+                due = st->unsynced_ns + st->cfg.sync_ms * 1000000ULL;
+                if (due <= now)
+                    break;
+            }
+            clock_gettime(CLOCK_REALTIME, &ts);
+            due -= now;
+            ts.tv_sec += due / 1000000000ULL;
+            ts.tv_nsec += due % 1000000000ULL;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&st->wake, &st->lock, &ts);
+        }
+        stop = st->stop;
+        if (stop && st->cur && st->cur->records)
+            queue_cur(st);
+        list = st->queue;
+        st->queue = NULL;
+        st->queue_tail = &st->queue;
+        pthread_mutex_unlock(&st->lock);
+
+        if (list)
+            write_chunks(st, list);
+        else if (sync_wanted(st))
+            store_sync(st);
+
+        pthread_mutex_lock(&st->lock);
+        for (c = list; c; c = last) {
+            last = c->next;
+            c->next = st->free;
+            st->free = c;
+        }
+        if (stop && !st->queue)
+            break;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+int store_open(struct store *st, const struct store_config *cfg)
+{
+    struct store_chunk *c;
+    struct store_index idx;
+    uint32_t *segs = NULL;
+    char path[300];
+    int n, i;
+
+    memset(st, 0, sizeof(*st));
+    st->cfg = *cfg;
+    snprintf(st->dir, sizeof(st->dir), "%s", cfg->dir);
+    st->cfg.dir = st->dir;
+    st->segment_bytes = (uint64_t)(cfg->segment_mb ? cfg->segment_mb : STORE_DEFAULT_SEGMENT_MB) << 20;
+    st->fd = -1;
+    st->queue_tail = &st->queue;
+    hist_init(&st->write_lat);
+    hist_init(&st->sync_lat);
+    hist_init(&st->sync_time);
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->wake, NULL);
+    if (mkdir(st->dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "store: cannot create %s: %s\n", st->dir, strerror(errno));
+        return -1;
+    }
+    n = list_segments(st->dir, &segs);
+    if (n < 0) {
+        fprintf(stderr, "store: cannot read %s: %s\n", st->dir, strerror(errno));
+        return -1;
+    }
+    if (n > 0) {
+        /* the last run may have died before indexing its segment */
+        seg_path(path, sizeof(path), st->dir, segs[n - 1], "idx");
+        if (access(path, F_OK) != 0 && index_load(&idx, st->dir, segs[n - 1]) == 0) {
+            index_write(&idx, st->dir);
+            index_free(&idx);
+        }
+        st->segment = segs[n - 1] + 1;
+    }
+    free(segs);
+
+    for (i = 0; i < STORE_CHUNKS; i++) {
+        c = malloc(sizeof(*c));
+        if (!c)
+            return -1;
+        c->next = st->free;
+        st->free = c;
+    }
+    if (index_init(&st->index, st->segment) != 0)
+        return -1;
+    st->start_ns = mono_ns();
+    if (pthread_create(&st->thread, NULL, store_writer, st) != 0) {
+        perror("could not create store writer");
+        return -1;
+    }
+    return 0;
+}
+
+void store_close(struct store *st)
+{
+    struct store_chunk *c;
+
+    pthread_mutex_lock(&st->lock);
+    /* the open segment ends here, its index travels with the last chunk */
+    if (st->records) {
+        if (!st->cur && st->free) {
+            st->cur = st->free;
+            st->free = st->cur->next;
+            st->cur->segment = st->segment;
+            st->cur->offset = STORE_HEADER_BYTES + st->records * sizeof(struct store_record);
+            st->cur->records = 0;
+            st->cur->first_ns = mono_ns();
+        }
+        if (st->cur) {
+            st->cur->seg_end = 1;
+            st->cur->index = st->index;
+            st->index.time = NULL;
+            st->index.serial = NULL;
+            queue_cur(st);
+        }
+    }
+    st->stop = 1;
+    pthread_cond_signal(&st->wake);
+    pthread_mutex_unlock(&st->lock);
+    pthread_join(st->thread, NULL);
+    st->start_ns = mono_ns() - st->start_ns;
+
+    if (st->fd >= 0) {
+        if (st->cfg.sync_frames || st->cfg.sync_ms)
+            store_sync(st);
+        close(st->fd);
+    }
+    index_free(&st->index);
+    while ((c = st->free)) {
+        st->free = c->next;
+        free(c);
+    }
+}
+
+void store_append(struct store *st, const unsigned char *frames, unsigned n,
+                  size_t stride)
+{
+    struct store_record *rec;
+    struct store_chunk *c;
+    uint64_t now, mono = 0;
+    unsigned i;
+    int seg_full;
+
+    pthread_mutex_lock(&st->lock);
+    now = real_ns();
+    /* keep the segment sorted even if the clock is stepped back */
+    if (now < st->last_ns)
+        now = st->last_ns;
+    st->last_ns = now;
+    for (i = 0; i < n; i++) {
+        c = st->cur;
+        if (!c) {
+            if (!st->free) {
+                /* every chunk is waiting for the disk */
+                st->dropped += n - i;
+                break;
+            }
+            c = st->cur = st->free;
+            st->free = c->next;
+            c->segment = st->segment;
+            c->offset = STORE_HEADER_BYTES + st->records * sizeof(struct store_record);
+            c->records = 0;
+            c->seg_end = 0;
+            c->first_ns = mono ? mono : (mono = mono_ns());
+            /* the writer arms its flush_ms timer for this chunk */
+            pthread_cond_signal(&st->wake);
+        }
+        rec = &c->rec[c->records++];
+        rec->arrival_ns = now;
+        rec->serial = wire_frame_serial(frames + i * stride);
+        rec->reserved = 0;
+        memcpy(rec->frame, frames + i * stride, STORE_FRAME_BYTES);
+        index_add(&st->index, rec);
+        st->records++;
+        st->appended++;
+
+        seg_full = STORE_HEADER_BYTES + st->records * sizeof(struct store_record) >=
+                   st->segment_bytes;
+        if (seg_full) {
+            /* hand the index over with the last chunk, start the next segment */
+            c->seg_end = 1;
+            c->index = st->index;
+            st->segment++;
+            st->records = 0;
+            index_init(&st->index, st->segment);
+        }
+        if (seg_full || c->records == STORE_CHUNK_RECORDS)
+            queue_cur(st);
+    }
+    pthread_mutex_unlock(&st->lock);
+}
+
+void store_print_stats(struct store *st, FILE *f)
+{
+    double secs = st->start_ns / 1e9, busy = st->busy_ns / 1e9;
+
+    fprintf(f, "Store: %s, %lu records in %lu segments, %lu dropped (disk behind)\n",
+            st->dir, st->appended, st->segments, st->dropped);
+    fprintf(f, "Store: %lu writes, %.1f records per write, %lu syncs, "
+            "%.2f MB/s sustained, %.2f MB/s while busy\n",
+            st->writes, st->writes ? (double)st->appended / st->writes : 0, st->syncs,
+            secs > 0 ? st->bytes / secs / 1e6 : 0, busy > 0 ? st->bytes / busy / 1e6 : 0);
+    hist_print(&st->write_lat, f, "Store write latency", 1e6, "ms");
+    hist_print(&st->sync_lat, f, "Store durable latency", 1e6, "ms");
+    hist_print(&st->sync_time, f, "Store fdatasync", 1e6, "ms");
+}
+
+long store_query(const char *dir, uint32_t serial, int all,
+                 uint64_t t1_ns, uint64_t t2_ns,
+                 void (*fn)(const struct store_record *rec, void *arg), void *arg)
+{
+    const struct store_record *recs;
+    const struct store_serial *s;
+    struct store_index idx;
+    uint32_t *segs = NULL;
+    uint64_t records, r;
+    unsigned lo, hi, mid;
+    long found = 0;
+    size_t len;
+    int n, i;
+
+    n = list_segments(dir, &segs);
+    if (n < 0) {
+        fprintf(stderr, "store: cannot read %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (index_load(&idx, dir, segs[i]) != 0)
+            break;
+        /* skip segments, and nodes in them, outside the window */
+        if (idx.hdr.records == 0 || idx.hdr.last_ns < t1_ns || idx.hdr.first_ns > t2_ns)
+            goto next;
+        if (!all && !idx.hdr.serials_full) {
+            s = index_serial(&idx, serial, 0);
+            if (!s || s->last_ns < t1_ns || s->first_ns > t2_ns)
+                goto next;
+        }
+        recs = seg_map(dir, segs[i], &records, &len);
+        if (!recs)
+            goto next;
+
+        /* last index entry before t1, the records from there on are sorted */
+        lo = 0;
+        hi = idx.hdr.entries;
+        while (hi - lo > 1) {
+            mid = (lo + hi) / 2;
+            if (idx.time[mid] < t1_ns)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        for (r = (uint64_t)lo * STORE_INDEX_EVERY; r < records; r++) {
+            if (recs[r].arrival_ns > t2_ns)
+                break;
+            if (recs[r].arrival_ns < t1_ns || (!all && recs[r].serial != serial))
+                continue;
+            fn(&recs[r], arg);
+            found++;
+        }
+        seg_unmap(recs, len);
+next:
+        index_free(&idx);
+    }
+    free(segs);
+    return found;
+}
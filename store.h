@@ -0,0 +1,179 @@
+/*
+ * store.h - append-only segmented frame store of the collector
+ *
+ * Frames are kept as fixed size records in segment files DIR/NNNNNNNN.seg,
+ * each capped at a size and followed by a new one. A record carries the
+ * node serial (taken from the frame, see wire_frame_serial) and
+ * the arrival time next to the frame, and the arrival time never goes
+ * backwards within a store, so records of a segment are sorted by time.
+ *
+ * When a segment is closed its sparse index goes to NNNNNNNN.idx: the
+ * time of every STORE_INDEX_EVERY-th record, plus one entry per node
+ * with its record count and first and last arrival. A query for node X
+ * between t1 and t2 reads the small index files, skips every segment
+ * where X was not seen in that window, and maps only the others, starting
+ * at the index entry just before t1. A segment without index (the one
+ * being written when the collector died) is indexed by a scan.
+ *
+ * Reactors never touch the disk: store_append copies records into a chunk
+ * of STORE_CHUNK_RECORDS under a short lock and queues full chunks for
+ * the writer thread, which owns the segment files. The writer takes
+ * whatever is queued in one go (group commit) and writes it with one
+ * pwritev() per segment; a chunk that is not full is taken once its
+ * oldest record is flush_ms old. Durability is set by sync_frames and
+ * sync_ms: fdatasync() after that many frames or once the oldest
+ * unsynced frame is that old, whichever comes first (0 = never, the page
+ * cache decides). When all STORE_CHUNKS are queued because the disk is
+ * behind, new frames are dropped and counted instead of blocking.
+ */
+
+#ifndef TRAKRAY_STORE_H
+#define TRAKRAY_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hist.h"
+#include "wire.h"
+
+#define STORE_FRAME_BYTES 256
+#define STORE_INDEX_EVERY 256           /* records per sparse index entry */
+#define STORE_MAX_SERIALS 4096          /* nodes tracked per segment index */
+#define STORE_DEFAULT_SEGMENT_MB 64
+#define STORE_HEADER_BYTES 4096
+#define STORE_SEG_MAGIC "TRKSEG01"
+#define STORE_CHUNK_RECORDS 1024        /* 68 pages */
+#define STORE_CHUNKS 32
+#define STORE_DEFAULT_FLUSH_MS 20
+#define STORE_DEFAULT_SYNC_MS 1000
+
+struct store_record {
+    uint64_t arrival_ns;                /* CLOCK_REALTIME, never decreasing */
+    uint32_t serial;
+    uint32_t reserved;
+    unsigned char frame[STORE_FRAME_BYTES];
+};
+
+/* 256 records are exactly 17 pages, so record runs stay page aligned */
+_Static_assert(sizeof(struct store_record) == 272, "store record layout");
+
+struct store_seg_header {
+    char magic[8];                      /* "TRKSEG01" */
+    uint32_t record_size;
+    uint32_t segment;
+    uint64_t created_ns;
+};
+
+struct store_serial {
+    uint32_t serial;
+    uint32_t count;                     /* 0: free slot */
+    uint64_t first_ns, last_ns;
+};
+
+struct store_idx_header {
+    char magic[8];                      /* "TRKIDX01" */
+    uint32_t segment;
+    uint32_t serials_full;              /* serial table overflowed, scan */
+    uint64_t records;
+    uint64_t first_ns, last_ns;
+    uint32_t entries;                   /* uint64_t times follow */
+    uint32_t serials;                   /* then struct store_serial */
+};
+
+/* index of one segment, in memory */
+struct store_index {
+    struct store_idx_header hdr;
+    uint64_t *time;                     /* of records 0, EVERY, 2 * EVERY, ... */
+    unsigned time_cap;
+    struct store_serial *serial;        /* STORE_MAX_SERIALS open addressed slots */
+    int failed;                         /* out of memory, not written, queries scan */
+};
+
+struct store_config {
+    const char *dir;
+    unsigned segment_mb;                /* 0 = STORE_DEFAULT_SEGMENT_MB */
+    unsigned flush_ms;                  /* longest a record waits in a chunk */
+    unsigned sync_frames;               /* fdatasync every that many frames */
+    unsigned sync_ms;                   /* fdatasync when a frame is that old */
+};
+
+/* run of records of one segment on its way to the writer */
+struct store_chunk {
+    struct store_chunk *next;
+    uint32_t segment;
+    uint64_t offset;                    /* in the segment file */
+    unsigned records;
+    uint64_t first_ns;                  /* CLOCK_MONOTONIC, oldest record */
+    int seg_end;                        /* last chunk of its segment */
+    struct store_index index;           /* of that segment, when seg_end */
+    struct store_record rec[STORE_CHUNK_RECORDS];
+};
+
+struct store {
+    struct store_config cfg;
+    char dir[256];
+    uint64_t segment_bytes;
+
+    /* appending side, under lock */
+    pthread_mutex_t lock;               /* appends come from all reactors */
+    pthread_cond_t wake;                /* writer: chunks queued or stopping */
+    uint32_t segment;
+    uint64_t records;                   /* in the current segment */
+    uint64_t last_ns;
+    struct store_index index;
+    struct store_chunk *cur;            /* being filled */
+    struct store_chunk *queue, **queue_tail;
+    struct store_chunk *free;
+    int stop;
+
+    /* writer side */
+    pthread_t thread;
+    int fd;                             /* open segment */
+    uint32_t fd_segment;
+    unsigned long unsynced;             /* frames written since the last sync */
+    uint64_t unsynced_ns;               /* oldest of them, CLOCK_MONOTONIC */
+    struct hist write_lat;              /* record appended to written */
+    struct hist sync_lat;               /* oldest record appended to durable */
+    struct hist sync_time;              /* one fdatasync() */
+
+    /* counters */
+    unsigned long appended;             /* under lock */
+    unsigned long dropped;              /* under lock, disk behind */
+    unsigned long segments;
+    unsigned long writes;               /* pwritev() calls */
+    unsigned long syncs;
+    unsigned long long bytes;
+    uint64_t start_ns, busy_ns;         /* writing or syncing */
+};
+
+/*
+ * open dir (created if needed) and start the writer on a new segment
+ * after the last one
+ */
+int store_open(struct store *st, const struct store_config *cfg);
+
+/* write everything queued, index the last segment and stop the writer */
+void store_close(struct store *st);
+
+/*
+ * append n frames of 256 bytes that arrived now, stride bytes apart (256
+ * for a plain stream, more when a header sits between them), never blocks
+ * on disk
+ */
+void store_append(struct store *st, const unsigned char *frames, unsigned n,
+                  size_t stride);
+
+/* counters and latency histograms, after store_close */
+void store_print_stats(struct store *st, FILE *f);
+
+/*
+ * call fn for every record of node serial (any node when all is set)
+ * that arrived in [t1_ns, t2_ns], in time order per segment and segments
+ * in order; returns the number of records or -1
+ */
+long store_query(const char *dir, uint32_t serial, int all,
+                 uint64_t t1_ns, uint64_t t2_ns,
+                 void (*fn)(const struct store_record *rec, void *arg), void *arg);
+
+#endif
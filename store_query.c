@@ -0,0 +1,93 @@
+/*
+ * store_query.c - read frames back from the collector's frame store
+ *
+ * Compile
+ * gcc -O2 -o store_query store_query.c store.c hist.c -lpthread
+ * ./store_query -d dir [-s serial] [-a from] [-b to] [-l] > frames.bin
+ *
+ * serial is the node serial in hex as in /proc/cpuinfo, from and to are
+ * unix times in seconds (fractions allowed). Without -l the matching
+ * 256 byte frames are written to stdout in the collector's stream format,
+ * with -l one line per frame: arrival time, serial and the first bytes.
+ * The count, and the time taken, goes to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "store.h"
+
+static void print_frame(const struct store_record *rec, void *arg)
+{
+    (void)arg;
+    fwrite(rec->frame, 1, STORE_FRAME_BYTES, stdout);
+}
+
+static void list_frame(const struct store_record *rec, void *arg)
+{
+    int i;
+
+    (void)arg;
+    printf("%llu.%09llu %08x ", (unsigned long long)(rec->arrival_ns / 1000000000ULL),
+           (unsigned long long)(rec->arrival_ns % 1000000000ULL), rec->serial);
+    for (i = 0; i < 16; i++)
+        printf("%02X", rec->frame[i]);
+    printf("\n");
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL;
+    uint64_t t1 = 0, t2 = UINT64_MAX;
+    uint32_t serial = 0;
+    int all = 1, list = 0, opt;
+    double start;
+    long n;
+
+    while ((opt = getopt(argc, argv, "d:s:a:b:l")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 's':
+            serial = (uint32_t)strtoul(optarg, NULL, 16);
+            all = 0;
+            break;
+        case 'a':
+            t1 = (uint64_t)(atof(optarg) * 1e9);
+            break;
+        case 'b':
+            t2 = (uint64_t)(atof(optarg) * 1e9);
+            break;
+        case 'l':
+            list = 1;
+            break;
+        default:
+            dir = NULL;
+            optind = argc;
+            break;
+        }
+    }
+    if (!dir) {
+        fprintf(stderr, "usage: %s -d dir [-s serial] [-a from] [-b to] [-l]\n", argv[0]);
+        return 1;
+    }
+    start = now_sec();
+    n = store_query(dir, serial, all, t1, t2, list ? list_frame : print_frame, NULL);
+    fflush(stdout);
+    if (n < 0)
+        return 1;
+    fprintf(stderr, "%ld frames in %.3f s\n", n, now_sec() - start);
+    return 0;
+}
@@ -1,135 +1,1103 @@
-/*
-    C socket server example, handles multiple clients using threads
-    Compile
-    gcc server.c -lpthread -o server
-*/
- 
-#include<stdio.h>
-#include<string.h>    //strlen
-#include<stdlib.h>    //strlen
-#include<sys/socket.h>
-#include<sys/types.h>
-#include<arpa/inet.h> //inet_addr
-#include<unistd.h>    //write
-#include<pthread.h> //for threading , link with lpthread
- 
-//the thread function
-void *connection_handler(void *);
- 
-int main(int argc , char *argv[])
-{
-    int socket_desc , client_sock , c;
-    struct sockaddr_in server , client;
-     
-    //Create socket
-    socket_desc = socket(AF_INET , SOCK_STREAM , 0);
-    if (socket_desc == -1)
-    {
-        //printf("Could not create socket");
-    }
-    //puts("Socket created");
-     
-    //Prepare the sockaddr_in structure
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = htonl( INADDR_ANY );
-    server.sin_port = htons( 5019 );
-     
-    //Bind
-    if( bind(socket_desc,(struct sockaddr *)&server , sizeof(server)) < 0)
-    {
-        //print the error message
-        perror("bind failed. Error");
-        return 1;
-    }
-    //puts("bind done");
-     
-    //Listen
-    listen(socket_desc , 3);
-     
-    //Accept and incoming connection
-    //puts("Waiting for incoming connections...");
-    c = sizeof(struct sockaddr_in);
-     
-     
-    //Accept and incoming connection
-    //puts("Waiting for incoming connections...");
-    c = sizeof(struct sockaddr_in);
-	pthread_t thread_id;
-	
-    while( (client_sock = accept(socket_desc, (struct sockaddr *)&client, (socklen_t*)&c)) )
-    {
-        //puts("Connection accepted");
-         
-        if( pthread_create( &thread_id , NULL ,  connection_handler , (void*) &client_sock) < 0)
-        {
-            perror("could not create thread");
-            return 1;
-        }
-         
-        //Now join the thread , so that we dont terminate before the thread
-        //pthread_join( thread_id , NULL);
-        //puts("Handler assigned");
-    }
-     
-    if (client_sock < 0)
-    {
-        perror("accept failed");
-        return 1;
-    }
-     
-    return 0;
-}
- 
-/*
- * This will handle connection for each client
- * */
-void *connection_handler(void *socket_desc)
-{
-    //Get the socket descriptor
-    int sock = *(int*)socket_desc;
-    int read_size;
-    char client_message[256];
-    memset(client_message, 0, 256);
-     
-    //Send some messages to the client
-    //message = "Greetings! I am your connection handler\n";
-    //write(sock , message , strlen(message));
-    // 
-    //message = "Now type something and i shall repeat what you type \n";
-    //write(sock , message , strlen(message));
-     
-    //Receive a message from client
-    while( (read_size = recv(sock , client_message , 256 , MSG_WAITALL)) > 0 )
-    {
-	//printf("read_size is %d\n", read_size);
-	//printf("sock is %d\n", sock);
-        //end of string marker
-		//client_message[read_size] = '\0';
-		
-		//Send the message back to client
-        //write(sock , message , strlen(client_message));
-	//puts(client_message);
-	if (read_size == 256) {
-		fwrite(client_message, 1, read_size, stdout);  	
-		//clear the message buffer
-		memset(client_message, 0, 256);
-        } else {
-        	perror("read_size mismatch");
-                exit(1);
-        }
-	//printf("%s", client_message);
-    }
-     
-    if(read_size == 0)
-    {
-        //puts("Client disconnected");
-        fflush(stdout);
-    }
-    else if(read_size == -1)
-    {
-	//puts("I AM HERE2");
-        perror("recv failed");
-    }
-         
-    return 0;
-} 
+/*
+    trakray collector: receives the 256 byte location frames the nodes
+    (b28.c) send and writes them to stdout, or with -d to the segmented
+    frame store (store.h) in that directory, read back with store_query.
+
+    Compile
+    gcc tcp_server.c store.c hist.c wire.c delta.c latest.c query.c pubsub.c clocksync.c -lpthread -o server
+    ./server [-p port] [-t threads] > frames.bin
+    ./server [-p port] [-t threads] -d /var/lib/trakray [-m segment_mb]
+             [-w flush_ms] [-S sync_frames] [-T sync_ms]
+    ./server -u [-g group [-i if_addr]] ...
+    ./server -q /run/trakray.sock ...
+    ./server -P /run/trakray-frames.sock ...
+
+    Each of the threads runs an epoll reactor over non-blocking sockets
+    with its own listening socket bound with SO_REUSEPORT, so the kernel
+    spreads new connections over the reactors and no thread is ever tied
+    to one node. A readable connection is read into its 64 KiB receive
+    buffer in one recv(), and all complete frames are handed on straight
+    from there, so a busy node costs one syscall for up to 256 frames.
+    The bytes of a frame cut by the read are moved to the front of the
+    buffer and completed by the next one. Only whole frames are written;
+    stdout is flushed once per epoll round. The store is written by its
+    own thread, so a slow disk never holds up a reactor.
+
+    The first four bytes of a connection tell its format (wire.h): a
+    version 2 stream puts a header with serial, sequence number,
+    acquisition time and CRC in front of every frame, anything else is
+    the legacy stream of bare frames. A v2 frame with a bad CRC is
+    dropped; a bad header means the stream is out of step and the
+    connection is closed. Only the 256 byte payload is written, so the
+    output is the same for both. The sequence numbers are checked per
+    node serial and tracker (device) in a fixed table: a frame behind the expected one is
+    late (e.g. replayed from the node's spool) and no longer counted
+    missing, unless it is among the last 64 and was seen already, which
+    makes it a duplicate. Counting starts at the first frame of a node,
+    whatever it sent before is not missing; any other run id is a node
+    restart (run ids are random, not ordered), and the frames of the new
+    run before the first one seen are. Frames of the run before it are
+    late. Acquisition to arrival time goes into a latency histogram per
+    reactor.
+
+    Frames a node encodes (b28 -E, delta.h) are decoded here against the
+    last frame of their tracker, kept per connection (per node serial for
+    datagrams); a delta whose base frame never came is dropped until the
+    next keyframe. Plain frames are still handed on from the receive
+    buffer; decoded ones are collected in a per reactor scratch array and
+    handed on from there, in arrival order with the plain ones.
+
+    With -u the collector also takes version 2 datagrams (b28 -U) on the
+    same port, joining multicast group -g on interface -i if given, so
+    several collectors can receive one node. The datagram socket belongs
+    to the first reactor, which reads up to UDP_BATCH datagrams per
+    recvmmsg(); one reader keeps the order the datagrams arrived in.
+    With -q the newest frame of every node tracker, its arrival time and
+    frame rate are kept in a table (latest.h) that the reactors update as
+    frames are handed on and a query thread (query.h) reads for clients of
+    the Unix socket at that path, e.g. latest_query. The table entries are
+    seqlocks, so a query never makes a reactor wait.
+    With -P the collector is also a broker: consumers subscribe on that
+    Unix socket, to every node or some serials, and get the frames in
+    the stdout format (pubsub.h). Every frame is copied once into a
+    shared chunk that all subscribers are sent from; a subscriber that
+    falls behind loses its oldest frames, is closed, or holds up the
+    reactors for a bounded time, as it asked.
+    Frames are stamped with the kernel's receive time (SO_TIMESTAMPING,
+    software): per datagram, and for a TCP stream per read, the time the
+    newest bytes of the read came in. Nodes run with b28 -Y send clock
+    exchange messages (wire.h) among their frames; the reactor answers
+    each on the spot with its receive and send times, and the exchange
+    the node completed goes into the node's clock estimate (clocksync.h),
+    which maps acquisition times onto the collector's clock for the true
+    sensor to collector latency. Offset, drift and latency of every such
+    node are printed with the node counters.
+    SIGINT or SIGTERM stop the collector and print its counters to stderr,
+    with the frames, loss, reordering and duplicates of every node;
+    SIGUSR1 prints the per node counters while it runs.
+*/
+
+#define _GNU_SOURCE     /* accept4 */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "store.h"
+#include "hist.h"
+#include "wire.h"
+#include "delta.h"
+#include "latest.h"
+#include "query.h"
+#include "pubsub.h"
+#include "clocksync.h"
+
+#define PORT 5019
+#define FRAME_BYTES 256
+#define MAX_REACTORS 64
+#define MAX_EVENTS 64
+#define RX_BUF_BYTES 65536
+#define READS_PER_EVENT 4       /* then the other ready connections get a turn */
+#define MAX_NODES 4096          /* node serials tracked for gaps, a power of two */
+#define UDP_BATCH 64            /* datagrams per recvmmsg() */
+#define UDP_RCVBUF (4 << 20)    /* asked for, the kernel caps it at rmem_max */
+#define CONN_TRACKERS 8         /* delta states per connection, a power of two */
+#define DEC_BATCH 64            /* decoded frames handed on together */
+#define RX_CTL_BYTES CMSG_SPACE(sizeof(struct scm_timestamping))
+
+/* the last encoded frame of one tracker, what its next delta refers to */
+struct delta_dec {
+    uint32_t serial;
+    uint16_t device;
+    int used;
+    int valid;
+    uint32_t ctr;               /* its sequence counter */
+    unsigned char frame[WIRE_PAYLOAD];
+};
+
+/* a decoded frame, laid out like a plain one on the wire */
+struct dec_frame {
+    struct wire_hdr h;
+    unsigned char data[WIRE_PAYLOAD];
+};
+
+_Static_assert(sizeof(struct dec_frame) == WIRE_V2_BYTES, "decoded frame layout");
+
+struct conn {
+    int fd;
+    int version;                /* wire format, 0 until the first bytes are in */
+    unsigned fill;              /* bytes in buf, a partial frame after parsing */
+    struct delta_dec dec[CONN_TRACKERS];
+    _Alignas(8) char buf[RX_BUF_BYTES];     /* v2 headers are read in place */
+};
+
+/* where the sequence of one tracker of a node stands */
+struct node_seq {
+    uint32_t serial;
+    uint16_t device;
+    uint32_t run;               /* run id of the newest frame seen */
+    uint32_t prev_run;          /* the run before it, its frames are late */
+    uint32_t next;              /* counter expected next in that run */
+    uint64_t window;            /* bit i: counter next - 1 - i has arrived */
+    int used;
+    unsigned long frames, missing, late, dups, restarts;
+};
+
+/* the datagram socket and its receive buffers, read by reactor 0 only */
+struct udp_rx {
+    int fd;
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    _Alignas(8) char buf[UDP_BATCH][WIRE_DGRAM_MAX_FRAMES * WIRE_V2_BYTES];
+    _Alignas(struct cmsghdr) char ctl[UDP_BATCH][RX_CTL_BYTES];
+    struct delta_dec dec[MAX_NODES];
+};
+
+struct reactor {
+    int id;
+    int listen_fd;
+    int epoll_fd;
+    int listen_paused;          /* out of file descriptors */
+    pthread_t thread;
+
+    /* counters, written by the reactor thread */
+    atomic_ulong accepted;
+    atomic_ulong closed;
+    atomic_ulong frames;
+    atomic_ulong reads;
+    atomic_ulong bytes;
+    atomic_ulong partial;       /* connections that ended inside a frame */
+    atomic_ulong v2_frames;
+    atomic_ulong crc_errors;
+    atomic_ulong bad_headers;   /* v2 streams closed out of step */
+    atomic_ulong datagrams;
+    atomic_ulong bad_dgrams;    /* truncated or not whole frames */
+    atomic_ulong encoded;       /* frames that came encoded */
+    atomic_ulong keyframes;
+    atomic_ulong undecodable;   /* base frame missing or bad encoding */
+    atomic_ulong enc_bytes;     /* their payloads, padding included */
+    atomic_ulong syncs;         /* clock exchange requests */
+    atomic_ulong sync_unanswered;   /* over datagrams or the reply did not fit */
+    atomic_ulong no_rx_time;    /* reads without a kernel timestamp */
+    struct hist latency;        /* acquisition to arrival, ns */
+    struct hist decode;         /* per encoded frame, ns */
+    unsigned ndec;
+    struct dec_frame dec[DEC_BATCH];
+
+    /* the read being handled */
+    uint64_t rx_ns;             /* kernel receive time, CLOCK_REALTIME */
+    int rx_fd;                  /* its connection, -1 for a datagram */
+};
+
+static atomic_int stop;
+static int stop_fd;             /* eventfd, readable once we are stopping */
+static struct store store;
+static int use_store;
+static struct udp_rx *udp;
+static struct latest latest;
+static int use_latest;
+static struct pubsub pubsub;
+static int use_pubsub;
+static struct clocksync clocks;
+
+/* gap detection over all connections, nodes may reconnect anywhere */
+static pthread_mutex_t nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct node_seq nodes[MAX_NODES];
+static unsigned long nodes_seen, nodes_full, seq_missing, seq_late, seq_dups, seq_restarts;
+
+static unsigned long long mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* have the kernel stamp what fd receives */
+static void rx_timestamping(int fd)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+/* the kernel receive time of msg, now when it carries none */
+static uint64_t rx_time(struct reactor *r, struct msghdr *msg)
+{
+    const struct scm_timestamping *ts;
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMPING) {
+            ts = (const struct scm_timestamping *)CMSG_DATA(cm);
+            if (ts->ts[0].tv_sec)
+                return ts->ts[0].tv_sec * 1000000000ULL + ts->ts[0].tv_nsec;
+        }
+    atomic_fetch_add(&r->no_rx_time, 1);
+    return real_ns();
+}
+
+static int listen_socket(int port)
+{
+    struct sockaddr_in server;
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket failed");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_ANY);
+    server.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        perror("bind failed. Error");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void conn_close(struct reactor *r, struct conn *c)
+{
+    if (c->fill) {
+        fprintf(stderr, "connection closed inside a frame, %u bytes dropped\n",
+                c->fill);
+        atomic_fetch_add(&r->partial, 1);
+    }
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+    atomic_fetch_add(&r->closed, 1);
+
+    /* a descriptor is free again */
+    if (r->listen_paused) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, r->listen_fd, &ev);
+        r->listen_paused = 0;
+    }
+}
+
+static void accept_all(struct reactor *r)
+{
+    struct epoll_event ev;
+    struct conn *c;
+    int fd;
+
+    for (;;) {
+        fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                /* stop polling the listener until a connection closes */
+                perror("accept failed");
+                ev.events = 0;
+                ev.data.ptr = NULL;
+                epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, r->listen_fd, &ev);
+                r->listen_paused = 1;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept failed");
+            }
+            return;
+        }
+        c = malloc(sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        rx_timestamping(fd);
+        c->fd = fd;
+        c->version = 0;
+        c->fill = 0;
+        memset(c->dec, 0, sizeof(c->dec));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close(fd);
+            free(c);
+            continue;
+        }
+        atomic_fetch_add(&r->accepted, 1);
+    }
+}
+
+static struct node_seq *node_lookup(uint32_t serial, uint16_t device)
+{
+    unsigned i, h = ((serial ^ device * 0x9e37u) * 2654435761u) & (MAX_NODES - 1);
+
+    for (i = 0; i < MAX_NODES; i++, h = (h + 1) & (MAX_NODES - 1)) {
+        if (!nodes[h].used) {
+            nodes[h].used = 1;
+            nodes[h].serial = serial;
+            nodes[h].device = device;
+            nodes_seen++;
+            return &nodes[h];
+        }
+        if (nodes[h].serial == serial && nodes[h].device == device)
+            return &nodes[h];
+    }
+    return NULL;
+}
+
+/* account for the sequence numbers of n v2 frames, stride bytes apart */
+static void check_seq(const char *p, unsigned n, size_t stride)
+{
+    const struct wire_hdr *h;
+    struct node_seq *ns;
+    uint32_t run, ctr, gap, back;
+    unsigned i;
+
+    pthread_mutex_lock(&nodes_lock);
+    for (i = 0; i < n; i++, p += stride) {
+        h = (const struct wire_hdr *)p;
+        run = wire_seq_run(h->seq);
+        ctr = wire_seq_count(h->seq);
+        ns = node_lookup(h->serial, h->device);
+        if (!ns) {
+            nodes_full++;
+            continue;
+        }
+        ns->frames++;
+        if (ns->run == 0) {
+            /* first frame of the node, which may have been running long
+             * before the collector: what it sent earlier is not missing */
+            ns->run = run;
+            ns->next = ctr + 1;
+            ns->window = 1;
+        } else if (run == ns->prev_run) {
+            seq_late++;         /* straggler or spool replay of the last run */
+            ns->late++;
+        } else if (run != ns->run) {
+            /* it restarted, frames before ctr of the new run have not
+             * come yet */
+            seq_restarts++;
+            ns->restarts++;
+            ns->prev_run = ns->run;
+            ns->run = run;
+            seq_missing += ctr;
+            ns->missing += ctr;
+            ns->next = ctr + 1;
+            ns->window = 1;
+        } else if (ctr >= ns->next) {
+            gap = ctr - ns->next;
+            seq_missing += gap;
+            ns->missing += gap;
+            ns->window = gap >= 63 ? 1 : ns->window << (gap + 1) | 1;
+            ns->next = ctr + 1;
+        } else if ((back = ns->next - 1 - ctr) < 64 && (ns->window >> back & 1)) {
+            seq_dups++;
+            ns->dups++;
+        } else {
+            if (back < 64)
+                ns->window |= 1ULL << back;
+            seq_late++;
+            ns->late++;
+            if (seq_missing)
+                seq_missing--;
+            if (ns->missing)
+                ns->missing--;
+        }
+    }
+    pthread_mutex_unlock(&nodes_lock);
+}
+
+/* loss, reordering and duplicates of every node and tracker seen */
+static void print_nodes(FILE *f)
+{
+    const struct node_seq *ns;
+    unsigned long expected;
+    unsigned i;
+
+    pthread_mutex_lock(&nodes_lock);
+    for (i = 0; i < MAX_NODES; i++) {
+        ns = &nodes[i];
+        if (!ns->used)
+            continue;
+        expected = ns->frames - ns->dups + ns->missing;
+        fprintf(f, "Node %08x/%u: %lu frames, %lu missing (%.3f%% loss), %lu late "
+                "(%.3f%%), %lu duplicates (%.3f%%), %lu restarts\n", ns->serial,
+                ns->device, ns->frames, ns->missing,
+                expected ? 100.0 * ns->missing / expected : 0, ns->late,
+                ns->frames ? 100.0 * ns->late / ns->frames : 0, ns->dups,
+                ns->frames ? 100.0 * ns->dups / ns->frames : 0, ns->restarts);
+    }
+    pthread_mutex_unlock(&nodes_lock);
+}
+
+/* hand on n payloads stride bytes apart */
+static void emit_frames(const char *p, unsigned n, size_t stride)
+{
+    unsigned i;
+
+    if (use_store)
+        store_append(&store, (const unsigned char *)p, n, stride);
+    else if (stride == FRAME_BYTES)
+        fwrite(p, FRAME_BYTES, n, stdout);
+    else
+        for (i = 0; i < n; i++)
+            fwrite(p + i * stride, FRAME_BYTES, 1, stdout);
+    if (use_pubsub)
+        pubsub_publish(&pubsub, (const unsigned char *)p, n, stride);
+}
+
+/* keep the newest of n frames per node for queries, stride bytes apart */
+static void track_latest(const char *p, unsigned n, size_t stride, int version, uint64_t now)
+{
+    const struct wire_hdr *h;
+    const unsigned char *f;
+    unsigned i;
+
+    for (i = 0; i < n; i++, p += stride) {
+        if (version != WIRE_VERSION) {
+            f = (const unsigned char *)p;
+            latest_update(&latest, wire_frame_serial(f), 0, 0, 0, now, f);
+            continue;
+        }
+        h = (const struct wire_hdr *)p;
+        f = (const unsigned char *)(h + 1);
+        latest_update(&latest, wire_frame_serial(f), h->device, h->seq, h->real_ns, now, f);
+    }
+}
+
+/* account for and hand on n good v2 frames in a row, received at now */
+static void pass_v2(const char *p, unsigned n, uint64_t now)
+{
+    check_seq(p, n, WIRE_V2_BYTES);
+    clocksync_frames(&clocks, p, n, WIRE_V2_BYTES, now);
+    emit_frames(p + sizeof(struct wire_hdr), n, WIRE_V2_BYTES);
+    if (use_latest)
+        track_latest(p, n, WIRE_V2_BYTES, WIRE_VERSION, now);
+}
+
+/*
+ * n complete frames of the wire version that arrived, still in the
+ * receive buffer, returns -1 when the stream is out of step
+ */
+static int handle_frames(struct reactor *r, int version, const char *p, unsigned n)
+{
+    const struct wire_hdr *h;
+    uint64_t now = r->rx_ns;
+    unsigned i, run = 0, good = 0;
+    int ret = 0;
+
+    if (version != WIRE_VERSION) {
+        emit_frames(p, n, FRAME_BYTES);
+        if (use_latest)
+            track_latest(p, n, FRAME_BYTES, version, now);
+        atomic_fetch_add(&r->frames, n);
+        return 0;
+    }
+
+    /* pass runs of good frames on in one go, skip the corrupted ones */
+    for (i = 0; i < n; i++) {
+        h = (const struct wire_hdr *)(p + i * WIRE_V2_BYTES);
+        if (!wire_hdr_ok(h)) {
+            atomic_fetch_add(&r->bad_headers, 1);
+            ret = -1;
+            break;
+        }
+        if (wire_crc32c(h + 1, WIRE_PAYLOAD) != h->crc) {
+            atomic_fetch_add(&r->crc_errors, 1);
+            if (i > run)
+                pass_v2(p + run * WIRE_V2_BYTES, i - run, now);
+            run = i + 1;
+            continue;
+        }
+        hist_add(&r->latency, now > h->real_ns ? now - h->real_ns : 0);
+        good++;
+    }
+    if (i > run)
+        pass_v2(p + run * WIRE_V2_BYTES, i - run, now);
+    atomic_fetch_add(&r->frames, good);
+    atomic_fetch_add(&r->v2_frames, good);
+    return ret;
+}
+
+static struct delta_dec *dec_lookup(struct delta_dec *tab, unsigned size, uint32_t serial,
+                                    uint16_t device)
+{
+    unsigned i, h = ((serial ^ device * 0x9e37u) * 2654435761u) & (size - 1);
+
+    for (i = 0; i < size; i++, h = (h + 1) & (size - 1)) {
+        if (!tab[h].used) {
+            tab[h].used = 1;
+            tab[h].valid = 0;
+            tab[h].serial = serial;
+            tab[h].device = device;
+            return &tab[h];
+        }
+        if (tab[h].serial == serial && tab[h].device == device)
+            return &tab[h];
+    }
+    return NULL;
+}
+
+/* hand on the frames decoded so far */
+static void flush_decoded(struct reactor *r)
+{
+    if (r->ndec)
+        handle_frames(r, WIRE_VERSION, (const char *)r->dec, r->ndec);
+    r->ndec = 0;
+}
+
+/* decode the encoded frame behind h into the next scratch frame */
+static void decode_frame(struct reactor *r, struct delta_dec *tab, unsigned size,
+                         const struct wire_hdr *h)
+{
+    struct delta_dec *d = dec_lookup(tab, size, h->serial, h->device);
+    struct dec_frame *out = &r->dec[r->ndec];
+    int key = h->flags == WIRE_F_KEY;
+    unsigned long long t;
+
+    atomic_fetch_add(&r->encoded, 1);
+    atomic_fetch_add(&r->enc_bytes, wire_frame_len(h) - sizeof(*h));
+    if (key)
+        atomic_fetch_add(&r->keyframes, 1);
+    if (!d || (!key && (!d->valid || d->ctr != h->reserved))) {
+        /* its base frame never came, wait for the next keyframe */
+        atomic_fetch_add(&r->undecodable, 1);
+        return;
+    }
+    t = mono_ns();
+    if (delta_decode((const unsigned char *)(h + 1), h->payload_len,
+                     key ? NULL : d->frame, out->data) != 0) {
+        d->valid = 0;
+        atomic_fetch_add(&r->undecodable, 1);
+        return;
+    }
+    hist_add(&r->decode, mono_ns() - t);
+    /* a wrong reconstruction fails the CRC in handle_frames, and so do
+     * the deltas on top of it until the next keyframe */
+    memcpy(d->frame, out->data, WIRE_PAYLOAD);
+    d->ctr = wire_seq_count(h->seq);
+    d->valid = 1;
+    out->h = *h;
+    out->h.payload_len = WIRE_PAYLOAD;
+    out->h.flags = 0;
+    out->h.reserved = 0;
+    if (++r->ndec == DEC_BATCH)
+        flush_decoded(r);
+}
+
+/*
+ * a clock exchange request: the exchange the node completed goes into its
+ * estimate, the reply with our receive and send times goes out at once
+ */
+static void handle_sync(struct reactor *r, const struct wire_hdr *h)
+{
+    const struct wire_sync *s = (const struct wire_sync *)(h + 1);
+    struct {
+        struct wire_hdr h;
+        struct wire_sync s;
+    } reply;
+
+    atomic_fetch_add(&r->syncs, 1);
+    if (wire_crc32c(s, sizeof(*s)) != h->crc) {
+        atomic_fetch_add(&r->crc_errors, 1);
+        return;
+    }
+    clocksync_exchange(&clocks, h->serial, s);
+    /* the collector's send buffer towards a node is otherwise empty, so
+     * the reply goes whole or not at all */
+    if (r->rx_fd < 0) {
+        atomic_fetch_add(&r->sync_unanswered, 1);
+        return;
+    }
+    memset(&reply.s, 0, sizeof(reply.s));
+    reply.s.t1 = h->real_ns;
+    reply.s.t2 = r->rx_ns;
+    reply.s.t3 = real_ns();
+    wire_fill_sync(&reply.h, h->serial, 0, reply.s.t3, &reply.s);
+    if (send(r->rx_fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(reply))
+        atomic_fetch_add(&r->sync_unanswered, 1);
+}
+
+/*
+ * pass on the complete v2 frames in the len bytes at p in arrival order,
+ * runs of plain frames in place and encoded ones once decoded against the
+ * delta states in tab; returns the bytes used, -1 when the stream is out
+ * of step
+ */
+static long handle_v2(struct reactor *r, struct delta_dec *tab, unsigned size,
+                      const char *p, size_t len)
+{
+    const struct wire_hdr *h;
+    const char *run = NULL;
+    unsigned nrun = 0;
+    size_t off = 0, flen;
+    long ret;
+
+    for (;;) {
+        ret = off;
+        if (len - off < sizeof(*h))
+            break;
+        h = (const struct wire_hdr *)(p + off);
+        if (!wire_hdr_ok(h)) {
+            atomic_fetch_add(&r->bad_headers, 1);
+            ret = -1;
+            break;
+        }
+        flen = wire_frame_len(h);
+        if (len - off < flen)
+            break;
+        if (h->flags == 0) {
+            flush_decoded(r);
+            if (!nrun++)
+                run = (const char *)h;
+        } else if (h->flags == WIRE_F_SYNC) {
+            if (nrun)
+                handle_frames(r, WIRE_VERSION, run, nrun);
+            nrun = 0;
+            flush_decoded(r);
+            handle_sync(r, h);
+        } else {
+            if (nrun)
+                handle_frames(r, WIRE_VERSION, run, nrun);
+            nrun = 0;
+            decode_frame(r, tab, size, h);
+        }
+        off += flen;
+    }
+    if (nrun)
+        handle_frames(r, WIRE_VERSION, run, nrun);
+    flush_decoded(r);
+    return ret;
+}
+
+/* read what the connection has, returns -1 once it is closed */
+static int conn_read(struct reactor *r, struct conn *c)
+{
+    _Alignas(struct cmsghdr) char ctl[RX_CTL_BYTES];
+    struct msghdr msg;
+    struct iovec iov;
+    unsigned frames;
+    long used;
+    size_t room;
+    ssize_t n;
+    int i;
+
+    for (i = 0; i < READS_PER_EVENT; i++) {
+        room = RX_BUF_BYTES - c->fill;
+        iov.iov_base = c->buf + c->fill;
+        iov.iov_len = room;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        n = recvmsg(c->fd, &msg, 0);
+        if (n > 0) {
+            r->rx_ns = rx_time(r, &msg);
+            r->rx_fd = c->fd;
+            atomic_fetch_add(&r->reads, 1);
+            atomic_fetch_add(&r->bytes, n);
+            c->fill += n;
+            if (!c->version) {
+                if (c->fill < sizeof(uint32_t))
+                    continue;
+                c->version = *(uint32_t *)c->buf == WIRE_MAGIC ? WIRE_VERSION : 1;
+            }
+            if (c->version == WIRE_VERSION) {
+                used = handle_v2(r, c->dec, CONN_TRACKERS, c->buf, c->fill);
+                if (used < 0) {
+                    fprintf(stderr, "bad frame header, closing the connection\n");
+                    c->fill = 0;
+                    break;
+                }
+            } else {
+                frames = c->fill / FRAME_BYTES;
+                used = frames * FRAME_BYTES;
+                if (frames)
+                    handle_frames(r, c->version, c->buf, frames);
+            }
+            /* carry the start of the next frame over, less than a frame */
+            if (used && (unsigned)used < c->fill)
+                memmove(c->buf, c->buf + used, c->fill - used);
+            c->fill -= used;
+            /* a short read drained the socket, epoll tells us about more */
+            if ((size_t)n < room)
+                return 0;
+            continue;
+        }
+        if (n == 0)
+            break;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        perror("recv failed");
+        break;
+    }
+    if (i == READS_PER_EVENT)
+        return 0;       /* more to read, level triggered epoll comes back */
+    conn_close(r, c);
+    return -1;
+}
+
+/* read what datagrams are queued, each one holds whole v2 frames */
+static void udp_read(struct reactor *r, struct udp_rx *u)
+{
+    unsigned len;
+    long used;
+    int i, n, rounds;
+
+    r->rx_fd = -1;
+    for (rounds = 0; rounds < READS_PER_EVENT; rounds++) {
+        for (i = 0; i < UDP_BATCH; i++)
+            u->msgs[i].msg_hdr.msg_controllen = RX_CTL_BYTES;
+        n = recvmmsg(u->fd, u->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("recvmmsg failed");
+            return;
+        }
+        atomic_fetch_add(&r->reads, 1);
+        atomic_fetch_add(&r->datagrams, n);
+        for (i = 0; i < n; i++) {
+            len = u->msgs[i].msg_len;
+            atomic_fetch_add(&r->bytes, len);
+            if ((u->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || len == 0) {
+                atomic_fetch_add(&r->bad_dgrams, 1);
+                continue;
+            }
+            r->rx_ns = rx_time(r, &u->msgs[i].msg_hdr);
+            /* a bad header only costs the rest of its datagram */
+            used = handle_v2(r, u->dec, MAX_NODES, u->buf[i], len);
+            if (used >= 0 && (unsigned)used != len)
+                atomic_fetch_add(&r->bad_dgrams, 1);
+        }
+        if (n < UDP_BATCH)
+            return;
+    }
+}
+
+static void *reactor_thread(void *arg)
+{
+    struct reactor *r = arg;
+    struct epoll_event events[MAX_EVENTS];
+    int i, n;
+
+    while (!atomic_load(&stop)) {
+        n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_all(r);
+            else if (events[i].data.ptr == udp)
+                udp_read(r, udp);
+            else if (events[i].data.ptr != &stop_fd)
+                conn_read(r, events[i].data.ptr);
+        }
+        if (!use_store)
+            fflush(stdout);
+    }
+    return NULL;
+}
+
+/* the datagram socket, in multicast group when one is given */
+static struct udp_rx *udp_open(int port, const char *group, const char *ifaddr)
+{
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    struct udp_rx *u;
+    int i, one = 1, rcvbuf = UDP_RCVBUF;
+
+    u = calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+    u->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (u->fd < 0) {
+        perror("socket failed");
+        free(u);
+        return NULL;
+    }
+    /* more collectors of one host can join the same group */
+    setsockopt(u->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(u->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(u->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("udp bind failed");
+        goto fail;
+    }
+    if (group) {
+        memset(&mreq, 0, sizeof(mreq));
+        if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 ||
+            (ifaddr && inet_pton(AF_INET, ifaddr, &mreq.imr_interface) != 1)) {
+            fprintf(stderr, "bad multicast group or interface address\n");
+            goto fail;
+        }
+        if (!ifaddr)
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(u->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            perror("cannot join the multicast group");
+            goto fail;
+        }
+    }
+    for (i = 0; i < UDP_BATCH; i++) {
+        u->iov[i].iov_base = u->buf[i];
+        u->iov[i].iov_len = sizeof(u->buf[i]);
+        u->msgs[i].msg_hdr.msg_iov = &u->iov[i];
+        u->msgs[i].msg_hdr.msg_iovlen = 1;
+        u->msgs[i].msg_hdr.msg_control = u->ctl[i];
+    }
+    rx_timestamping(u->fd);
+    return u;
+
+fail:
+    close(u->fd);
+    free(u);
+    return NULL;
+}
+
+static int reactor_init(struct reactor *r, int id, int port)
+{
+    struct epoll_event ev;
+
+    memset(r, 0, sizeof(*r));
+    r->id = id;
+    hist_init(&r->latency);
+    hist_init(&r->decode);
+    r->listen_fd = listen_socket(port);
+    if (r->listen_fd < 0)
+        return -1;
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->listen_fd, &ev);
+    ev.data.ptr = &stop_fd;
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+    if (udp && id == 0) {
+        ev.data.ptr = udp;
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, udp->fd, &ev);
+    }
+    return 0;
+}
+
+int main(int argc , char *argv[])
+{
+    static struct reactor reactors[MAX_REACTORS];
+    unsigned long accepted = 0, closed = 0, frames = 0, reads = 0, bytes = 0, partial = 0;
+    unsigned long v2_frames = 0, crc_errors = 0, bad_headers = 0, datagrams = 0, bad_dgrams = 0;
+    unsigned long encoded = 0, keyframes = 0, undecodable = 0, enc_bytes = 0;
+    unsigned long syncs = 0, sync_unanswered = 0, no_rx_time = 0;
+    static struct hist latency, decode;
+    int port = PORT, threads = 1, use_udp = 0, opt, sig, i;
+    const char *group = NULL, *ifaddr = NULL, *query_path = NULL, *pubsub_path = NULL;
+    static struct query query;
+    struct store_config scfg = { NULL, 0, STORE_DEFAULT_FLUSH_MS, 0, STORE_DEFAULT_SYNC_MS };
+    sigset_t sigs;
+    uint64_t one = 1;
+
+    while ((opt = getopt(argc, argv, "p:t:d:m:w:S:T:ug:i:q:P:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'd':
+            scfg.dir = optarg;
+            break;
+        case 'm':
+            scfg.segment_mb = atoi(optarg);
+            break;
+        case 'w':
+            scfg.flush_ms = atoi(optarg);
+            break;
+        case 'S':
+            scfg.sync_frames = atoi(optarg);
+            break;
+        case 'T':
+            scfg.sync_ms = atoi(optarg);
+            break;
+        case 'u':
+            use_udp = 1;
+            break;
+        case 'g':
+            group = optarg;
+            use_udp = 1;
+            break;
+        case 'i':
+            ifaddr = optarg;
+            break;
+        case 'q':
+            query_path = optarg;
+            break;
+        case 'P':
+            pubsub_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-t threads] [-d store_dir [-m segment_mb] "
+                    "[-w flush_ms] [-S sync_frames] [-T sync_ms]] [-u] [-g group [-i if_addr]] "
+                    "[-q query_socket] [-P pubsub_socket]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    hist_init(&latency);
+    hist_init(&decode);
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_REACTORS)
+        threads = MAX_REACTORS;
+
+    /* signals are taken by sigwait below, the reactors never see them */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (scfg.dir) {
+        if (store_open(&store, &scfg) != 0)
+            return 1;
+        use_store = 1;
+    }
+
+    if (clocksync_init(&clocks) != 0)
+        return 1;
+    if (use_udp && !(udp = udp_open(port, group, ifaddr)))
+        return 1;
+    if (query_path) {
+        if (latest_init(&latest) != 0 || query_start(&query, query_path, &latest) != 0)
+            return 1;
+        use_latest = 1;
+    }
+    if (pubsub_path) {
+        if (pubsub_start(&pubsub, pubsub_path) != 0)
+            return 1;
+        use_pubsub = 1;
+    }
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    for (i = 0; i < threads; i++) {
+        if (reactor_init(&reactors[i], i, port) != 0)
+            return 1;
+        if (pthread_create(&reactors[i].thread, NULL, reactor_thread, &reactors[i]) != 0) {
+            perror("could not create thread");
+            return 1;
+        }
+    }
+
+    while (sigwait(&sigs, &sig) == 0 && sig == SIGUSR1) {
+        print_nodes(stderr);
+        clocksync_print(&clocks, stderr);
+    }
+    atomic_store(&stop, 1);
+    if (write(stop_fd, &one, sizeof(one)) < 0)
+        perror("write failed");
+    for (i = 0; i < threads; i++) {
+        pthread_join(reactors[i].thread, NULL);
+        accepted += atomic_load(&reactors[i].accepted);
+        closed += atomic_load(&reactors[i].closed);
+        frames += atomic_load(&reactors[i].frames);
+        reads += atomic_load(&reactors[i].reads);
+        bytes += atomic_load(&reactors[i].bytes);
+        partial += atomic_load(&reactors[i].partial);
+        v2_frames += atomic_load(&reactors[i].v2_frames);
+        crc_errors += atomic_load(&reactors[i].crc_errors);
+        bad_headers += atomic_load(&reactors[i].bad_headers);
+        datagrams += atomic_load(&reactors[i].datagrams);
+        bad_dgrams += atomic_load(&reactors[i].bad_dgrams);
+        encoded += atomic_load(&reactors[i].encoded);
+        keyframes += atomic_load(&reactors[i].keyframes);
+        undecodable += atomic_load(&reactors[i].undecodable);
+        enc_bytes += atomic_load(&reactors[i].enc_bytes);
+        syncs += atomic_load(&reactors[i].syncs);
+        sync_unanswered += atomic_load(&reactors[i].sync_unanswered);
+        no_rx_time += atomic_load(&reactors[i].no_rx_time);
+        hist_merge(&latency, &reactors[i].latency);
+        hist_merge(&decode, &reactors[i].decode);
+    }
+    fflush(stdout);
+    if (use_latest)
+        query_stop(&query);
+    if (use_pubsub)
+        pubsub_stop(&pubsub);
+    fprintf(stderr, "Collector: %d reactors, %lu connections accepted, %lu closed, "
+            "%lu frames, %.2f frames (%.0f bytes) per read, %lu cut inside a frame\n",
+            threads, accepted, closed, frames, reads ? (double)frames / reads : 0,
+            reads ? (double)bytes / reads : 0, partial);
+    fprintf(stderr, "Wire: %lu v2 frames, %lu legacy, %lu crc errors, %lu bad headers, "
+            "%lu nodes (%lu frames untracked), %lu missing, %lu late, %lu duplicates, "
+            "%lu restarts\n",
+            v2_frames, frames - v2_frames, crc_errors, bad_headers, nodes_seen,
+            nodes_full, seq_missing, seq_late, seq_dups, seq_restarts);
+    if (udp)
+        fprintf(stderr, "Wire: %lu datagrams, %lu bad\n", datagrams, bad_dgrams);
+    if (encoded) {
+        fprintf(stderr, "Delta: %lu encoded frames, %lu keyframes, %lu undecodable, "
+                "%.1f payload bytes per frame, %.2fx smaller\n", encoded, keyframes,
+                undecodable, (double)enc_bytes / encoded,
+                (double)encoded * FRAME_BYTES / enc_bytes);
+        hist_print(&decode, stderr, "Delta: decode", 1e3, "us");
+    }
+    print_nodes(stderr);
+    if (v2_frames)
+        hist_print(&latency, stderr, "Wire: acquisition to arrival", 1e6, "ms");
+    if (no_rx_time)
+        fprintf(stderr, "Wire: %lu reads without a kernel receive time\n", no_rx_time);
+    if (syncs) {
+        fprintf(stderr, "Clock: %lu exchanges, %lu unanswered\n", syncs, sync_unanswered);
+        clocksync_print(&clocks, stderr);
+    }
+    clocksync_free(&clocks);
+    if (use_latest) {
+        query_print_stats(&query, stderr);
+        latest_free(&latest);
+    }
+    if (use_pubsub)
+        pubsub_print_stats(&pubsub, stderr);
+    if (use_store) {
+        store_close(&store);
+        store_print_stats(&store, stderr);
+    }
+    return 0;
+}
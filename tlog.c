@@ -0,0 +1,220 @@
+/*
+ * tlog.c - asynchronous binary logger, see tlog.h
+ *
+ * The ring is a bounded multi producer / single consumer queue: each
+ * record carries a sequence number that tells whether it is free for the
+ * lap of the producer that claimed it or holds a record for the consumer.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "tlog.h"
+
+#define TLOG_POLL_MS 10
+#define TLOG_LINE 512
+
+struct tlog_rec {
+    atomic_ulong seq;
+    const struct tlog_site *site;
+    uint64_t arg[TLOG_MAX_ARGS];
+};
+
+static struct tlog_rec ring[TLOG_RING_RECORDS];
+static _Alignas(64) atomic_ulong head;  /* next record a producer claims */
+static _Alignas(64) unsigned long tail; /* next record the thread formats */
+static atomic_ulong written, dropped;
+static atomic_int running;              /* else records are written at once */
+static atomic_int stopping;
+static enum tlog_mode mode = TLOG_SYNC;
+static pthread_t thread;
+
+/* format one argument for the conversion spec[0..len), as printf would */
+static int format_arg(char *out, size_t room, const char *spec, size_t len, uint64_t v)
+{
+    char f[32];
+    char conv = spec[len - 1];
+    int longs = 0;
+    size_t i;
+
+    if (len >= sizeof(f))
+        return 0;
+    memcpy(f, spec, len);
+    f[len] = '\0';
+    for (i = 1; i < len - 1; i++)
+        if (spec[i] == 'l' || spec[i] == 'z' || spec[i] == 'j' || spec[i] == 't')
+            longs = spec[i] == 'l' ? longs + 1 : 2;
+
+    switch (conv) {
+    case 'd': case 'i':
+        if (longs >= 2)
+            return snprintf(out, room, f, (long long)v);
+        if (longs == 1)
+            return snprintf(out, room, f, (long)v);
+        return snprintf(out, room, f, (int)v);
+    case 'u': case 'x': case 'X': case 'o':
+        if (longs >= 2)
+            return snprintf(out, room, f, (unsigned long long)v);
+        if (longs == 1)
+            return snprintf(out, room, f, (unsigned long)v);
+        return snprintf(out, room, f, (unsigned)v);
+    case 'c':
+        return snprintf(out, room, f, (int)v);
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+        union { uint64_t u; double d; } x = { v };
+
+        return snprintf(out, room, f, x.d);
+    }
+    case 's':
+        return snprintf(out, room, f, (const char *)(uintptr_t)v);
+    case 'p':
+        return snprintf(out, room, f, (void *)(uintptr_t)v);
+    }
+    return 0;
+}
+
+/* printf of site->fmt with the captured arguments into out */
+static void format_rec(char *out, size_t room, const struct tlog_site *site,
+                       const uint64_t *arg)
+{
+    const char *p = site->fmt, *spec;
+    unsigned next = 0;
+    size_t n = 0;
+    int w;
+
+    while (*p && n + 1 < room) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+        spec = p++;
+        while (*p && strchr("-+ #0123456789.hlLqjzt", *p))
+            p++;
+        if (!*p)
+            break;
+        p++;
+        w = next < site->nargs ? format_arg(out + n, room - n, spec, p - spec, arg[next++]) : 0;
+        if (w > 0)
+            n += (size_t)w < room - n ? (size_t)w : room - n - 1;
+    }
+    out[n] = '\0';
+}
+
+static void emit(const struct tlog_site *site, const uint64_t *arg)
+{
+    char line[TLOG_LINE];
+
+    format_rec(line, sizeof(line), site, arg);
+    fputs(line, stdout);
+}
+
+/* format every queued record, returns how many there were */
+static unsigned drain(void)
+{
+    struct tlog_rec *r;
+    unsigned n = 0;
+
+    for (;;) {
+        r = &ring[tail & (TLOG_RING_RECORDS - 1)];
+        if (atomic_load_explicit(&r->seq, memory_order_acquire) != tail + 1)
+            break;
+        emit(r->site, r->arg);
+        /* free for the producer one lap further on */
+        atomic_store_explicit(&r->seq, tail + TLOG_RING_RECORDS, memory_order_release);
+        tail++;
+        n++;
+    }
+    if (n)
+        fflush(stdout);
+    return n;
+}
+
+static void *tlog_thread(void *arg)
+{
+    struct timespec ts = { 0, TLOG_POLL_MS * 1000000L };
+
+    (void)arg;
+    while (!atomic_load(&stopping)) {
+        if (drain() == 0)
+            nanosleep(&ts, NULL);
+    }
+    drain();
+    return NULL;
+}
+
+int tlog_start(enum tlog_mode m)
+{
+    unsigned long i;
+
+    mode = m;
+    if (mode == TLOG_SYNC)
+        return 0;
+    for (i = 0; i < TLOG_RING_RECORDS; i++)
+        atomic_init(&ring[i].seq, i);
+    if (pthread_create(&thread, NULL, tlog_thread, NULL) != 0) {
+        perror("could not create log thread");
+        mode = TLOG_SYNC;
+        return -1;
+    }
+    atomic_store(&running, 1);
+    return 0;
+}
+
+void tlog_stop(void)
+{
+    if (atomic_load(&running)) {
+        atomic_store(&running, 0);
+        atomic_store(&stopping, 1);
+        pthread_join(thread, NULL);
+    }
+    fflush(stdout);
+}
+
+void tlog_write(const struct tlog_site *site, const uint64_t *args)
+{
+    unsigned long pos, seq;
+    struct tlog_rec *r;
+    long diff;
+
+    if (!atomic_load_explicit(&running, memory_order_relaxed)) {
+        emit(site, args);
+        atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+        return;
+    }
+    pos = atomic_load_explicit(&head, memory_order_relaxed);
+    for (;;) {
+        r = &ring[pos & (TLOG_RING_RECORDS - 1)];
+        seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        diff = (long)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            /* the thread is a lap behind, the line is lost */
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+    r->site = site;
+    memcpy(r->arg, args, site->nargs * sizeof(*args));
+    atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+    atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+}
+
+void tlog_print_stats(void)
+{
+    printf("Log: %s, %lu records, %lu dropped\n", mode == TLOG_ASYNC ? "async" : "sync",
+           atomic_load(&written), atomic_load(&dropped));
+}
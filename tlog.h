@@ -0,0 +1,102 @@
+/*
+ * tlog.h - asynchronous binary logger of the node
+ *
+ * A log call stores a fixed size binary record in a lock-free ring: a
+ * pointer to its call site (format string and level, a static constant)
+ * and up to TLOG_MAX_ARGS arguments of 8 bytes each. A background thread
+ * formats the records with printf semantics and writes the lines to
+ * stdout, so the acquisition loop never waits on formatting or on the
+ * terminal. When the ring is full records are dropped and counted, never
+ * waited for.
+ *
+ * Levels above TLOG_LEVEL are compiled out, arguments included; build
+ * with -DTLOG_LEVEL=TLOG_LVL_INFO to lose the per frame debug lines.
+ *
+ * Arguments may be integers, doubles and strings. A string is stored as
+ * its pointer and formatted later, so it must stay valid, i.e. be a
+ * literal or otherwise static. %* widths are not supported.
+ *
+ * Before tlog_start(TLOG_ASYNC), after tlog_stop and with TLOG_SYNC every
+ * call is formatted and written at once on the calling thread, the way
+ * the old printf calls were, which is what the asynchronous mode is
+ * benchmarked against.
+ */
+
+#ifndef TRAKRAY_TLOG_H
+#define TRAKRAY_TLOG_H
+
+#include <stdint.h>
+
+#define TLOG_LVL_ERROR 0
+#define TLOG_LVL_WARN 1
+#define TLOG_LVL_INFO 2
+#define TLOG_LVL_DEBUG 3
+
+#ifndef TLOG_LEVEL
+#define TLOG_LEVEL TLOG_LVL_DEBUG
+#endif
+
+#define TLOG_MAX_ARGS 10
+#define TLOG_RING_RECORDS 4096          /* a power of two */
+
+enum tlog_mode { TLOG_ASYNC, TLOG_SYNC };
+
+struct tlog_site {
+    const char *fmt;
+    int level;
+    unsigned nargs;
+};
+
+int tlog_start(enum tlog_mode mode);
+
+/* format what is still queued and stop the thread */
+void tlog_stop(void);
+
+void tlog_write(const struct tlog_site *site, const uint64_t *args);
+
+/* one line with records written and dropped */
+void tlog_print_stats(void);
+
+/* argument capture, every value travels as 8 bytes */
+static inline uint64_t tlog_int(long long v) { return (uint64_t)v; }
+static inline uint64_t tlog_dbl(double v) { union { double d; uint64_t u; } x = { v }; return x.u; }
+static inline uint64_t tlog_str(const char *s) { return (uint64_t)(uintptr_t)s; }
+
+#define TLOG_ARG(x) _Generic((x), float: tlog_dbl, double: tlog_dbl, \
+                             char *: tlog_str, const char *: tlog_str, \
+                             default: tlog_int)(x)
+
+#define TLOG_NARGS(...) TLOG_NARGS_(0, ##__VA_ARGS__, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define TLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, n, ...) n
+
+#define TLOG_CAT(a, b) TLOG_CAT_(a, b)
+#define TLOG_CAT_(a, b) a##b
+#define TLOG_MAP(...) TLOG_CAT(TLOG_MAP_, TLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define TLOG_MAP_0() 0
+#define TLOG_MAP_1(a) TLOG_ARG(a)
+#define TLOG_MAP_2(a, ...) TLOG_ARG(a), TLOG_MAP_1(__VA_ARGS__)
+#define TLOG_MAP_3(a, ...) TLOG_ARG(a), TLOG_MAP_2(__VA_ARGS__)
+#define TLOG_MAP_4(a, ...) TLOG_ARG(a), TLOG_MAP_3(__VA_ARGS__)
+#define TLOG_MAP_5(a, ...) TLOG_ARG(a), TLOG_MAP_4(__VA_ARGS__)
+#define TLOG_MAP_6(a, ...) TLOG_ARG(a), TLOG_MAP_5(__VA_ARGS__)
+#define TLOG_MAP_7(a, ...) TLOG_ARG(a), TLOG_MAP_6(__VA_ARGS__)
+#define TLOG_MAP_8(a, ...) TLOG_ARG(a), TLOG_MAP_7(__VA_ARGS__)
+#define TLOG_MAP_9(a, ...) TLOG_ARG(a), TLOG_MAP_8(__VA_ARGS__)
+#define TLOG_MAP_10(a, ...) TLOG_ARG(a), TLOG_MAP_9(__VA_ARGS__)
+
+#define TLOG_AT(lvl, fmt, ...) do {                                             \
+        if ((lvl) <= TLOG_LEVEL) {                                              \
+            static const struct tlog_site tlog_site_ = {                        \
+                fmt, lvl, TLOG_NARGS(__VA_ARGS__) };                            \
+            _Static_assert(TLOG_NARGS(__VA_ARGS__) <= TLOG_MAX_ARGS,            \
+                           "too many log arguments");                           \
+            tlog_write(&tlog_site_, (const uint64_t[]){ TLOG_MAP(__VA_ARGS__) }); \
+        }                                                                       \
+    } while (0)
+
+#define TLOG_ERROR(fmt, ...) TLOG_AT(TLOG_LVL_ERROR, fmt, ##__VA_ARGS__)
+#define TLOG_WARN(fmt, ...) TLOG_AT(TLOG_LVL_WARN, fmt, ##__VA_ARGS__)
+#define TLOG_INFO(fmt, ...) TLOG_AT(TLOG_LVL_INFO, fmt, ##__VA_ARGS__)
+#define TLOG_DEBUG(fmt, ...) TLOG_AT(TLOG_LVL_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif
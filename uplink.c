@@ -0,0 +1,845 @@
+/*
+ * uplink.c - sender thread, see uplink.h
+ *
+ * Without ENABLE_SERVER_SEND frames are consumed and discarded, so the
+ * ring behaves the same as on a node that forwards them.
+ */
+
+#define _GNU_SOURCE     /* sendmmsg */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "uplink.h"
+#include "backend.h"
+#include "tlog.h"
+
+#ifdef ENABLE_SERVER_SEND
+
+/**
+ * send all - used to send the half buffer 
+ */
+static int send_all(int socket_in, const char *buffer, size_t length, int flags)
+{
+    ssize_t n = -1;
+    const char *p = buffer;
+    //syslog(LOG_INFO,"send_all %zd  - %d \n", length, socket_in);
+    while (length > 0)
+    {
+        TLOG_DEBUG(" calling send %zu bytes at offset %zu \n", length, (size_t)(p - buffer));
+        n = send(socket_in, p, length, flags);
+        if( n < 0 ) {
+            //syslog(LOG_ERR,"Send failed - %zd", n);
+            return n;
+        }
+        TLOG_DEBUG("Send successful - %zd\n", n);
+        if (n == 0) break;
+        p += n;
+
+        length -= n;
+
+
+    }
+    return (n <= 0) ? -1 : 0;
+}
+
+/* time spent in one send, from start on */
+static void send_time(struct uplink *u, unsigned long long start)
+{
+    unsigned long long t = mono_ns();
+
+    pthread_mutex_lock(&u->send_lock);
+    hist_add(&u->send_lat, t - start);
+    pthread_mutex_unlock(&u->send_lock);
+}
+
+/* bytes of one plain frame on the wire */
+static size_t frame_len(const struct uplink *u)
+{
+    return u->cfg.version == WIRE_VERSION ? WIRE_V2_BYTES : FRAME_BYTES;
+}
+
+/* per frame encode times of a batch */
+static void encode_time(struct uplink *u, const unsigned long long *ns, unsigned n)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&u->send_lock);
+    for (i = 0; i < n; i++)
+        hist_add(&u->encode_lat, ns[i]);
+    pthread_mutex_unlock(&u->send_lock);
+}
+
+/*
+ * point iov[0..1] at the v2 frame of slot as it goes out: the ring slot
+ * itself, or its encoding in ef; returns the time spent encoding
+ */
+static unsigned long long frame_iov(struct uplink *u, struct frame_slot *slot,
+                                    struct uplink_enc_frame *ef, struct iovec *iov)
+{
+    unsigned long long t;
+    unsigned len;
+    size_t padded;
+
+    if (!u->cfg.key_every || slot->wire.device >= UPLINK_MAX_DEVICES) {
+        iov[0].iov_base = &slot->wire;
+        iov[0].iov_len = sizeof(slot->wire);
+        iov[1].iov_base = slot->data;
+        iov[1].iov_len = FRAME_BYTES;
+        return 0;
+    }
+    t = mono_ns();
+    ef->h = slot->wire;
+    len = delta_encode(&u->enc[slot->wire.device], u->cfg.key_every,
+                       wire_seq_count(slot->wire.seq), slot->data, ef->data,
+                       &ef->h.flags, &ef->h.reserved);
+    ef->h.payload_len = len;
+    padded = wire_frame_len(&ef->h) - sizeof(ef->h);
+    memset(ef->data + len, 0, padded - len);
+    iov[0].iov_base = &ef->h;
+    iov[0].iov_len = sizeof(ef->h);
+    iov[1].iov_base = ef->data;
+    iov[1].iov_len = padded;
+    atomic_fetch_add(&u->enc_frames, 1);
+    atomic_fetch_add(&u->enc_bytes, padded);
+    if (ef->h.flags == WIRE_F_KEY)
+        atomic_fetch_add(&u->keyframes, 1);
+    return mono_ns() - t;
+}
+
+/**
+ * @return - unsigned - frames that went out completely
+ * send_batch sends the frames described by the n iovecs, per of them to a
+ * frame, which point into the ring or the spool, with as few sendmsg()
+ * calls as the socket allows, so nothing is copied. MSG_MORE is set when
+ * more frames are queued behind the batch.
+ */
+static unsigned send_batch(struct uplink *u, int sock, struct iovec *iov,
+                           unsigned n, unsigned per, int more, int *err)
+{
+    struct msghdr msg;
+    unsigned first = 0;
+    size_t done;
+    ssize_t sent;
+    unsigned long long t;
+
+    *err = 0;
+    while (first < n) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov + first;
+        msg.msg_iovlen = n - first;
+        t = mono_ns();
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        send_time(u, t);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            *err = errno;
+            break;
+        }
+        atomic_fetch_add(&u->syscalls, 1);
+        atomic_fetch_add(&u->bytes_sent, sent);
+        /* skip what went out, a frame may have been cut in the middle */
+        for (done = sent; first < n && done >= iov[first].iov_len; first++)
+            done -= iov[first].iov_len;
+        if (first < n) {
+            iov[first].iov_base = (char *)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    /* a frame cut in the middle by an error is sent again after reconnect */
+    return first / per;
+}
+
+/* hold the first queued frame up to hold_ms while the batch fills */
+static unsigned fill_batch(struct uplink *u, unsigned n)
+{
+    unsigned long long deadline, now;
+
+    if (n >= u->cfg.batch || u->cfg.hold_ms == 0)
+        return n < u->cfg.batch ? n : u->cfg.batch;
+    deadline = mono_ns() + u->cfg.hold_ms * 1000000ULL;
+    while (n < u->cfg.batch && !atomic_load(&u->stop)) {
+        now = mono_ns();
+        if (now >= deadline)
+            break;
+        n = frame_ring_wait(u->ring, n, (int)((deadline - now + 999999) / 1000000));
+    }
+    return n < u->cfg.batch ? n : u->cfg.batch;
+}
+
+enum link_state { LINK_DOWN, LINK_CONNECTING, LINK_UP };
+
+/* connection to the collector, only touched by the sender thread */
+struct link {
+    enum link_state state;
+    int sock;
+    struct sockaddr_in addr;
+    unsigned backoff_ms;
+    unsigned long long next_try;    /* LINK_DOWN: next connect attempt */
+    unsigned long long deadline;    /* LINK_CONNECTING: give up */
+
+    /* clock exchange on this connection */
+    unsigned long long next_sync;
+    unsigned syncs;
+    uint64_t pending_t1;            /* request awaiting its reply, 0 = none */
+    struct wire_sync done;          /* the last exchange completed */
+    unsigned rx_fill;
+    _Alignas(8) char rx[WIRE_SYNC_BYTES];
+};
+
+static void link_down(struct uplink *u, struct link *l, const char *why)
+{
+    if (l->sock >= 0)
+        close(l->sock);
+    l->sock = -1;
+    if (l->state != LINK_UP)
+        atomic_fetch_add(&u->connect_fails, 1);
+    l->state = LINK_DOWN;
+    l->next_try = mono_ns() + l->backoff_ms * 1000000ULL;
+    fprintf(stderr, "uplink: %s:%d %s, retry in %u ms\n", u->ipaddr, u->cfg.port,
+            why, l->backoff_ms);
+    l->backoff_ms *= 2;
+    if (l->backoff_ms > UPLINK_BACKOFF_MAX_MS)
+        l->backoff_ms = UPLINK_BACKOFF_MAX_MS;
+}
+
+static void link_up(struct uplink *u, struct link *l)
+{
+    struct timeval tv = { UPLINK_CONNECT_TIMEOUT_MS / 1000, 0 };
+    int one = 1, ts = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    unsigned i;
+
+    /* sends block again, but a stalled collector turns into a send error */
+    fcntl(l->sock, F_SETFL, fcntl(l->sock, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(l->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    /* batches end without MSG_MORE, push them out right away; with
+     * clock replies coming back Nagle would hold frames for the delayed
+     * ACK of the collector, tens of ms */
+    if (u->cfg.batch > 1 || u->cfg.sync_ms)
+        setsockopt(l->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    l->state = LINK_UP;
+    l->backoff_ms = UPLINK_BACKOFF_MIN_MS;
+    /* the collector has no frames to decode deltas against yet */
+    for (i = 0; i < UPLINK_MAX_DEVICES; i++)
+        delta_enc_reset(&u->enc[i]);
+    /* clock exchange from scratch, replies are stamped by the kernel */
+    if (u->cfg.sync_ms)
+        setsockopt(l->sock, SOL_SOCKET, SO_TIMESTAMPING, &ts, sizeof(ts));
+    l->next_sync = mono_ns();
+    l->syncs = 0;
+    l->pending_t1 = 0;
+    memset(&l->done, 0, sizeof(l->done));
+    l->rx_fill = 0;
+    atomic_fetch_add(&u->connects, 1);
+    TLOG_INFO("uplink: connected to %s:%d\n", u->ipaddr, u->cfg.port);
+}
+
+/* start a non-blocking connect */
+static void link_connect(struct uplink *u, struct link *l)
+{
+    l->sock = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (l->sock < 0) {
+        link_down(u, l, strerror(errno));
+        return;
+    }
+    if (connect(l->sock, (struct sockaddr *)&l->addr, sizeof(l->addr)) == 0) {
+        link_up(u, l);
+    } else if (errno == EINPROGRESS) {
+        l->state = LINK_CONNECTING;
+        l->deadline = mono_ns() + UPLINK_CONNECT_TIMEOUT_MS * 1000000ULL;
+    } else {
+        link_down(u, l, strerror(errno));
+    }
+}
+
+/* see whether a pending connect finished */
+static void link_check(struct uplink *u, struct link *l)
+{
+    struct pollfd pfd = { l->sock, POLLOUT, 0 };
+    socklen_t len = sizeof(int);
+    int error = 0;
+
+    if (poll(&pfd, 1, 0) <= 0) {
+        if (mono_ns() >= l->deadline)
+            link_down(u, l, "connect timed out");
+        return;
+    }
+    if (getsockopt(l->sock, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+        error = errno;
+    if (error != 0)
+        link_down(u, l, strerror(error));
+    else
+        link_up(u, l);
+}
+
+static uint64_t real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the kernel receive time of msg, now when it carries none */
+static uint64_t rx_time(struct msghdr *msg)
+{
+    const struct scm_timestamping *ts;
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMPING) {
+            ts = (const struct scm_timestamping *)CMSG_DATA(cm);
+            if (ts->ts[0].tv_sec)
+                return ts->ts[0].tv_sec * 1000000000ULL + ts->ts[0].tv_nsec;
+        }
+    return real_ns();
+}
+
+/* a whole reply is in l->rx, received at t4 */
+static int sync_reply(struct uplink *u, struct link *l, uint64_t t4)
+{
+    const struct wire_hdr *h = (const struct wire_hdr *)l->rx;
+    const struct wire_sync *s = (const struct wire_sync *)(h + 1);
+    int64_t offset, rtt;
+
+    l->rx_fill = 0;
+    if (!wire_hdr_ok(h) || h->flags != WIRE_F_SYNC || wire_crc32c(s, sizeof(*s)) != h->crc)
+        return EPROTO;
+    /* a reply to an older request, its exchange is superseded */
+    if (!l->pending_t1 || s->t1 != l->pending_t1)
+        return 0;
+    l->pending_t1 = 0;
+    l->done = *s;
+    l->done.t4 = t4;
+    offset = ((int64_t)(s->t2 - s->t1) + (int64_t)(s->t3 - t4)) / 2;
+    rtt = (int64_t)(t4 - s->t1) - (int64_t)(s->t3 - s->t2);
+    atomic_fetch_add(&u->sync_replies, 1);
+    atomic_store(&u->sync_offset, offset);
+    pthread_mutex_lock(&u->send_lock);
+    hist_add(&u->sync_rtt, rtt > 0 ? rtt : 0);
+    pthread_mutex_unlock(&u->send_lock);
+    return 0;
+}
+
+/* read what the collector sent, returns 0 or the errno that broke the link */
+static int sync_read(struct uplink *u, struct link *l)
+{
+    _Alignas(struct cmsghdr) char ctl[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t n;
+    int err;
+
+    for (;;) {
+        iov.iov_base = l->rx + l->rx_fill;
+        iov.iov_len = sizeof(l->rx) - l->rx_fill;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        n = recvmsg(l->sock, &msg, MSG_DONTWAIT);
+        if (n == 0)
+            return ECONNRESET;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : errno;
+        }
+        l->rx_fill += n;
+        if (l->rx_fill == sizeof(l->rx) && (err = sync_reply(u, l, rx_time(&msg))) != 0)
+            return err;
+    }
+}
+
+/* send the next clock exchange request with the exchange before it */
+static int sync_send(struct uplink *u, struct link *l)
+{
+    struct {
+        struct wire_hdr h;
+        struct wire_sync s;
+    } req;
+    uint64_t t1;
+
+    req.s = l->done;
+    t1 = real_ns();
+    wire_fill_sync(&req.h, u->cfg.serial, mono_ns(), t1, &req.s);
+    if (send_all(l->sock, (const char *)&req, sizeof(req), MSG_NOSIGNAL) == -1)
+        return errno ? errno : EPIPE;
+    atomic_fetch_add(&u->syscalls, 1);
+    atomic_fetch_add(&u->bytes_sent, sizeof(req));
+    atomic_fetch_add(&u->syncs, 1);
+    l->pending_t1 = t1;
+    l->syncs++;
+    l->next_sync = mono_ns() +
+        (l->syncs < UPLINK_SYNC_BURST ? UPLINK_SYNC_BURST_MS : u->cfg.sync_ms) * 1000000ULL;
+    return 0;
+}
+
+/* move everything queued in the ring to the spool */
+static void spool_ring(struct uplink *u)
+{
+    unsigned i, n = frame_ring_count(u->ring);
+
+    struct frame_slot *slot;
+
+    for (i = 0; i < n; i++) {
+        slot = frame_ring_peek(u->ring, i);
+        spool_append(&u->spool, &slot->wire, slot->data);
+    }
+    frame_ring_release(u->ring, n);
+}
+
+/* send queued live frames, returns 0 or the errno that broke the link */
+static int send_live(struct uplink *u, int sock, unsigned n)
+{
+    struct iovec iov[2 * UPLINK_MAX_BATCH];
+    unsigned long long enc_ns[UPLINK_MAX_BATCH];
+    struct frame_slot *slot;
+    unsigned i, niov = 0, sent;
+    int err;
+
+    if (u->cfg.batch > 1 || u->cfg.version == WIRE_VERSION) {
+        n = fill_batch(u, n);
+        for (i = 0; i < n; i++) {
+            slot = frame_ring_peek(u->ring, i);
+            if (u->cfg.version == WIRE_VERSION) {
+                enc_ns[i] = frame_iov(u, slot, &u->encbuf[i], iov + niov);
+                niov += 2;
+                continue;
+            }
+            enc_ns[i] = 0;
+            iov[niov].iov_base = slot->data;
+            iov[niov++].iov_len = FRAME_BYTES;
+        }
+        if (u->cfg.key_every)
+            encode_time(u, enc_ns, n);
+        TLOG_DEBUG("Sending %u frames...\n", n);
+        sent = send_batch(u, sock, iov, niov, niov / n, frame_ring_count(u->ring) > n, &err);
+        if (sent) {
+            frame_ring_release(u->ring, sent);
+            atomic_fetch_add(&u->frames_sent, sent);
+            atomic_fetch_add(&u->batches[sent], 1);
+        }
+        return err;
+    }
+    slot = frame_ring_peek(u->ring, 0);
+    TLOG_DEBUG("Sending 256 bytes...\n");
+    errno = 0;
+    unsigned long long t = mono_ns();
+    int retSocVal = send_all(sock, (const char *)slot->data,
+                             sizeof(slot->data), MSG_CONFIRM | MSG_NOSIGNAL);
+    send_time(u, t);
+    atomic_fetch_add(&u->syscalls, 1);
+    if (retSocVal == -1)
+        return errno ? errno : EPIPE;
+    frame_ring_release(u->ring, 1);
+    atomic_fetch_add(&u->frames_sent, 1);
+    atomic_fetch_add(&u->bytes_sent, FRAME_BYTES);
+    atomic_fetch_add(&u->batches[1], 1);
+    return 0;
+}
+
+/* replay up to n spooled frames, oldest first, straight out of the spool */
+static int send_spooled(struct uplink *u, int sock, unsigned n)
+{
+    struct iovec iov[UPLINK_MAX_BATCH];
+    const struct spool_record *rec;
+    unsigned i, sent;
+    int err;
+
+    if (n > spool_count(&u->spool))
+        n = spool_count(&u->spool);
+    if (n > UPLINK_MAX_BATCH)
+        n = UPLINK_MAX_BATCH;
+    /* header and payload are contiguous in a spool record */
+    for (i = 0; i < n; i++) {
+        rec = spool_peek(&u->spool, i);
+        iov[i].iov_base = u->cfg.version == WIRE_VERSION ? (void *)&rec->wire
+                                                         : (void *)rec->data;
+        iov[i].iov_len = frame_len(u);
+    }
+    sent = send_batch(u, sock, iov, n, 1, spool_count(&u->spool) > n, &err);
+    if (sent) {
+        spool_consume(&u->spool, sent);
+        atomic_fetch_add(&u->frames_sent, sent);
+        atomic_fetch_add(&u->replayed, sent);
+        atomic_fetch_add(&u->batches[sent], 1);
+    }
+    return err;
+}
+
+static void *uplink_thread(void *arg)
+{
+    struct uplink *u = arg;
+    struct link l = { .state = LINK_DOWN, .sock = -1 };
+    unsigned long long now, last = mono_ns(), wake;
+    double tokens = 0;
+    unsigned n, burst;
+    int timeout, err;
+
+    l.addr.sin_family = AF_INET;
+    
+    /* Set port number, using htons function to use proper byte order */
+    l.addr.sin_port = htons(u->cfg.port);
+    
+    /* Set IP address to localhost */
+    l.addr.sin_addr.s_addr = inet_addr(u->ipaddr);
+    
+    /* Set all bits of the padding field to 0 */
+    memset(l.addr.sin_zero, '\0', sizeof l.addr.sin_zero);
+
+    l.backoff_ms = UPLINK_BACKOFF_MIN_MS;
+    l.next_try = last;
+    burst = u->cfg.batch > 1 ? u->cfg.batch : UPLINK_MAX_BATCH;
+
+    for (;;) {
+        now = mono_ns();
+        if (l.state == LINK_DOWN && now >= l.next_try)
+            link_connect(u, &l);
+        else if (l.state == LINK_CONNECTING)
+            link_check(u, &l);
+
+        n = frame_ring_count(u->ring);
+        if (atomic_load(&u->stop) && (l.state != LINK_UP || n == 0))
+            break;
+
+        /* drain token bucket, at most one burst is banked */
+        if (l.state == LINK_UP && u->cfg.drain_rate) {
+            tokens += (now - last) * 1e-9 * u->cfg.drain_rate;
+            if (tokens > burst)
+                tokens = burst;
+        } else {
+            tokens = u->cfg.drain_rate ? 0 : burst;
+        }
+        last = now;
+
+        err = 0;
+        if (l.state != LINK_UP) {
+            /* without a spool frames wait in the ring, the producer drops
+             * new ones once it is full */
+            if (u->spooling && n)
+                spool_ring(u);
+        } else if (n) {
+            err = send_live(u, l.sock, n);
+        } else if (u->spooling && spool_count(&u->spool) && tokens >= 1) {
+            n = (unsigned)tokens;
+            tokens -= n;
+            err = send_spooled(u, l.sock, n);
+        }
+        if (!err && l.state == LINK_UP && u->cfg.sync_ms) {
+            err = sync_read(u, &l);
+            if (!err && mono_ns() >= l.next_sync)
+                err = sync_send(u, &l);
+        }
+        if (err) {
+            fprintf(stderr, "socket() send failed: %s\n", strerror(err));
+            //syslog(LOG_ERR,  "socket() send failed: %s\n", strerror(errno));
+            atomic_fetch_add(&u->send_errors, 1);
+            /* unsent frames stay queued and go out after the reconnect */
+            link_down(u, &l, "link lost");
+            continue;
+        }
+
+        /* sleep until a frame arrives or the link or the spool needs us */
+        timeout = 1000;
+        if (l.state == LINK_DOWN) {
+            now = mono_ns();
+            wake = l.next_try > now ? (l.next_try - now + 999999) / 1000000 : 0;
+            if (wake < (unsigned long long)timeout)
+                timeout = (int)wake;
+        } else if (l.state == LINK_CONNECTING) {
+            timeout = 10;
+        } else if (u->spooling && spool_count(&u->spool)) {
+            if (tokens >= 1)
+                timeout = 0;
+            else if ((1 - tokens) * 1000 / u->cfg.drain_rate < timeout)
+                timeout = (int)((1 - tokens) * 1000 / u->cfg.drain_rate) + 1;
+        }
+        if (l.state == LINK_UP && u->cfg.sync_ms) {
+            now = mono_ns();
+            wake = l.next_sync > now ? (l.next_sync - now + 999999) / 1000000 : 0;
+            if (wake < (unsigned long long)timeout)
+                timeout = (int)wake;
+        }
+        /* frames left in the ring only count when they can be moved on */
+        n = l.state != LINK_UP && !u->spooling ? frame_ring_count(u->ring) : 0;
+        frame_ring_wait(u->ring, n, timeout);
+    }
+
+    /* whatever could not be sent is kept for the next run */
+    if (u->spooling) {
+        spool_ring(u);
+        spool_close(&u->spool);
+    }
+    if (l.sock >= 0)
+        close(l.sock);
+    return NULL;
+}
+
+/* the datagram socket, connected to the collector or the multicast group */
+static int udp_open(struct uplink *u)
+{
+    struct sockaddr_in addr;
+    int fd, ttl = u->cfg.mcast_ttl ? (int)u->cfg.mcast_ttl : 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(u->cfg.port);
+    if (inet_pton(AF_INET, u->ipaddr, &addr.sin_addr) != 1) {
+        fprintf(stderr, "uplink: bad address %s\n", u->ipaddr);
+        return -1;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("uplink: socket failed");
+        return -1;
+    }
+    if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr)))
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    /* connected, so sendmmsg() needs no address */
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "uplink: %s:%d %s\n", u->ipaddr, u->cfg.port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * send the first n queued frames as datagrams of up to batch frames, in
+ * one sendmmsg() unless a datagram fails, which is dropped
+ */
+static void send_datagrams(struct uplink *u, unsigned n)
+{
+    struct mmsghdr msgs[UPLINK_MAX_BATCH];
+    struct iovec iov[2 * UPLINK_MAX_BATCH];
+    unsigned long long enc_ns[UPLINK_MAX_BATCH];
+    unsigned i, nd = 0, first = 0, frames, dropped = 0;
+    unsigned long long t;
+    size_t bytes;
+    int ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < n; i++) {
+        if (i % u->cfg.batch == 0)
+            msgs[nd++].msg_hdr.msg_iov = iov + 2 * i;
+        enc_ns[i] = frame_iov(u, frame_ring_peek(u->ring, i), &u->encbuf[i], iov + 2 * i);
+        msgs[nd - 1].msg_hdr.msg_iovlen += 2;
+    }
+    if (u->cfg.key_every && nd)
+        encode_time(u, enc_ns, n);
+    while (first < nd) {
+        t = mono_ns();
+        ret = sendmmsg(u->udp_sock, msgs + first, nd - first, 0);
+        send_time(u, t);
+        atomic_fetch_add(&u->syscalls, 1);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            /* e.g. the refusal of an earlier datagram, only this one is lost */
+            if (atomic_fetch_add(&u->send_errors, 1) % 1000 == 0)
+                fprintf(stderr, "uplink: datagram send failed: %s\n", strerror(errno));
+            dropped += msgs[first++].msg_hdr.msg_iovlen / 2;
+            continue;
+        }
+        for (bytes = 0, frames = 0; ret > 0; ret--, first++) {
+            bytes += msgs[first].msg_len;
+            frames += msgs[first].msg_hdr.msg_iovlen / 2;
+            atomic_fetch_add(&u->datagrams, 1);
+        }
+        atomic_fetch_add(&u->bytes_sent, bytes);
+        atomic_fetch_add(&u->frames_sent, frames);
+    }
+    frame_ring_release(u->ring, n);
+    atomic_fetch_add(&u->batches[n], 1);
+    if (dropped)
+        atomic_fetch_add(&u->dropped, dropped);
+}
+
+static void *uplink_udp_thread(void *arg)
+{
+    struct uplink *u = arg;
+    unsigned n;
+
+    for (;;) {
+        n = frame_ring_wait(u->ring, 0, 1000);
+        if (n == 0) {
+            if (atomic_load(&u->stop))
+                break;
+            continue;
+        }
+        if (n < u->cfg.batch)
+            fill_batch(u, n);
+        /* everything queued by now goes in the same call */
+        n = frame_ring_count(u->ring);
+        if (n > UPLINK_MAX_BATCH)
+            n = UPLINK_MAX_BATCH;
+        TLOG_DEBUG("Sending %u frames as datagrams\n", n);
+        send_datagrams(u, n);
+    }
+    close(u->udp_sock);
+    return NULL;
+}
+
+#else
+
+static void *uplink_thread(void *arg)
+{
+    struct uplink *u = arg;
+    unsigned n;
+
+    for (;;) {
+        n = frame_ring_wait(u->ring, 0, 1000);
+        if (n == 0) {
+            if (atomic_load(&u->stop))
+                break;
+            continue;
+        }
+        frame_ring_release(u->ring, n);
+        atomic_fetch_add(&u->frames_sent, n);
+    }
+    return NULL;
+}
+
+#endif //ENABLE_SERVER_SEND
+
+int uplink_start(struct uplink *u, struct frame_ring *ring,
+                 const struct uplink_config *cfg)
+{
+    void *(*thread)(void *) = uplink_thread;
+
+    memset(u, 0, sizeof(*u));
+    u->udp_sock = -1;
+    pthread_mutex_init(&u->send_lock, NULL);
+    hist_init(&u->send_lat);
+    hist_init(&u->encode_lat);
+    hist_init(&u->sync_rtt);
+    u->ring = ring;
+    u->cfg = *cfg;
+    snprintf(u->ipaddr, sizeof(u->ipaddr), "%s", cfg->ipaddr);
+    u->cfg.ipaddr = u->ipaddr;
+    if (u->cfg.batch < 1)
+        u->cfg.batch = 1;
+    if (u->cfg.batch > UPLINK_MAX_BATCH)
+        u->cfg.batch = UPLINK_MAX_BATCH;
+    if (u->cfg.version != 1)
+        u->cfg.version = WIRE_VERSION;
+    if (u->cfg.sync_ms && (u->cfg.version != WIRE_VERSION || cfg->udp)) {
+        fprintf(stderr, "uplink: the clock exchange needs a version %d TCP uplink\n",
+                WIRE_VERSION);
+        return -1;
+    }
+    if (u->cfg.key_every && u->cfg.version != WIRE_VERSION) {
+        fprintf(stderr, "uplink: encoded frames need the version %d wire format\n",
+                WIRE_VERSION);
+        return -1;
+    }
+#ifdef ENABLE_SERVER_SEND
+    if (cfg->udp) {
+        if (cfg->spool_path || u->cfg.version != WIRE_VERSION) {
+            fprintf(stderr, "uplink: datagrams are never spooled and always version %d\n",
+                    WIRE_VERSION);
+            return -1;
+        }
+        if (u->cfg.batch > WIRE_DGRAM_MAX_FRAMES)
+            u->cfg.batch = WIRE_DGRAM_MAX_FRAMES;
+        u->udp_sock = udp_open(u);
+        if (u->udp_sock < 0)
+            return -1;
+        thread = uplink_udp_thread;
+    } else if (cfg->spool_path) {
+        if (spool_open(&u->spool, cfg->spool_path,
+                       cfg->spool_frames ? cfg->spool_frames : SPOOL_DEFAULT_FRAMES,
+                       SPOOL_DEFAULT_SYNC_BLOCKS) != 0)
+            return -1;
+        u->spooling = 1;
+    }
+#endif
+    if (pthread_create(&u->thread, NULL, thread, u) != 0) {
+        perror("could not create sender thread");
+        if (u->spooling)
+            spool_close(&u->spool);
+        if (u->udp_sock >= 0)
+            close(u->udp_sock);
+        return -1;
+    }
+    return 0;
+}
+
+void uplink_stop(struct uplink *u)
+{
+    atomic_store(&u->stop, 1);
+    frame_ring_wake(u->ring);
+    pthread_join(u->thread, NULL);
+}
+
+void uplink_print_stats(struct uplink *u)
+{
+    unsigned long calls = atomic_load(&u->syscalls), nb = 0, frames = 0, c;
+    unsigned i;
+
+    printf("Uplink: %lu frames sent (%lu replayed), %lu send errors, %lu connects, "
+           "%lu failed connects\n",
+           atomic_load(&u->frames_sent), atomic_load(&u->replayed),
+           atomic_load(&u->send_errors), atomic_load(&u->connects),
+           atomic_load(&u->connect_fails));
+    for (i = 1; i <= UPLINK_MAX_BATCH; i++) {
+        c = atomic_load(&u->batches[i]);
+        nb += c;
+        frames += c * i;
+    }
+    printf("Uplink: %lu batches, %.2f frames per batch, %.1f bytes per syscall\n",
+           nb, nb ? (double)frames / nb : 0,
+           calls ? (double)atomic_load(&u->bytes_sent) / calls : 0);
+    if (u->cfg.udp) {
+        c = atomic_load(&u->datagrams);
+        printf("Uplink: udp, %lu datagrams, %.2f frames per datagram, %.2f datagrams "
+               "per sendmmsg, %lu frames dropped\n", c,
+               c ? (double)(atomic_load(&u->frames_sent)) / c : 0,
+               calls ? (double)c / calls : 0, atomic_load(&u->dropped));
+    }
+    if (u->cfg.batch > 1) {
+        printf("Uplink: batch sizes");
+        for (i = 1; i <= u->cfg.batch; i++)
+            if ((c = atomic_load(&u->batches[i])))
+                printf(" %u:%lu", i, c);
+        printf("\n");
+    }
+    if (u->cfg.key_every) {
+        c = atomic_load(&u->enc_frames);
+        printf("Uplink: %lu frames encoded, %lu keyframes, %.1f payload bytes per frame, "
+               "%.2fx smaller (%.2fx with headers)\n", c, atomic_load(&u->keyframes),
+               c ? (double)atomic_load(&u->enc_bytes) / c : 0,
+               c ? (double)c * FRAME_BYTES / atomic_load(&u->enc_bytes) : 0,
+               c ? (double)c * WIRE_V2_BYTES /
+                   (atomic_load(&u->enc_bytes) + c * sizeof(struct wire_hdr)) : 0);
+    }
+    pthread_mutex_lock(&u->send_lock);
+    if (u->send_lat.count)
+        hist_print(&u->send_lat, stdout, "Uplink: send", 1e6, "ms");
+    if (u->encode_lat.count)
+        hist_print(&u->encode_lat, stdout, "Uplink: encode", 1e3, "us");
+    if (u->cfg.sync_ms) {
+        printf("Uplink: %lu clock exchanges, %lu replies, collector clock %+.3f ms off\n",
+               atomic_load(&u->syncs), atomic_load(&u->sync_replies),
+               atomic_load(&u->sync_offset) / 1e6);
+        if (u->sync_rtt.count)
+            hist_print(&u->sync_rtt, stdout, "Uplink: clock exchange round trip", 1e6, "ms");
+    }
+    pthread_mutex_unlock(&u->send_lock);
+    /* the spool belongs to the sender thread until it is joined */
+    if (u->spooling && atomic_load(&u->stop))
+        spool_print_stats(&u->spool);
+}
@@ -0,0 +1,140 @@
+/*
+ * uplink.h - sender thread forwarding location frames to the collector
+ *
+ * The acquisition loop only publishes frames into the frame ring; this
+ * thread owns the socket, so a slow or absent collector (connect retries,
+ * blocking sends) never stalls reading the tracker.
+ *
+ * With batch > 1 frames are coalesced: up to batch queued frames go out
+ * in one sendmsg(), and a frame is held at most hold_ms waiting for the
+ * batch to fill, which bounds the latency added.
+ *
+ * Connecting never blocks the thread: a non-blocking connect() is checked
+ * while frames keep arriving, and failed attempts back off exponentially
+ * from UPLINK_BACKOFF_MIN_MS to UPLINK_BACKOFF_MAX_MS. With a spool_path
+ * frames produced while the link is down go to the on-disk spool
+ * (spool.h) instead of piling up in the ring; once connected the spool is
+ * replayed in order at up to drain_rate frames per second, next to the
+ * live frames, which always go first.
+ *
+ * Frames go out in the version 2 wire format (wire.h), header and payload
+ * straight from the ring slot; version 1 sends the bare 256 byte frames
+ * for collectors that predate it.
+ *
+ * With udp set the frames go out as datagrams instead (wire.h), up to
+ * batch (at most WIRE_DGRAM_MAX_FRAMES) frames each and everything queued
+ * in one sendmmsg(). There is no connection to lose and nothing is
+ * resent or spooled: a frame whose send fails is dropped and counted, so
+ * a collector that is slow or away costs lost frames, never a stall.
+ * The address may be a multicast group, which every collector that
+ * joined it receives.
+ *
+ * With key_every frames go out encoded (delta.h): a keyframe, then deltas
+ * against the frame before of the same tracker, a keyframe again every
+ * key_every frames and first thing on every new connection. Frames are
+ * encoded by this thread as they are sent; spooled frames are replayed
+ * plain.
+ *
+ * With sync_ms the thread also exchanges clock messages with the
+ * collector over the connection (wire.h): UPLINK_SYNC_BURST requests
+ * UPLINK_SYNC_BURST_MS apart on every new connection, then one every
+ * sync_ms, each carrying the exchange before it, which the reply
+ * completed with the kernel receive time of the reply (SO_TIMESTAMPING),
+ * so a reply read late costs nothing. The collector keeps the estimate;
+ * the thread only counts the exchanges and keeps their round trips and
+ * the last offset for the stats. Not with udp or version 1.
+ */
+
+#ifndef TRAKRAY_UPLINK_H
+#define TRAKRAY_UPLINK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "frame_ring.h"
+#include "spool.h"
+#include "hist.h"
+#include "delta.h"
+
+#define UPLINK_MAX_BATCH 64
+#define UPLINK_BACKOFF_MIN_MS 100
+#define UPLINK_BACKOFF_MAX_MS 30000
+#define UPLINK_CONNECT_TIMEOUT_MS 5000  /* also bounds a blocked send */
+#define UPLINK_MAX_DEVICES 8            /* trackers encoded, frames of others go plain */
+#define UPLINK_SYNC_BURST 4
+#define UPLINK_SYNC_BURST_MS 100
+
+struct uplink_config {
+    const char *ipaddr;
+    int port;
+    unsigned batch;         /* frames per send, 1 = one send() per frame */
+    unsigned hold_ms;       /* longest a frame waits for its batch to fill */
+    const char *spool_path; /* NULL: no spool, frames wait in the ring */
+    unsigned spool_frames;  /* spool size, 0 = SPOOL_DEFAULT_FRAMES */
+    unsigned drain_rate;    /* spooled frames per second, 0 = no limit */
+    unsigned version;       /* wire format, 1 = bare frames, else WIRE_VERSION */
+    int udp;                /* datagrams instead of a TCP stream */
+    unsigned mcast_ttl;     /* hops of multicast datagrams, 0 = 1 */
+    unsigned key_every;     /* encode, a keyframe every so many, 0 = plain */
+    unsigned sync_ms;       /* clock exchange every so often, 0 = none */
+    uint32_t serial;        /* node serial, for the clock exchange messages */
+};
+
+/* an encoded frame as it goes out */
+struct uplink_enc_frame {
+    struct wire_hdr h;
+    unsigned char data[(WIRE_ENC_MAX + 7) & ~7];
+};
+
+struct uplink {
+    struct frame_ring *ring;
+    struct uplink_config cfg;
+    char ipaddr[64];
+
+    pthread_t thread;
+    atomic_int stop;
+    int spooling;           /* spool is open, owned by the thread */
+    int udp_sock;
+    struct delta_enc enc[UPLINK_MAX_DEVICES];
+    struct uplink_enc_frame encbuf[UPLINK_MAX_BATCH];
+    struct spool spool;
+
+    /* counters, written by the sender thread */
+    atomic_ulong frames_sent;
+    atomic_ulong send_errors;
+    atomic_ulong connects;
+    atomic_ulong connect_fails;
+    atomic_ulong replayed;                        /* sent out of the spool */
+    atomic_ulong syscalls;
+    atomic_ulong bytes_sent;
+    atomic_ulong datagrams;
+    atomic_ulong dropped;                         /* lost to failed datagram sends */
+    atomic_ulong enc_frames;
+    atomic_ulong keyframes;
+    atomic_ulong enc_bytes;                       /* encoded payloads, padding included */
+    atomic_ulong batches[UPLINK_MAX_BATCH + 1];   /* by frames per batch */
+    atomic_ulong syncs;                           /* clock exchange requests */
+    atomic_ulong sync_replies;
+    atomic_long sync_offset;                      /* collector minus node, last exchange, ns */
+
+    /* wall clock time per send call, ns; the lock is only ever contended
+     * while the stats are printed */
+    pthread_mutex_t send_lock;
+    struct hist send_lat;
+    struct hist encode_lat;                       /* per frame, ns */
+    struct hist sync_rtt;                         /* clock exchange round trip, ns */
+};
+
+/* start the sender thread for ring, returns 0 or -1 */
+int uplink_start(struct uplink *u, struct frame_ring *ring,
+                 const struct uplink_config *cfg);
+
+/*
+ * send what is still queued while connected, spool it otherwise, and
+ * join the thread
+ */
+void uplink_stop(struct uplink *u);
+
+void uplink_print_stats(struct uplink *u);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * wire.c - node to collector wire format, see wire.h
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "wire.h"
+
+/* CRC-32C (Castagnoli), reflected, slicing by 4 */
+static uint32_t crc_table[4][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = c & 1 ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 4; j++)
+            crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^ crc_table[0][crc_table[j - 1][i] & 0xff];
+}
+
+uint32_t wire_crc32c(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint32_t c = 0xffffffffu;
+
+    pthread_once(&crc_once, crc_init);
+    for (; len >= 4; len -= 4, p += 4) {
+        c ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        c = crc_table[3][c & 0xff] ^ crc_table[2][(c >> 8) & 0xff] ^
+            crc_table[1][(c >> 16) & 0xff] ^ crc_table[0][c >> 24];
+    }
+    while (len--)
+        c = (c >> 8) ^ crc_table[0][(c ^ *p++) & 0xff];
+    return ~c;
+}
+
+uint32_t wire_new_run(void)
+{
+    struct timespec ts;
+    uint32_t run = 0;
+
+    /* without entropy yet, the boot time and pid still differ per start */
+    if (getrandom(&run, sizeof(run), GRND_NONBLOCK) != sizeof(run)) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        run = (uint32_t)ts.tv_nsec ^ (uint32_t)ts.tv_sec << 20 ^ (uint32_t)getpid() << 8;
+    }
+    return run ? run : 1;
+}
+
+void wire_fill(struct wire_hdr *h, uint32_t serial, uint16_t device, uint64_t seq,
+               uint64_t mono_ns, uint64_t real_ns, const unsigned char *payload)
+{
+    h->magic = WIRE_MAGIC;
+    h->version = WIRE_VERSION;
+    h->hdr_len = sizeof(*h);
+    h->payload_len = WIRE_PAYLOAD;
+    h->serial = serial;
+    h->crc = wire_crc32c(payload, WIRE_PAYLOAD);
+    h->seq = seq;
+    h->mono_ns = mono_ns;
+    h->real_ns = real_ns;
+    h->device = device;
+    h->flags = 0;
+    h->reserved = 0;
+}
+
+void wire_fill_sync(struct wire_hdr *h, uint32_t serial, uint64_t mono_ns, uint64_t real_ns,
+                    const struct wire_sync *sync)
+{
+    h->magic = WIRE_MAGIC;
+    h->version = WIRE_VERSION;
+    h->hdr_len = sizeof(*h);
+    h->payload_len = sizeof(*sync);
+    h->serial = serial;
+    h->crc = wire_crc32c(sync, sizeof(*sync));
+    h->seq = 0;
+    h->mono_ns = mono_ns;
+    h->real_ns = real_ns;
+    h->device = 0;
+    h->flags = WIRE_F_SYNC;
+    h->reserved = 0;
+}
+
+int wire_hdr_ok(const struct wire_hdr *h)
+{
+    if (h->magic != WIRE_MAGIC || h->version != WIRE_VERSION || h->hdr_len != sizeof(*h))
+        return 0;
+    if (h->flags == 0)
+        return h->payload_len == WIRE_PAYLOAD;
+    if (h->flags == WIRE_F_SYNC)
+        return h->payload_len == sizeof(struct wire_sync);
+    return (h->flags == WIRE_F_KEY || h->flags == WIRE_F_DELTA) &&
+           h->payload_len > 0 && h->payload_len <= WIRE_ENC_MAX;
+}
@@ -0,0 +1,135 @@
+/*
+ * wire.h - node to collector wire format
+ *
+ * Version 1 is the legacy stream of bare 256 byte frames. A version 2
+ * frame is a struct wire_hdr followed by the 256 byte payload, so the
+ * collector can tell lost frames from late ones (seq), see how stale a
+ * frame is (acquisition timestamps) and catch corruption (crc). All
+ * fields are little endian, the byte order of the Pi and of x86.
+ *
+ * seq carries the run id in its upper half and a counter from 0 in the
+ * lower half. The run id is drawn at random at every start of the node
+ * (wire_new_run), never 0. It is not the start time: a Pi has no RTC and
+ * may start on a stale clock, and two starts can fall in one second.
+ * Run ids are not ordered, so any change of run id is a restart, and
+ * frames of the run before it (stragglers, a spool of an earlier run) are
+ * recognised as late.
+ *
+ * device tells the trackers of a node with several apart; the sequence
+ * numbers count per node serial and device.
+ *
+ * The collector detects the version from the first four bytes of a
+ * connection: WIRE_MAGIC starts a version 2 stream, anything else is
+ * taken as legacy frames. hdr_len lets later versions grow the header.
+ *
+ * flags tells how the payload is coded. 0 is the plain 256 bytes. With
+ * WIRE_F_KEY or WIRE_F_DELTA it is a compact encoding (delta.h) of
+ * payload_len bytes, at most WIRE_ENC_MAX, and for a delta reserved holds
+ * the sequence counter of the frame of the same tracker it refers to. crc
+ * always covers the 256 byte frame, so it checks the reconstruction too.
+ * An encoded payload is padded with zeros to a multiple of 8 bytes on the
+ * wire (wire_frame_len), so headers stay aligned in a receive buffer.
+ *
+ * A message with WIRE_F_SYNC carries no frame but a struct wire_sync,
+ * one step of the clock exchange between node and collector (uplink.h,
+ * clocksync.h), and goes both ways over a TCP connection: the node sends
+ * its request time t1 in real_ns and the last exchange it completed, the
+ * collector answers at once with t1, the kernel receive time of the
+ * request t2 and its send time t3; the node's receive time t4 completes
+ * it. crc covers the wire_sync. Collectors that predate it close the
+ * connection, so nodes only send it when told to.
+ *
+ * Over UDP a datagram carries 1 to WIRE_DGRAM_MAX_FRAMES version 2
+ * frames back to back and nothing else; there are no legacy datagrams.
+ * Four frames are the most that fit an Ethernet MTU unfragmented.
+ */
+
+#ifndef TRAKRAY_WIRE_H
+#define TRAKRAY_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIRE_MAGIC 0x324b5254u          /* "TRK2" */
+#define WIRE_VERSION 2
+#define WIRE_PAYLOAD 256
+#define WIRE_SERIAL_INDEX 244           /* node serial in the frame, little endian */
+
+struct wire_hdr {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t hdr_len;                    /* sizeof(struct wire_hdr) for version 2 */
+    uint16_t payload_len;               /* WIRE_PAYLOAD */
+    uint32_t serial;                    /* node serial, low 32 bits */
+    uint32_t crc;                       /* CRC-32C of the payload */
+    uint64_t seq;                       /* run id << 32 | frame counter */
+    uint64_t mono_ns;                   /* acquisition, CLOCK_MONOTONIC of the node */
+    uint64_t real_ns;                   /* the same instant in CLOCK_REALTIME */
+    uint16_t device;                    /* tracker of the node, 0 for the first */
+    uint16_t flags;                     /* payload coding, 0 = plain */
+    uint32_t reserved;                  /* WIRE_F_DELTA: counter of its base, else 0 */
+};
+
+_Static_assert(sizeof(struct wire_hdr) == 48, "wire header layout");
+
+#define WIRE_V2_BYTES (sizeof(struct wire_hdr) + WIRE_PAYLOAD)
+#define WIRE_DGRAM_MAX_FRAMES 4         /* 4 * 304 bytes < 1472 */
+#define WIRE_ENC_MAX (WIRE_PAYLOAD + WIRE_PAYLOAD / 128)
+
+/* flags */
+#define WIRE_F_KEY 0x1                  /* encoded on its own */
+#define WIRE_F_DELTA 0x2                /* encoded against an earlier frame */
+#define WIRE_F_SYNC 0x4                 /* clock exchange, no frame */
+
+/* payload of a WIRE_F_SYNC message, CLOCK_REALTIME ns, 0 = not taken */
+struct wire_sync {
+    uint64_t t1;                        /* node sent the request */
+    uint64_t t2;                        /* collector received it */
+    uint64_t t3;                        /* collector sent the reply */
+    uint64_t t4;                        /* node received the reply */
+};
+
+#define WIRE_SYNC_BYTES (sizeof(struct wire_hdr) + sizeof(struct wire_sync))
+
+/* bytes of the frame behind h on the wire, header and padded payload */
+static inline size_t wire_frame_len(const struct wire_hdr *h)
+{
+    return sizeof(*h) + ((h->payload_len + 7u) & ~7u);
+}
+
+static inline uint32_t wire_seq_run(uint64_t seq)
+{
+    return (uint32_t)(seq >> 32);
+}
+
+static inline uint32_t wire_seq_count(uint64_t seq)
+{
+    return (uint32_t)seq;
+}
+
+/* the node serial b28 puts into the 256 byte frame */
+static inline uint32_t wire_frame_serial(const unsigned char *frame)
+{
+    const unsigned char *p = frame + WIRE_SERIAL_INDEX;
+
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint32_t wire_crc32c(const void *buf, size_t len);
+
+/* a run id for a new start of the node, random and never 0 */
+uint32_t wire_new_run(void);
+
+/* fill h for payload, timestamps are taken by the caller */
+void wire_fill(struct wire_hdr *h, uint32_t serial, uint16_t device, uint64_t seq,
+               uint64_t mono_ns, uint64_t real_ns, const unsigned char *payload);
+
+/* the header of a clock exchange message carrying sync */
+void wire_fill_sync(struct wire_hdr *h, uint32_t serial, uint64_t mono_ns, uint64_t real_ns,
+                    const struct wire_sync *sync);
+
+/* 1 if h starts a valid version 2 frame, plain or encoded, of a supported size,
+ * or a clock exchange message */
+int wire_hdr_ok(const struct wire_hdr *h);
+
+#endif